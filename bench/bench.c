@@ -0,0 +1,940 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdlib.h>     /* exit, strtol */
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset */
+#include <time.h>       /* clock_gettime */
+#include <unistd.h>     /* getopt, dup, dup2, rmdir */
+#include <fcntl.h>      /* open */
+#include <dirent.h>     /* opendir, readdir */
+#include "checksum.h"
+#include "hc32boot.h"
+#include "probe.h"
+#include "devcache.h"
+#include "shell.h"
+#include "manifest.h"
+#include "patch.h"
+#include "flashsim.h"
+
+//--------------------------------------------
+// All results are printed as JSON lines, one object per measurement:
+//   {"bench":"sum8","size":521,"ops":...,"ns_per_op":...,"mb_per_s":...}
+//   {"bench":"e2e_write","baudrate":...,"latency_us":...,"bytes":...,"seconds":...,"bytes_per_s":...,"result":"ok"}
+//   {"bench":"gang","backend":"poll","sessions":...,"bytes":...,"seconds":...,"cpu_seconds":...,"failed":0}
+
+//--------------------------------------------
+static double min_seconds = 0.2;
+static volatile uint32_t sink;
+static char capture_text[0x4000];
+
+//--------------------------------------------
+#define CRC16_INIT       0xffff
+
+//--------------------------------------------
+static uint16_t crc16_table[256];
+
+//--------------------------------------------
+// CRC-16/CCITT-FALSE (poly 0x1021), the byte-wise table kernel to compare sum8 and crc32 with
+static void crc16_init(void)
+{
+	for (uint32_t cnt = 0; cnt < 256; cnt++)
+	{
+		uint16_t crc = (uint16_t)(cnt << 8);
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+		}
+		crc16_table[cnt] = crc;
+	}
+}
+
+//--------------------------------------------
+static uint16_t crc16(uint16_t crc, const void *buf, size_t len)
+{
+	const uint8_t *ptr = buf;
+
+	while (len--)
+	{
+		crc = (uint16_t)(crc << 8) ^ crc16_table[(crc >> 8) ^ *ptr++];
+	}
+	return crc;
+}
+
+//--------------------------------------------
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//--------------------------------------------
+// CPU time of the host side only, the simulators are separate processes
+static double cpu_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//--------------------------------------------
+static void report_micro(const char *name, size_t size, uint64_t ops, double seconds)
+{
+	printf("{\"bench\":\"%s\",\"size\":%zu,\"ops\":%llu,\"ns_per_op\":%.1f,\"mb_per_s\":%.1f}\n",
+		name, size, (unsigned long long)ops, seconds * 1e9 / ops, (double)size * ops / seconds / 1e6);
+	fflush(stdout);
+}
+
+//--------------------------------------------
+// Repeats the statement until min_seconds elapse, doubling the batch size.
+#define MICRO(name, size, stmt) \
+	do { \
+		uint64_t ops = 0; \
+		uint64_t batch = 16; \
+		double start = now(); \
+		double elapsed; \
+		for (;;) \
+		{ \
+			for (uint64_t cnt = 0; cnt < batch; cnt++) \
+			{ \
+				stmt; \
+			} \
+			ops += batch; \
+			elapsed = now() - start; \
+			if (elapsed >= min_seconds) \
+			{ \
+				break; \
+			} \
+			batch *= 2; \
+		} \
+		report_micro(name, size, ops, elapsed); \
+	} while (0)
+
+//--------------------------------------------
+static void bench_micro(void)
+{
+	static uint8_t data[HC32L110_FLASH_SIZE];
+	static const size_t sizes[] = { HC32BOOT_FRAME_HEADER_SIZE + 1, HC32BOOT_FRAME_MAX_SIZE, HC32L110_FLASH_SIZE };
+	uint8_t frame[HC32BOOT_FRAME_MAX_SIZE];
+	hc32boot_resp_t resp;
+	hc32boot_image_t image;
+	size_t frame_len;
+
+	for (size_t cnt = 0; cnt < sizeof(data); cnt++)
+	{
+		data[cnt] = (uint8_t)(cnt * 131 + 7);
+	}
+	crc16_init();
+
+	for (size_t cnt = 0; cnt < sizeof(sizes) / sizeof(sizes[0]); cnt++)
+	{
+		size_t size = sizes[cnt];
+		MICRO("sum8", size, sink += sum8(data, size));
+		MICRO("crc16", size, sink += crc16(CRC16_INIT, data, size));
+		MICRO("crc32", size, sink += crc32(CRC32_INIT, data, size));
+	}
+
+	MICRO("frame_build_read", HC32BOOT_FRAME_HEADER_SIZE + 1,
+		sink += (uint32_t)hc32boot_frame_build(frame, HC32BOOT_CMD_READ, (uint32_t)cnt, READ_PACKET_MAX_DATA_SIZE, NULL));
+	MICRO("frame_build_write", HC32BOOT_FRAME_MAX_SIZE,
+		sink += (uint32_t)hc32boot_frame_build(frame, HC32BOOT_CMD_WRITE, (uint32_t)cnt, WRITE_PACKET_MAX_DATA_SIZE, data));
+	MICRO("image_prepare", HC32L110_FLASH_SIZE,
+		sink += hc32boot_image_prepare(&image, 0, data, HC32L110_FLASH_SIZE, 0);
+		hc32boot_image_free(&image));
+
+	// a read response has the same layout as a write request
+	frame_len = hc32boot_frame_build(frame, 0, 0, READ_PACKET_MAX_DATA_SIZE, data);
+	MICRO("resp_decode_read", frame_len,
+		hc32boot_resp_init(&resp);
+		hc32boot_resp_feed(&resp, frame, HC32BOOT_FRAME_HEADER_SIZE);
+		sink += hc32boot_resp_feed(&resp, frame + HC32BOOT_FRAME_HEADER_SIZE, frame_len - HC32BOOT_FRAME_HEADER_SIZE));
+	frame_len = hc32boot_frame_build(frame, 0, 0, 0, NULL);
+	MICRO("resp_decode_ack", frame_len,
+		hc32boot_resp_init(&resp);
+		hc32boot_resp_feed(&resp, frame, HC32BOOT_FRAME_HEADER_SIZE);
+		sink += hc32boot_resp_feed(&resp, frame + HC32BOOT_FRAME_HEADER_SIZE, 1));
+}
+
+//--------------------------------------------
+static void report_e2e(const char *name, const flashsim_config_t *cfg, size_t bytes, double seconds, int res)
+{
+	printf("{\"bench\":\"%s\",\"baudrate\":%d,\"latency_us\":%d,\"bytes\":%zu,\"seconds\":%.4f,\"bytes_per_s\":%.1f,\"result\":\"%s\"}\n",
+		name, cfg->baudrate, cfg->latency_us, bytes, seconds, seconds > 0 ? bytes / seconds : 0, res ? "error" : "ok");
+	fflush(stdout);
+}
+
+//--------------------------------------------
+static int session_run(const char *name, hc32boot_t *session, const flashsim_config_t *cfg, int type, uint32_t size, uint8_t *data,
+	const hc32boot_image_t *image)
+{
+	hc32boot_op_t op = { 0 };
+	double start;
+	int res;
+
+	op.type = type;
+	op.size = size;
+	op.data = data;
+	op.image = image;
+	start = now();
+	res = hc32boot_submit(session, &op) ? -1 : hc32boot_wait(session);
+	report_e2e(name, cfg, size, now() - start, res);
+	return res;
+}
+
+//--------------------------------------------
+// -i: the UID of the first simulator and the sector sums of the image just written
+static int bench_identify(hc32boot_t *session, const flashsim_config_t *cfg, const uint8_t *image)
+{
+	uint8_t uid[HC32L110_UID_SIZE];
+	probe_t probe;
+	uint16_t sum;
+	double start;
+	int res;
+
+	start = now();
+	res = probe_run(session, &probe);
+	report_e2e("e2e_identify", cfg, HC32L110_FLASH_SIZE, now() - start, res);
+	if (res)
+	{
+		return -1;
+	}
+	flashsim_memory(0, HC32L110_UID_ADDR, uid, sizeof(uid));
+	if (memcmp(probe.uid, uid, sizeof(uid)))
+	{
+		fprintf(stderr, "The identify UID differs from the simulated one.\n");
+		return -1;
+	}
+	for (int cnt = 0; cnt < PROBE_SECTOR_CNT; cnt++)
+	{
+		sum = 0;
+		for (int cnt_b = 0; cnt_b < HC32L110_SECTOR_SIZE; cnt_b++)
+		{
+			sum += image[cnt * HC32L110_SECTOR_SIZE + cnt_b];
+		}
+		if (probe.sector_sum[cnt] != sum)
+		{
+			fprintf(stderr, "The identify sum of sector %d differs from the image.\n", cnt);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// The modules behind the command line options print their progress, it goes
+// to a file while such a case runs and the output stays JSON lines only.
+static int capture_begin(const char *dir, int *saved_fd)
+{
+	char path[256];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/stdout", dir);
+	fflush(stdout);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 || (*saved_fd = dup(STDOUT_FILENO)) < 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+	return 0;
+}
+
+//--------------------------------------------
+// returns what was printed since capture_begin()
+static const char *capture_end(const char *dir, int saved_fd)
+{
+	char path[256];
+	FILE *file;
+	size_t len = 0;
+
+	fflush(stdout);
+	dup2(saved_fd, STDOUT_FILENO);
+	close(saved_fd);
+	snprintf(path, sizeof(path), "%s/stdout", dir);
+	if ((file = fopen(path, "r")) != NULL)
+	{
+		len = fread(capture_text, 1, sizeof(capture_text) - 1, file);
+		fclose(file);
+	}
+	capture_text[len] = '\0';
+	return capture_text;
+}
+
+//--------------------------------------------
+static void scratch_remove(const char *dir)
+{
+	char path[256];
+	struct dirent *entry;
+	DIR *handle;
+
+	if ((handle = opendir(dir)) != NULL)
+	{
+		while ((entry = readdir(handle)) != NULL)
+		{
+			// a name that does not fit is not one of the bench files
+			if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..") &&
+				snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) < (int)sizeof(path))
+			{
+				remove(path);
+			}
+		}
+		closedir(handle);
+	}
+	rmdir(dir);
+}
+
+//--------------------------------------------
+// -D: a board without a record, the record confirmed by a matching sum, and a
+// sector erased behind the cache's back, the sum does not match any more
+static int bench_devcache(hc32boot_t *session, const flashsim_config_t *cfg, const hc32boot_image_t *image, const char *dir)
+{
+	static const struct
+	{
+		const char *name;
+		const char *expect;      // in the progress messages
+	} cases[] = {
+		{ "e2e_devcache_unknown", "unknown state, 32 of 32 sectors" },
+		{ "e2e_devcache_match", "device cache confirmed, 0 of 32 sectors" },
+		{ "e2e_devcache_mismatch", "has changed since the last write" },
+	};
+	hc32boot_op_t op = { 0 };
+	double start;
+	int saved_fd;
+	int res = 0;
+
+	for (size_t cnt = 0; cnt < sizeof(cases) / sizeof(cases[0]) && !res; cnt++)
+	{
+		if (cnt == 2)
+		{
+			op.type = HC32BOOT_OP_ERASE;
+			op.addr = 3 * HC32L110_SECTOR_SIZE;
+			op.size = HC32L110_SECTOR_SIZE;
+			if (hc32boot_submit(session, &op) || hc32boot_wait(session))
+			{
+				return -1;
+			}
+		}
+		if (capture_begin(dir, &saved_fd))
+		{
+			return -1;
+		}
+		start = now();
+		res = devcache_write(session, dir, image, 1);
+		res |= strstr(capture_end(dir, saved_fd), cases[cnt].expect) == NULL;
+		report_e2e(cases[cnt].name, cfg, image->size, now() - start, res);
+	}
+	if (res)
+	{
+		fprintf(stderr, "%s", capture_text);
+	}
+	return res ? -1 : 0;
+}
+
+//--------------------------------------------
+// -r with a region or -x: the SRAM and the UID by name, a peripheral address
+// outside every region, all of them compared with the simulated memory map
+static int bench_regions(hc32boot_t *session, const flashsim_config_t *cfg)
+{
+	static const struct
+	{
+		const char *name;
+		const char *region;      // NULL: a raw address
+		uint32_t addr;
+		uint32_t size;
+	} cases[] = {
+		{ "e2e_read_sram", "sram", 0, 0 },
+		{ "e2e_read_uid", "uid", 0, 0 },
+		{ "e2e_read_raw", NULL, 0x40020000, 0x40 },
+	};
+	static uint8_t data[HC32L110_SRAM_SIZE];
+	static uint8_t expect[HC32L110_SRAM_SIZE];
+	int res = 0;
+
+	for (size_t cnt = 0; cnt < sizeof(cases) / sizeof(cases[0]) && !res; cnt++)
+	{
+		const hc32boot_region_t *region = cases[cnt].region ? hc32boot_region(cases[cnt].region) : NULL;
+		hc32boot_op_t op = { 0 };
+		double start;
+
+		op.type = HC32BOOT_OP_READ;
+		op.addr = region ? region->addr : cases[cnt].addr;
+		op.size = region ? region->size : cases[cnt].size;
+		op.data = data;
+		if (cases[cnt].region && !region)
+		{
+			fprintf(stderr, "The %s region is not known.\n", cases[cnt].region);
+			return -1;
+		}
+		if (!region && hc32boot_region_of(op.addr, op.size))
+		{
+			fprintf(stderr, "0x%08X is not a raw address.\n", op.addr);
+			return -1;
+		}
+		memset(data, 0x55, sizeof(data));
+		flashsim_memory(0, op.addr, expect, op.size);
+		start = now();
+		res = hc32boot_submit(session, &op) || hc32boot_wait(session);
+		res |= memcmp(data, expect, op.size) != 0;
+		report_e2e(cases[cnt].name, cfg, op.size, now() - start, res);
+	}
+	return res ? -1 : 0;
+}
+
+//--------------------------------------------
+// -I from a script: the checksum and probe commands against the sums of the image in the flash
+static int bench_shell(hc32boot_t *session, const flashsim_config_t *cfg, const uint8_t *image, const char *dir)
+{
+	char path[256];
+	char expect[6][64];
+	uint8_t uid[HC32L110_UID_SIZE];
+	uint16_t sum = 0;
+	uint16_t sector_sum = 0;
+	FILE *file;
+	double start;
+	int saved_stdin;
+	int saved_fd;
+	int fd;
+	int res;
+
+	for (int cnt = 0; cnt < HC32L110_FLASH_SIZE; cnt++)
+	{
+		sum += image[cnt];
+		sector_sum += cnt / HC32L110_SECTOR_SIZE == 3 ? image[cnt] : 0;
+	}
+	flashsim_memory(0, HC32L110_UID_ADDR, uid, sizeof(uid));
+	snprintf(expect[0], sizeof(expect[0]), "Sum16 of 0x4000 bytes at 0x0000: 0x%04X.", sum);
+	snprintf(expect[1], sizeof(expect[1]), "Sum16 of 0x0200 bytes at 0x0600: 0x%04X.", sector_sum);
+	snprintf(expect[2], sizeof(expect[2]), "{\"uid\":\"%02x%02x", uid[0], uid[1]);
+	snprintf(expect[3], sizeof(expect[3]), "\"sum16\":%u,", sum);
+	// a range across a sector boundary erases both sectors
+	snprintf(expect[4], sizeof(expect[4]), "Flash memory 0x0000-0x03FF erased.");
+	snprintf(expect[5], sizeof(expect[5]), "Sum16 of 0x0400 bytes at 0x0000: 0x%04X.", (uint16_t)(0x400 * 0xff));
+
+	snprintf(path, sizeof(path), "%s/script", dir);
+	if ((file = fopen(path, "w")) == NULL)
+	{
+		return -1;
+	}
+	fprintf(file, "checksum 0 4000\nchecksum 600 200\nprobe\nerase 1ff 2\nchecksum 0 400\nquit\n");
+	fclose(file);
+	if ((fd = open(path, O_RDONLY)) < 0 || (saved_stdin = dup(STDIN_FILENO)) < 0 || capture_begin(dir, &saved_fd))
+	{
+		return -1;
+	}
+	dup2(fd, STDIN_FILENO);
+	close(fd);
+	start = now();
+	res = shell_run(session, 0) != EXIT_SUCCESS;
+	capture_end(dir, saved_fd);
+	dup2(saved_stdin, STDIN_FILENO);
+	close(saved_stdin);
+	clearerr(stdin);
+	for (size_t cnt = 0; cnt < sizeof(expect) / sizeof(expect[0]); cnt++)
+	{
+		res |= strstr(capture_text, expect[cnt]) == NULL;
+	}
+	report_e2e("e2e_shell", cfg, HC32L110_FLASH_SIZE, now() - start, res);
+	if (res)
+	{
+		fprintf(stderr, "%s", capture_text);
+	}
+	return res ? -1 : 0;
+}
+
+//--------------------------------------------
+// -m: overlapping regions are rejected; regions sharing or touching sectors
+// become one erase run, listed out of order and run on the simulator, the
+// sectors between the runs keep their data
+static int bench_manifest(hc32boot_t *session, const flashsim_config_t *cfg, const uint8_t *image, const char *dir)
+{
+	static const uint32_t run_addr[] = { 0x0000, 0x1000 };
+	static const uint32_t run_size[] = { 0x0600, 0x0200 };
+	static uint8_t before[0x1600];
+	static uint8_t readback[0x1600];
+	manifest_t manifest;
+	hc32boot_op_t op = { 0 };
+	char path[256];
+	char a_bin[256];
+	char b_bin[256];
+	FILE *file;
+	double start;
+	int saved_fd;
+	int res;
+
+	// a.bin: 0x300 bytes, b.bin: 0x100 bytes
+	snprintf(a_bin, sizeof(a_bin), "%s/a.bin", dir);
+	snprintf(b_bin, sizeof(b_bin), "%s/b.bin", dir);
+	if ((file = fopen(a_bin, "wb")) == NULL)
+	{
+		return -1;
+	}
+	fwrite(&image[0x2000], 1, 0x300, file);
+	fclose(file);
+	if ((file = fopen(b_bin, "wb")) == NULL)
+	{
+		return -1;
+	}
+	fwrite(&image[0x3000], 1, 0x100, file);
+	fclose(file);
+
+	snprintf(path, sizeof(path), "%s/overlap.ini", dir);
+	if ((file = fopen(path, "w")) == NULL)
+	{
+		return -1;
+	}
+	fprintf(file, "[a]\nfile = %s\n[b]\nfile = %s\naddr = 2ff\n", a_bin, b_bin);
+	fclose(file);
+	if (capture_begin(dir, &saved_fd))
+	{
+		return -1;
+	}
+	res = !manifest_load(&manifest, path);
+	manifest_free(&manifest);
+	if (res || !strstr(capture_end(dir, saved_fd), "The regions a and b overlap."))
+	{
+		fprintf(stderr, "The overlapping regions are not rejected.\n%s", capture_text);
+		return -1;
+	}
+
+	// a and b share a sector, c starts where the sector of b ends, e is not erased
+	snprintf(path, sizeof(path), "%s/runs.ini", dir);
+	if ((file = fopen(path, "w")) == NULL)
+	{
+		return -1;
+	}
+	fprintf(file, "[d]\nfile = %s\naddr = 1000\n[c]\nfile = %s\naddr = 400\n[a]\nfile = %s\n"
+		"[e]\nfile = %s\naddr = 1400\nerase = none\n[b]\nfile = %s\naddr = 300\n", b_bin, b_bin, a_bin, b_bin, b_bin);
+	fclose(file);
+	if (manifest_load(&manifest, path))
+	{
+		manifest_free(&manifest);
+		return -1;
+	}
+	res = manifest.region_cnt != 5 || manifest.chip_erase || manifest.erase_cnt != 2 || strcmp(manifest.regions[0].name, "a") ||
+		strcmp(manifest.regions[4].name, "e");
+	for (int cnt = 0; cnt < 2 && !res; cnt++)
+	{
+		res = manifest.erase_addr[cnt] != run_addr[cnt] || manifest.erase_size[cnt] != run_size[cnt];
+	}
+	if (res)
+	{
+		fprintf(stderr, "The erase runs are not coalesced: %d runs, 0x%04X+0x%04X.\n",
+			manifest.erase_cnt, manifest.erase_addr[0], manifest.erase_size[0]);
+		manifest_free(&manifest);
+		return -1;
+	}
+
+	op.type = HC32BOOT_OP_READ;
+	op.size = sizeof(before);
+	op.data = before;
+	if (manifest_prepare(&manifest) || hc32boot_submit(session, &op) || hc32boot_wait(session) || capture_begin(dir, &saved_fd))
+	{
+		manifest_free(&manifest);
+		return -1;
+	}
+	start = now();
+	res = manifest_run(&manifest, session, "");
+	capture_end(dir, saved_fd);
+	op.data = readback;
+	res = res || hc32boot_submit(session, &op) || hc32boot_wait(session);
+	report_e2e("e2e_manifest", cfg, 0x700, now() - start, res);
+	for (int cnt = 0; cnt < manifest.region_cnt && !res; cnt++)
+	{
+		manifest_region_t *region = &manifest.regions[cnt];
+
+		res = memcmp(&readback[region->addr], region->data, region->size) != 0;
+	}
+	res = res || memcmp(&readback[0x0600], &before[0x0600], 0x0a00);
+	if (res)
+	{
+		fprintf(stderr, "The flash memory differs from the manifest.\n%s", capture_text);
+	}
+	manifest_free(&manifest);
+	return res ? -1 : 0;
+}
+
+//--------------------------------------------
+// -P: every kind of patch on the first sector of the image, the counter taken
+// from a file in the scratch directory, written and read back from the flash.
+// The patch list is global, no other case may add to it.
+static int bench_patch(hc32boot_t *session, const flashsim_config_t *cfg, const uint8_t *image, const char *dir)
+{
+	static const char *const rejected[] = { "10=u8:0x100", "10=u16:-", "10=hex:abc", "10=str:", "4000=u8:1",
+		"10=crc32:100-10", "10=crc32:0-4001", "10=counter:file,%d", "10=counter:file,%u%u", "10=f32:1" };
+	static uint8_t data[HC32L110_SECTOR_SIZE];
+	static uint8_t expect[HC32L110_SECTOR_SIZE];
+	static uint8_t readback[HC32L110_SECTOR_SIZE];
+	hc32boot_image_t *images[1];
+	hc32boot_image_t patched;
+	hc32boot_op_t op = { 0 };
+	char spec[300];
+	char counter[256];
+	FILE *file;
+	double start;
+	uint32_t crc;
+	int saved_fd;
+	int res = 0;
+
+	for (size_t cnt = 0; cnt < sizeof(rejected) / sizeof(rejected[0]); cnt++)
+	{
+		if (!patch_add(rejected[cnt]))
+		{
+			fprintf(stderr, "The patch %s is not rejected.\n", rejected[cnt]);
+			return -1;
+		}
+	}
+	snprintf(counter, sizeof(counter), "%s/counter", dir);
+	if ((file = fopen(counter, "w")) == NULL)
+	{
+		return -1;
+	}
+	fprintf(file, "41\n");
+	fclose(file);
+	snprintf(spec, sizeof(spec), "40=counter:%s,SN%%06u", counter);
+	if (patch_add("10=u8:0xa5") || patch_add("12=u16:0x1234") || patch_add("14=u32:305419896") ||
+		patch_add("20=hex:DEADbeef") || patch_add("30=str:HC32") || patch_add(spec) || patch_add("1fc=crc32:0-1fc") ||
+		patch_count() != 7)
+	{
+		fprintf(stderr, "The patches are not accepted.\n");
+		return -1;
+	}
+
+	memcpy(data, image, sizeof(data));
+	memcpy(expect, image, sizeof(expect));
+	memcpy(&expect[0x10], "\xa5", 1);
+	memcpy(&expect[0x12], "\x34\x12", 2);
+	memcpy(&expect[0x14], "\x78\x56\x34\x12", 4);
+	memcpy(&expect[0x20], "\xde\xad\xbe\xef", 4);
+	memcpy(&expect[0x30], "HC32", 4);
+	memcpy(&expect[0x40], "SN000041", 8);
+	crc = crc32(CRC32_INIT, expect, 0x1fc);
+	for (int cnt = 0; cnt < 4; cnt++)
+	{
+		expect[0x1fc + cnt] = (uint8_t)(crc >> (8 * cnt));
+	}
+	if (hc32boot_image_prepare(&patched, 0, data, sizeof(data), 0))
+	{
+		return -1;
+	}
+	images[0] = &patched;
+	if (capture_begin(dir, &saved_fd))
+	{
+		hc32boot_image_free(&patched);
+		return -1;
+	}
+	start = now();
+	res = patch_apply(images, 1);
+	capture_end(dir, saved_fd);
+	res |= hc32boot_image_get(&patched, 0, readback, sizeof(readback)) || memcmp(readback, expect, sizeof(expect));
+	// the frames must carry the patched data and checksums to the board
+	op.type = HC32BOOT_OP_ERASE;
+	op.size = sizeof(data);
+	res = res || hc32boot_submit(session, &op) || hc32boot_wait(session);
+	op.type = HC32BOOT_OP_WRITE;
+	op.image = &patched;
+	res = res || hc32boot_submit(session, &op) || hc32boot_wait(session);
+	memset(readback, 0, sizeof(readback));
+	op.type = HC32BOOT_OP_READ;
+	op.image = NULL;
+	op.data = readback;
+	res = res || hc32boot_submit(session, &op) || hc32boot_wait(session) || memcmp(readback, expect, sizeof(expect));
+	report_e2e("e2e_patch", cfg, sizeof(data), now() - start, res);
+	if (res)
+	{
+		fprintf(stderr, "%s", capture_text);
+	}
+	hc32boot_image_free(&patched);
+	// the next number is stored for the next board
+	if (!res)
+	{
+		file = fopen(counter, "r");
+		res = !file || !fgets(spec, sizeof(spec), file) || strcmp(spec, "42\n");
+		if (file)
+		{
+			fclose(file);
+		}
+		if (res)
+		{
+			fprintf(stderr, "The counter file is not incremented.\n");
+		}
+	}
+	return res ? -1 : 0;
+}
+
+//--------------------------------------------
+static int bench_e2e(const flashsim_config_t *cfg, int boot_baudrate)
+{
+	// the simulator starts in the ROM bootloader, no reset time is needed
+	hc32boot_config_t session_cfg = { cfg->baudrate, 0, 0, boot_baudrate, 0, HC32BOOT_RESET_RTS, 0 };
+	static uint8_t image[HC32L110_FLASH_SIZE];
+	static uint8_t readback[HC32L110_FLASH_SIZE];
+	char scratch[] = "/tmp/hc32boot-bench-XXXXXX";
+	hc32boot_image_t prepared;
+	const char *name;
+	hc32boot_t *session;
+	int res;
+
+	for (size_t cnt = 0; cnt < sizeof(image); cnt++)
+	{
+		image[cnt] = (uint8_t)(cnt * 29 + 3);
+	}
+	if (hc32boot_image_prepare(&prepared, 0, image, sizeof(image), 0))
+	{
+		return -1;
+	}
+
+	name = flashsim_start(cfg);
+	if (!name || (session = hc32boot_open(name, &session_cfg)) == NULL)
+	{
+		fprintf(stderr, "Could not start the flashloader simulator.\n");
+		flashsim_stop();
+		hc32boot_image_free(&prepared);
+		return -1;
+	}
+
+	res = session_run("e2e_connect", session, cfg, HC32BOOT_OP_CONNECT, 0, NULL, NULL);
+	if (!res)
+	{
+		res = session_run("e2e_load_flashloader", session, cfg, HC32BOOT_OP_LOAD, 0, NULL, NULL);
+	}
+	if (!res)
+	{
+		res = session_run("e2e_calibrate", session, cfg, HC32BOOT_OP_CALIBRATE, 0, NULL, NULL);
+	}
+	if (!res)
+	{
+		res = session_run("e2e_erase", session, cfg, HC32BOOT_OP_ERASE, 0, NULL, NULL);
+	}
+	if (!res)
+	{
+		res = session_run("e2e_write", session, cfg, HC32BOOT_OP_WRITE, HC32L110_FLASH_SIZE, NULL, &prepared);
+	}
+	if (!res)
+	{
+		res = session_run("e2e_read", session, cfg, HC32BOOT_OP_READ, HC32L110_FLASH_SIZE, readback, NULL);
+	}
+	if (!res && memcmp(image, readback, sizeof(image)))
+	{
+		fprintf(stderr, "The data read back differs from the data written.\n");
+		res = -1;
+	}
+	if (!res)
+	{
+		res = bench_identify(session, cfg, image);
+	}
+	if (!res)
+	{
+		res = bench_regions(session, cfg);
+	}
+	if (!res)
+	{
+		if (mkdtemp(scratch))
+		{
+			res = bench_devcache(session, cfg, &prepared, scratch);
+			if (!res)
+			{
+				res = bench_shell(session, cfg, image, scratch);
+			}
+			// before the patches, the manifest would apply them
+			if (!res)
+			{
+				res = bench_manifest(session, cfg, image, scratch);
+			}
+			if (!res)
+			{
+				res = bench_patch(session, cfg, image, scratch);
+			}
+			scratch_remove(scratch);
+		}
+		else
+		{
+			fprintf(stderr, "Could not create a temporary directory.\n");
+			res = -1;
+		}
+	}
+
+	hc32boot_close(session);
+	flashsim_stop();
+	hc32boot_image_free(&prepared);
+	return res;
+}
+
+//--------------------------------------------
+// Programs cnt simulated boards at once with hc32boot_wait_all(): connect,
+// flashloader upload, chip erase, write and read back of the whole flash.
+static int bench_gang(const flashsim_config_t *cfg, int boot_baudrate, int cnt)
+{
+	hc32boot_config_t session_cfg = { cfg->baudrate, 0, 0, boot_baudrate, 0, HC32BOOT_RESET_RTS, 0 };
+	static const int types[] = { HC32BOOT_OP_CONNECT, HC32BOOT_OP_LOAD, HC32BOOT_OP_ERASE, HC32BOOT_OP_WRITE, HC32BOOT_OP_READ };
+	static uint8_t image[HC32L110_FLASH_SIZE];
+	static hc32boot_t *sessions[FLASHSIM_MAX_INSTANCES];
+	static int results[FLASHSIM_MAX_INSTANCES];
+	uint8_t *readback;
+	hc32boot_image_t prepared;
+	double start;
+	double cpu_start;
+	int failed = 0;
+	int opened;
+
+	for (size_t cnt_b = 0; cnt_b < sizeof(image); cnt_b++)
+	{
+		image[cnt_b] = (uint8_t)(cnt_b * 29 + 3);
+	}
+	readback = malloc((size_t)cnt * HC32L110_FLASH_SIZE);
+	if (!readback || hc32boot_image_prepare(&prepared, 0, image, sizeof(image), 0))
+	{
+		free(readback);
+		return -1;
+	}
+	for (opened = 0; opened < cnt; opened++)
+	{
+		const char *name = flashsim_start(cfg);
+		if (!name || (sessions[opened] = hc32boot_open(name, &session_cfg)) == NULL)
+		{
+			fprintf(stderr, "Could not start the flashloader simulator %d.\n", opened + 1);
+			failed = opened + 1;
+			break;
+		}
+		for (size_t cnt_t = 0; cnt_t < sizeof(types) / sizeof(types[0]) && !failed; cnt_t++)
+		{
+			hc32boot_op_t op = { 0 };
+
+			op.type = types[cnt_t];
+			if (op.type == HC32BOOT_OP_WRITE)
+			{
+				op.image = &prepared;
+			}
+			else if (op.type == HC32BOOT_OP_READ)
+			{
+				op.size = HC32L110_FLASH_SIZE;
+				op.data = readback + (size_t)opened * HC32L110_FLASH_SIZE;
+			}
+			failed = hc32boot_submit(sessions[opened], &op) ? opened + 1 : 0;
+		}
+	}
+
+	if (!failed)
+	{
+		start = now();
+		cpu_start = cpu_now();
+		failed = hc32boot_wait_all(sessions, results, (size_t)cnt);
+		for (int cnt_s = 0; cnt_s < cnt; cnt_s++)
+		{
+			failed += !results[cnt_s] && memcmp(image, readback + (size_t)cnt_s * HC32L110_FLASH_SIZE, sizeof(image));
+		}
+		printf("{\"bench\":\"gang\",\"backend\":\"%s\",\"sessions\":%d,\"bytes\":%zu,\"seconds\":%.4f,\"cpu_seconds\":%.4f,\"failed\":%d}\n",
+			hc32boot_wait_backend(), cnt, (size_t)cnt * HC32L110_FLASH_SIZE, now() - start, cpu_now() - cpu_start, failed);
+		fflush(stdout);
+	}
+
+	for (int cnt_s = 0; cnt_s < opened; cnt_s++)
+	{
+		hc32boot_close(sessions[cnt_s]);
+	}
+	flashsim_stop();
+	hc32boot_image_free(&prepared);
+	free(readback);
+	return failed ? -1 : 0;
+}
+
+//--------------------------------------------
+static void print_usage(void)
+{
+	printf("Usage:\n");
+	printf("  hc32l110-serial-boot-bench [-m] [-e] [-b <baudrate>] [-f <baudrate>] [-l <latency>] [-t <seconds>] [-g <boards>]\n\n");
+	printf("  -m                 run only the microbenchmarks\n");
+	printf("  -e                 run only the end-to-end benchmarks\n");
+	printf("  -b <baudrate>      simulated UART baud rate, default 115200\n");
+	printf("  -f <baudrate>      two-stage flashloader load at this baud rate\n");
+	printf("  -l <latency>       simulated response latency in microseconds, default 1000\n");
+	printf("  -p <program>       simulated flash program time per word in microseconds, default 25\n");
+	printf("  -s <erase>         simulated sector erase time in microseconds, default 4000\n");
+	printf("  -t <seconds>       minimum duration of every microbenchmark, default 0.2\n");
+	printf("  -g <boards>        program this many simulated boards at once instead of the end-to-end benchmarks\n");
+}
+
+//--------------------------------------------
+int main(int argc, char *argv[])
+{
+	int option;
+	int micro = 1;
+	int e2e = 1;
+	int boot_baudrate = 0;
+	int gang = 0;
+	flashsim_config_t cfg = { 115200, 1000, 25, 4000 };
+
+	while ((option = getopt(argc, argv, "meb:f:l:p:s:t:g:")) != -1)
+	{
+		switch (option)
+		{
+		case 'm':
+			e2e = 0;
+			break;
+		case 'e':
+			micro = 0;
+			break;
+		case 'b':
+			cfg.baudrate = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'f':
+			boot_baudrate = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'l':
+			cfg.latency_us = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			cfg.program_us = (int)strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			cfg.erase_us = (int)strtol(optarg, NULL, 10);
+			break;
+		case 't':
+			min_seconds = strtod(optarg, NULL);
+			break;
+		case 'g':
+			gang = (int)strtol(optarg, NULL, 10);
+			break;
+		default: // '?'
+			print_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (cfg.baudrate <= 0 || gang < 0 || gang > FLASHSIM_MAX_INSTANCES)
+	{
+		print_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (micro)
+	{
+		bench_micro();
+	}
+	if (e2e && gang && bench_gang(&cfg, boot_baudrate, gang))
+	{
+		exit(EXIT_FAILURE);
+	}
+	if (e2e && !gang && bench_e2e(&cfg, boot_baudrate))
+	{
+		exit(EXIT_FAILURE);
+	}
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,355 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stdlib.h>     /* posix_openpt */
+#include <string.h>     /* memset, strncpy */
+#include <fcntl.h>      /* O_RDWR */
+#include <unistd.h>     /* read, write, fork */
+#include <time.h>       /* nanosleep */
+#include <termios.h>    /* cfmakeraw */
+#include <signal.h>     /* kill */
+#include <sys/wait.h>   /* waitpid */
+#include "checksum.h"
+#include "hc32boot.h"
+#include "flashsim.h"
+
+//--------------------------------------------
+#define FLASHSIM_FLASH_SIZE      0x8000
+#define FLASHSIM_SECTOR_SIZE     0x200
+#define FLASHSIM_SUM_SECTOR_US   500   // the flashloader summing loop, per sector
+
+//--------------------------------------------
+static pid_t sim_pid[FLASHSIM_MAX_INSTANCES];
+static char sim_name[FLASHSIM_MAX_INSTANCES][64];
+static int sim_cnt;
+static int sim_index;
+static uint8_t flash[FLASHSIM_FLASH_SIZE];
+
+//--------------------------------------------
+// any byte of the memory map as the flashloader reads it
+static uint8_t peek(uint32_t addr)
+{
+	uint8_t buf;
+
+	if (addr < FLASHSIM_FLASH_SIZE)
+	{
+		return flash[addr];
+	}
+	flashsim_memory(sim_index, addr, &buf, 1);
+	return buf;
+}
+
+//--------------------------------------------
+static void delay_us(long us)
+{
+	struct timespec ts;
+
+	if (us <= 0)
+	{
+		return;
+	}
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+//--------------------------------------------
+static long wire_us(const flashsim_config_t *cfg, size_t len)
+{
+	return (long)(len * 10 * 1000000ULL / cfg->baudrate);
+}
+
+//--------------------------------------------
+static int read_exact(int fd, uint8_t *buf, size_t len)
+{
+	size_t cnt = 0;
+
+	while (cnt < len)
+	{
+		ssize_t res = read(fd, buf + cnt, len - cnt);
+		if (res <= 0)
+		{
+			return -1;
+		}
+		cnt += res;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static void respond(int fd, const flashsim_config_t *cfg, long busy_us, size_t req_len, const uint8_t *buf, size_t len)
+{
+	delay_us(wire_us(cfg, req_len) + busy_us + cfg->latency_us + wire_us(cfg, len));
+	if (write(fd, buf, len) < 0)
+	{
+		return;
+	}
+}
+
+//--------------------------------------------
+static void flashloader(int fd, const flashsim_config_t *cfg)
+{
+	uint8_t req[HC32BOOT_FRAME_MAX_SIZE];
+	uint8_t resp[HC32BOOT_FRAME_MAX_SIZE];
+
+	for (;;)
+	{
+		uint32_t addr;
+		uint16_t size;
+		size_t req_len = HC32BOOT_FRAME_HEADER_SIZE + 1;
+		uint16_t resp_size = 0;
+		long busy_us = 0;
+
+		if (read_exact(fd, req, HC32BOOT_FRAME_HEADER_SIZE))
+		{
+			return;
+		}
+		addr = (uint32_t)req[5] << 24 | (uint32_t)req[4] << 16 | (uint32_t)req[3] << 8 | req[2];
+		size = (uint16_t)req[7] << 8 | req[6];
+		if (req[1] != HC32BOOT_CMD_READ)
+		{
+			req_len += size;
+		}
+		if (req_len > sizeof(req) || read_exact(fd, req + HC32BOOT_FRAME_HEADER_SIZE, req_len - HC32BOOT_FRAME_HEADER_SIZE))
+		{
+			return;
+		}
+		resp[1] = 0;
+		if (sum8(req, req_len - 1) != req[req_len - 1])
+		{
+			resp[1] = 1;
+		}
+		else if (req[1] == HC32BOOT_CMD_NOP)
+		{
+		}
+		else if (req[1] == HC32BOOT_CMD_CHIP_ERASE)
+		{
+			memset(flash, 0xff, sizeof(flash));
+			busy_us = cfg->erase_us * 4;
+		}
+		else if (req[1] == HC32BOOT_CMD_SECTOR_ERASE && addr < FLASHSIM_FLASH_SIZE)
+		{
+			memset(flash + (addr & ~(FLASHSIM_SECTOR_SIZE - 1)), 0xff, FLASHSIM_SECTOR_SIZE);
+			busy_us = cfg->erase_us;
+		}
+		else if (req[1] == HC32BOOT_CMD_WRITE && addr + size <= FLASHSIM_FLASH_SIZE)
+		{
+			for (uint16_t cnt = 0; cnt < size; cnt++)
+			{
+				flash[addr + cnt] &= req[HC32BOOT_FRAME_HEADER_SIZE + cnt];
+			}
+			busy_us = (long)cfg->program_us * ((size + 3) / 4);
+		}
+		else if (req[1] == HC32BOOT_CMD_READ && size <= READ_PACKET_MAX_DATA_SIZE)
+		{
+			for (uint16_t cnt = 0; cnt < size; cnt++)
+			{
+				resp[HC32BOOT_FRAME_HEADER_SIZE + cnt] = peek(addr + cnt);
+			}
+			resp_size = size;
+		}
+		else if (req[1] == HC32BOOT_CMD_CHECKSUM && size == 4)
+		{
+			uint8_t *data = req + HC32BOOT_FRAME_HEADER_SIZE;
+			uint32_t len = (uint32_t)data[3] << 24 | (uint32_t)data[2] << 16 | (uint32_t)data[1] << 8 | data[0];
+			uint16_t sum = 0;
+
+			if (len <= FLASHSIM_FLASH_SIZE)
+			{
+				for (uint32_t cnt = 0; cnt < len; cnt++)
+				{
+					sum += peek(addr + cnt);
+				}
+				resp[HC32BOOT_FRAME_HEADER_SIZE] = (uint8_t)sum;
+				resp[HC32BOOT_FRAME_HEADER_SIZE + 1] = (uint8_t)(sum >> 8);
+				resp_size = 2;
+				busy_us = (long)FLASHSIM_SUM_SECTOR_US * ((len + FLASHSIM_SECTOR_SIZE - 1) / FLASHSIM_SECTOR_SIZE);
+			}
+			else
+			{
+				resp[1] = 5;
+			}
+		}
+		else
+		{
+			resp[1] = 5;
+		}
+		resp[0] = HC32BOOT_FRAME_HEADER;
+		resp[2] = req[2];
+		resp[3] = req[3];
+		resp[4] = req[4];
+		resp[5] = req[5];
+		resp[6] = (uint8_t)resp_size;
+		resp[7] = (uint8_t)(resp_size >> 8);
+		resp[HC32BOOT_FRAME_HEADER_SIZE + resp_size] = sum8(resp, HC32BOOT_FRAME_HEADER_SIZE + resp_size);
+		respond(fd, cfg, busy_us, req_len, resp, HC32BOOT_FRAME_HEADER_SIZE + resp_size + 1);
+	}
+}
+
+//--------------------------------------------
+static void rom_bootloader(int fd, const flashsim_config_t *cfg)
+{
+	uint8_t buf[10];
+	uint8_t ack = 0x11;
+	static uint8_t code[0x800];
+	size_t code_len = 0;
+
+	// connect pattern: 0x18 0xff pairs, the target answers 0x11 once
+	do
+	{
+		if (read_exact(fd, buf, 1))
+		{
+			return;
+		}
+	} while (buf[0] != 0x18);
+	respond(fd, cfg, 0, 1, &ack, 1);
+	// the host waits and flushes its buffers before the upload, drop the rest of the pattern
+	delay_us(150000);
+	tcflush(fd, TCIFLUSH);
+
+	for (;;)
+	{
+		if (read_exact(fd, buf, sizeof(buf)))
+		{
+			return;
+		}
+		ack = 0x01;
+		if (buf[0] == 0xc0)
+		{
+			uint8_t acks[11];
+			memset(acks, ack, sizeof(acks));
+			respond(fd, cfg, 0, sizeof(buf), acks, sizeof(acks));
+			// a short upload is the two-stage stub: ratio and image size are its last words
+			if (code_len > 8 && code_len < 0x7a4)
+			{
+				flashsim_config_t fast = *cfg;
+				uint32_t ratio = code[code_len - 8] | (uint32_t)code[code_len - 7] << 8;
+				uint32_t size = code[code_len - 4] | (uint32_t)code[code_len - 3] << 8;
+				uint8_t sum;
+				ack = (ratio && 144 % ratio == 0) ? 0xa5 : 0x5a;
+				respond(fd, cfg, 0, 0, &ack, 1);
+				if (ack == 0xa5)
+				{
+					fast.baudrate *= ratio;
+				}
+				if (size > sizeof(code) || read_exact(fd, code, size))
+				{
+					return;
+				}
+				sum = sum8(code, size);
+				respond(fd, &fast, 0, size, &sum, 1);
+			}
+			flashloader(fd, cfg);
+			return;
+		}
+		respond(fd, cfg, 0, sizeof(buf), &ack, 1);
+		// upload command: the code block and its checksum follow
+		code_len = (size_t)buf[6] << 8 | buf[5];
+		if (code_len + 1 > sizeof(code) || read_exact(fd, code, code_len + 1))
+		{
+			return;
+		}
+		respond(fd, cfg, 0, code_len + 1, &ack, 1);
+	}
+}
+
+//--------------------------------------------
+const char *flashsim_start(const flashsim_config_t *cfg)
+{
+	int fd;
+	int slave;
+	const char *name;
+	struct termios tio;
+	char *sim = sim_name[sim_cnt];
+
+	if (sim_cnt == FLASHSIM_MAX_INSTANCES)
+	{
+		return NULL;
+	}
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd) || (name = ptsname(fd)) == NULL)
+	{
+		return NULL;
+	}
+	strncpy(sim, name, sizeof(sim_name[0]) - 1);
+	// keep the slave side open, otherwise the master reports EIO until the host opens it
+	slave = open(sim, O_RDWR | O_NOCTTY);
+	if (slave < 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	tcgetattr(slave, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave, TCSANOW, &tio);
+
+	sim_pid[sim_cnt] = fork();
+	if (sim_pid[sim_cnt] < 0)
+	{
+		close(slave);
+		close(fd);
+		return NULL;
+	}
+	if (sim_pid[sim_cnt] == 0)
+	{
+		memset(flash, 0xff, sizeof(flash));
+		sim_index = sim_cnt;
+		rom_bootloader(fd, cfg);
+		_exit(0);
+	}
+	close(slave);
+	close(fd);
+	sim_cnt++;
+	return sim;
+}
+
+//--------------------------------------------
+void flashsim_memory(int index, uint32_t addr, uint8_t *buf, size_t size)
+{
+	for (size_t cnt = 0; cnt < size; cnt++, addr++)
+	{
+		if (addr < FLASHSIM_FLASH_SIZE)
+		{
+			buf[cnt] = 0xff;
+		}
+		else if (addr - HC32L110_UID_ADDR < HC32L110_UID_SIZE)
+		{
+			// the board number in the first two bytes, every board has its own UID
+			uint32_t offset = addr - HC32L110_UID_ADDR;
+			buf[cnt] = offset < 2 ? (uint8_t)(index >> (8 * offset)) : (uint8_t)(0xa0 + offset);
+		}
+		else if (addr - HC32L110_SRAM_ADDR < HC32L110_SRAM_SIZE)
+		{
+			buf[cnt] = (uint8_t)((addr - HC32L110_SRAM_ADDR) * 13 + 7);
+		}
+		else
+		{
+			// peripherals and reserved space
+			buf[cnt] = 0;
+		}
+	}
+}
+
+//--------------------------------------------
+void flashsim_stop(void)
+{
+	for (int cnt = 0; cnt < sim_cnt; cnt++)
+	{
+		kill(sim_pid[cnt], SIGTERM);
+		waitpid(sim_pid[cnt], NULL, 0);
+	}
+	sim_cnt = 0;
+}
@@ -0,0 +1,45 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef FLASHSIM_H_
+#define FLASHSIM_H_
+
+#include <stddef.h>     /* size_t */
+#include <stdint.h>     /* uint8_t, uint32_t */
+
+//--------------------------------------------
+#define FLASHSIM_MAX_INSTANCES   256
+
+//--------------------------------------------
+// HC32L110 ROM bootloader and flashloader model used by the benchmarks
+typedef struct flashsim_config
+{
+	int baudrate;            // simulated UART speed, 10 bits per byte
+	int latency_us;          // added to every response (USB-UART latency timer etc.)
+	int program_us;          // flash program time per 32-bit word
+	int erase_us;            // flash sector erase time
+} flashsim_config_t;
+
+//--------------------------------------------
+// Starts a simulator in a child process on a new pseudo terminal,
+// returns the slave device name to open or NULL on error.
+// Can be called again for more boards, each one has its own flash.
+const char *flashsim_start(const flashsim_config_t *cfg);
+// The memory map of the simulator started index-th (from 0) as its flashloader
+// reads it before any write: erased flash, the UID, the SRAM, zeros elsewhere.
+void flashsim_memory(int index, uint32_t addr, uint8_t *buf, size_t size);
+// Terminates all simulators, the flash contents are lost.
+void flashsim_stop(void);
+
+#endif /* FLASHSIM_H_ */
@@ -0,0 +1,591 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdlib.h>     /* malloc, strtod */
+#include <stdio.h>      /* snprintf, fopen, rename */
+#include <string.h>     /* memset, memcpy, strcmp */
+#include <time.h>       /* time, gmtime */
+#ifdef _WIN32
+#include <windows.h>    /* Windows stuff */
+#include <process.h>    /* _getpid */
+#include "gettimeofday.h"
+#define getpid _getpid
+#else
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* close, getpid */
+#include <sys/file.h>   /* flock */
+#include <sys/time.h>   /* gettimeofday */
+#endif
+#include "serial.h"
+#include "hc32boot.h"
+#include "audit.h"
+
+//--------------------------------------------
+typedef struct sample
+{
+	char key[AUDIT_KEY_SIZE];    // name and labels
+	double value;
+} sample_t;
+
+//--------------------------------------------
+typedef struct metrics
+{
+	sample_t samples[AUDIT_MAX_SAMPLES];
+	int cnt;
+} metrics_t;
+
+//--------------------------------------------
+typedef struct family
+{
+	const char *name;
+	const char *type;
+	const char *help;
+} family_t;
+
+//--------------------------------------------
+static const family_t families[] = {
+	{ "hc32boot_sessions", "counter", "Sessions by result." },
+	{ "hc32boot_session_seconds", "histogram", "Session time, from the port open to the end of the last operation." },
+	{ "hc32boot_connect_seconds", "histogram", "Reset and connect to the ROM bootloader, the reset hold included." },
+	{ "hc32boot_upload_seconds", "histogram", "Flashloader upload until it runs." },
+	{ "hc32boot_packet_rtt_seconds", "histogram", "Flashloader frame, from the start of the transmission to the end of the response." },
+	{ "hc32boot_frames", "counter", "Flashloader frames answered." },
+	{ "hc32boot_bytes", "counter", "Bytes on the wire." },
+	{ "hc32boot_retries", "counter", "Connect patterns repeated." },
+	{ "hc32boot_timeouts", "counter", "Responses not received in time." },
+};
+
+//--------------------------------------------
+// seconds, upper bounds of the buckets
+static const double connect_bounds[] = { 1, 2.5, 5, 5.25, 5.5, 6, 7.5, 10 };
+static const double upload_bounds[] = { 0.25, 0.5, 1, 1.5, 2, 2.5, 3, 5 };
+static const double rtt_bounds[AUDIT_RTT_BUCKETS] = { 0.001, 0.002, 0.005, 0.01, 0.02, 0.05, 0.1, 0.25, 0.5, 1 };
+static const double session_bounds[] = { 5.5, 6, 7, 8, 10, 15, 20, 30, 60, 120 };
+
+//--------------------------------------------
+#define BOUNDS(a)                (a), (int)(sizeof(a) / sizeof((a)[0]))
+
+//--------------------------------------------
+static const char *log_path;
+static const char *metrics_path;
+
+//--------------------------------------------
+static uint64_t get_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//--------------------------------------------
+// label values and JSON strings are copied without quotes and backslashes
+static void copy_name(char *dst, size_t size, const char *src)
+{
+	size_t cnt;
+
+	for (cnt = 0; cnt + 1 < size && src[cnt]; cnt++)
+	{
+		dst[cnt] = src[cnt] == '"' || src[cnt] == '\\' || (unsigned char)src[cnt] < ' ' ? '_' : src[cnt];
+	}
+	dst[cnt] = '\0';
+}
+
+//--------------------------------------------
+// An exclusive lock on <path>.lock, it outlives the renames of the file itself.
+// Every holder opens the lock file on its own, so threads exclude each other as processes do.
+#ifdef _WIN32
+static HANDLE lock_take(const char *path)
+{
+	char name[512];
+	HANDLE file;
+	OVERLAPPED ov = { 0 };
+
+	snprintf(name, sizeof(name), "%s.lock", path);
+	file = CreateFileA(name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+	if (!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &ov))
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+	return file;
+}
+
+//--------------------------------------------
+static void lock_release(HANDLE file)
+{
+	OVERLAPPED ov = { 0 };
+
+	UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &ov);
+	CloseHandle(file);
+}
+#else
+static int lock_take(const char *path)
+{
+	char name[512];
+	int fd;
+
+	snprintf(name, sizeof(name), "%s.lock", path);
+	fd = open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (flock(fd, LOCK_EX))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+//--------------------------------------------
+static void lock_release(int fd)
+{
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+#endif
+
+//--------------------------------------------
+static void sample_add(metrics_t *m, const char *key, double value)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < m->cnt; cnt++)
+	{
+		if (!strcmp(m->samples[cnt].key, key))
+		{
+			m->samples[cnt].value += value;
+			return;
+		}
+	}
+	if (m->cnt < AUDIT_MAX_SAMPLES)
+	{
+		snprintf(m->samples[m->cnt].key, sizeof(m->samples[0].key), "%s", key);
+		m->samples[m->cnt++].value = value;
+	}
+}
+
+//--------------------------------------------
+// counts: per bucket and one for +Inf, not cumulative
+static void histogram_add(metrics_t *m, const char *name, const char *port,
+	const double *bounds, int bound_cnt, const uint32_t *counts, double sum)
+{
+	char key[AUDIT_KEY_SIZE];
+	uint32_t total = 0;
+	int cnt;
+
+	for (cnt = 0; cnt <= bound_cnt; cnt++)
+	{
+		total += counts[cnt];
+		if (cnt < bound_cnt)
+		{
+			snprintf(key, sizeof(key), "%s_bucket{port=\"%s\",le=\"%g\"}", name, port, bounds[cnt]);
+		}
+		else
+		{
+			snprintf(key, sizeof(key), "%s_bucket{port=\"%s\",le=\"+Inf\"}", name, port);
+		}
+		sample_add(m, key, total);
+	}
+	snprintf(key, sizeof(key), "%s_sum{port=\"%s\"}", name, port);
+	sample_add(m, key, sum);
+	snprintf(key, sizeof(key), "%s_count{port=\"%s\"}", name, port);
+	sample_add(m, key, total);
+}
+
+//--------------------------------------------
+static int bucket(const double *bounds, int bound_cnt, double value)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < bound_cnt && value > bounds[cnt]; cnt++);
+	return cnt;
+}
+
+//--------------------------------------------
+static void histogram_observe(metrics_t *m, const char *name, const char *port,
+	const double *bounds, int bound_cnt, double value)
+{
+	uint32_t counts[AUDIT_RTT_BUCKETS + 2] = { 0 };
+
+	counts[bucket(bounds, bound_cnt, value)] = 1;
+	histogram_add(m, name, port, bounds, bound_cnt, counts, value);
+}
+
+//--------------------------------------------
+// the samples of the current file, the comments are generated again
+static void metrics_load(metrics_t *m, const char *path)
+{
+	char line[AUDIT_KEY_SIZE + 64];
+	FILE *file;
+
+	m->cnt = 0;
+	if ((file = fopen(path, "r")) == NULL)
+	{
+		return;
+	}
+	while (fgets(line, sizeof(line), file) && m->cnt < AUDIT_MAX_SAMPLES)
+	{
+		char *value = strrchr(line, ' ');
+
+		if (line[0] == '#' || !value || (size_t)(value - line) >= sizeof(m->samples[0].key))
+		{
+			continue;
+		}
+		*value++ = '\0';
+		// the length is checked above
+		memcpy(m->samples[m->cnt].key, line, strlen(line) + 1);
+		m->samples[m->cnt++].value = strtod(value, NULL);
+	}
+	fclose(file);
+}
+
+//--------------------------------------------
+// written to a temporary file and renamed, a scrape never sees a partial file
+static int metrics_store(const metrics_t *m, const char *path)
+{
+	static const char *const suffixes[] = { "_total{", "_bucket{", "_sum{", "_count{" };
+	char tmp[512];
+	FILE *file;
+	size_t fam;
+	int res;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if ((file = fopen(tmp, "w")) == NULL)
+	{
+		return -1;
+	}
+	for (fam = 0; fam < sizeof(families) / sizeof(families[0]); fam++)
+	{
+		size_t len = strlen(families[fam].name);
+		int cnt;
+
+		fprintf(file, "# TYPE %s %s\n# HELP %s %s\n", families[fam].name, families[fam].type,
+			families[fam].name, families[fam].help);
+		for (cnt = 0; cnt < m->cnt; cnt++)
+		{
+			const char *key = m->samples[cnt].key;
+			size_t suf;
+
+			if (strncmp(key, families[fam].name, len))
+			{
+				continue;
+			}
+			// counters: _total only, histograms: the rest
+			for (suf = families[fam].type[0] == 'c' ? 0 : 1; suf < (families[fam].type[0] == 'c' ? 1 : 4); suf++)
+			{
+				if (!strncmp(key + len, suffixes[suf], strlen(suffixes[suf])))
+				{
+					fprintf(file, "%s %.15g\n", key, m->samples[cnt].value);
+					break;
+				}
+			}
+		}
+	}
+	fprintf(file, "# EOF\n");
+	res = ferror(file);
+	res |= fclose(file) != 0;
+#ifdef _WIN32
+	// rename does not replace a file on Windows
+	remove(path);
+#endif
+	if (res || rename(tmp, path))
+	{
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static void metrics_update(const audit_t *a, int result)
+{
+	char key[AUDIT_KEY_SIZE];
+	metrics_t *m;
+	int cnt;
+#ifdef _WIN32
+	HANDLE lock;
+#else
+	int lock;
+#endif
+
+	if ((m = malloc(sizeof(*m))) == NULL)
+	{
+		return;
+	}
+	lock = lock_take(metrics_path);
+#ifdef _WIN32
+	if (!lock)
+#else
+	if (lock < 0)
+#endif
+	{
+		printf("Warning: Could not lock the metrics file %s.\n", metrics_path);
+		free(m);
+		return;
+	}
+	metrics_load(m, metrics_path);
+	snprintf(key, sizeof(key), "hc32boot_sessions_total{port=\"%s\",result=\"%s\"}", a->port, result ? "error" : "ok");
+	sample_add(m, key, 1);
+	histogram_observe(m, "hc32boot_session_seconds", a->port, BOUNDS(session_bounds), (get_time_us() - a->start_us) / 1e6);
+	for (cnt = 0; cnt < a->phase_cnt; cnt++)
+	{
+		if (!strcmp(a->phases[cnt].name, "connect"))
+		{
+			histogram_observe(m, "hc32boot_connect_seconds", a->port, BOUNDS(connect_bounds), a->phases[cnt].us / 1e6);
+		}
+		else if (!strcmp(a->phases[cnt].name, "load"))
+		{
+			histogram_observe(m, "hc32boot_upload_seconds", a->port, BOUNDS(upload_bounds), a->phases[cnt].us / 1e6);
+		}
+	}
+	histogram_add(m, "hc32boot_packet_rtt_seconds", a->port, BOUNDS(rtt_bounds), a->rtt_cnt, a->rtt_sum_us / 1e6);
+	snprintf(key, sizeof(key), "hc32boot_frames_total{port=\"%s\"}", a->port);
+	sample_add(m, key, a->stats.frames);
+	snprintf(key, sizeof(key), "hc32boot_bytes_total{port=\"%s\",direction=\"tx\"}", a->port);
+	sample_add(m, key, (double)a->stats.tx_bytes);
+	snprintf(key, sizeof(key), "hc32boot_bytes_total{port=\"%s\",direction=\"rx\"}", a->port);
+	sample_add(m, key, (double)a->stats.rx_bytes);
+	snprintf(key, sizeof(key), "hc32boot_retries_total{port=\"%s\"}", a->port);
+	sample_add(m, key, a->stats.retries);
+	snprintf(key, sizeof(key), "hc32boot_timeouts_total{port=\"%s\"}", a->port);
+	sample_add(m, key, a->stats.timeouts);
+	if (metrics_store(m, metrics_path))
+	{
+		printf("Warning: Could not write the metrics file %s.\n", metrics_path);
+	}
+	lock_release(lock);
+	free(m);
+}
+
+//--------------------------------------------
+static void log_append(const audit_t *a, int result)
+{
+	char line[AUDIT_LINE_SIZE];
+	char stamp[32];
+	size_t len;
+	time_t start = (time_t)a->start_time;
+	struct tm tm;
+	FILE *file;
+	uint32_t rtt_cnt = 0;
+	int cnt;
+#ifdef _WIN32
+	HANDLE lock;
+#else
+	int lock;
+#endif
+
+	for (cnt = 0; cnt <= AUDIT_RTT_BUCKETS; cnt++)
+	{
+		rtt_cnt += a->rtt_cnt[cnt];
+	}
+#ifdef _WIN32
+	gmtime_s(&tm, &start);
+#else
+	gmtime_r(&start, &tm);
+#endif
+	strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+	len = snprintf(line, sizeof(line), "{\"time\":\"%s\",\"port\":\"%s\",\"usb\":\"%s\",\"uid\":\"", stamp, a->devname, a->usb);
+	for (cnt = 0; a->uid_valid && cnt < HC32L110_UID_SIZE; cnt++)
+	{
+		len += snprintf(line + len, sizeof(line) - len, "%02x", a->uid[cnt]);
+	}
+	len += snprintf(line + len, sizeof(line) - len, "\",\"images\":[");
+	for (cnt = 0; cnt < a->image_cnt; cnt++)
+	{
+		len += snprintf(line + len, sizeof(line) - len, "%s\"0x%08X\"", cnt ? "," : "", a->images[cnt]);
+	}
+	len += snprintf(line + len, sizeof(line) - len, "],\"result\":\"%s\",\"seconds\":%.3f,\"phases\":{",
+		result ? "error" : "ok", (get_time_us() - a->start_us) / 1e6);
+	for (cnt = 0; cnt < a->phase_cnt && len < sizeof(line); cnt++)
+	{
+		const audit_phase_t *phase = &a->phases[cnt];
+
+		len += snprintf(line + len, sizeof(line) - len, "%s\"%s\":{\"seconds\":%.3f", cnt ? "," : "", phase->name, phase->us / 1e6);
+		if (phase->bytes && phase->us && len < sizeof(line))
+		{
+			len += snprintf(line + len, sizeof(line) - len, ",\"bytes\":%llu,\"bytes_per_s\":%.0f",
+				(unsigned long long)phase->bytes, phase->bytes * 1e6 / phase->us);
+		}
+		if (len < sizeof(line))
+		{
+			len += snprintf(line + len, sizeof(line) - len, "}");
+		}
+	}
+	if (len < sizeof(line))
+	{
+		len += snprintf(line + len, sizeof(line) - len,
+			"},\"frames\":%u,\"tx_bytes\":%llu,\"rx_bytes\":%llu,\"packet_rtt_ms\":{\"avg\":%.2f,\"max\":%.2f},\"retries\":%u,\"timeouts\":%u}\n",
+			a->stats.frames, (unsigned long long)a->stats.tx_bytes, (unsigned long long)a->stats.rx_bytes,
+			rtt_cnt ? a->rtt_sum_us / 1000.0 / rtt_cnt : 0, a->rtt_max_us / 1000.0, a->stats.retries, a->stats.timeouts);
+	}
+	if (len >= sizeof(line))
+	{
+		printf("Warning: The audit record is too long.\n");
+		return;
+	}
+	// one line per session even if several jobs end at once
+	lock = lock_take(log_path);
+	if ((file = fopen(log_path, "a")) == NULL || fputs(line, file) < 0 || fclose(file))
+	{
+		printf("Warning: Could not append to the audit log %s.\n", log_path);
+	}
+#ifdef _WIN32
+	if (lock)
+#else
+	if (lock >= 0)
+#endif
+	{
+		lock_release(lock);
+	}
+}
+
+//--------------------------------------------
+static void on_frame(void *arg, int cmd, uint32_t rtt_us)
+{
+	audit_t *a = arg;
+
+	(void)cmd;
+	a->rtt_cnt[bucket(rtt_bounds, AUDIT_RTT_BUCKETS, rtt_us / 1e6)]++;
+	a->rtt_sum_us += rtt_us;
+	if (rtt_us > a->rtt_max_us)
+	{
+		a->rtt_max_us = rtt_us;
+	}
+}
+
+//--------------------------------------------
+void audit_open(const char *log, const char *metrics)
+{
+	log_path = log;
+	metrics_path = metrics;
+}
+
+//--------------------------------------------
+int audit_enabled(void)
+{
+	return log_path || metrics_path;
+}
+
+//--------------------------------------------
+void audit_begin(audit_t *audit, const char *port)
+{
+	serial_port_info_t info;
+
+	memset(audit, 0, sizeof(*audit));
+	audit->cur = -1;
+	audit->start_us = get_time_us();
+	audit->start_time = (int64_t)time(NULL);
+	copy_name(audit->devname, sizeof(audit->devname), port);
+	copy_name(audit->port, sizeof(audit->port), port);
+	if (audit_enabled() && !serial_port_info(port, &info))
+	{
+		char usb[sizeof(audit->usb)];
+
+		snprintf(usb, sizeof(usb), "usb-path:%s vidpid:%04x:%04x usb-serial:%s", info.usb_path, info.vid, info.pid, info.serial);
+		copy_name(audit->usb, sizeof(audit->usb), usb);
+		if (info.usb_path[0])
+		{
+			// the fixture, whatever tty name the adapter gets
+			copy_name(audit->port, sizeof(audit->port), info.usb_path);
+		}
+	}
+}
+
+//--------------------------------------------
+void audit_attach(audit_t *audit, hc32boot_t *session)
+{
+	// the baseline of a session that ran other jobs before
+	audit->stats = *hc32boot_stats(session);
+	if (audit_enabled())
+	{
+		hc32boot_set_frame_hook(session, on_frame, audit);
+	}
+}
+
+//--------------------------------------------
+void audit_phase(audit_t *audit, const char *phase, uint32_t bytes)
+{
+	uint64_t now_us = get_time_us();
+	int cnt;
+
+	if (audit->cur >= 0)
+	{
+		audit->phases[audit->cur].us += now_us - audit->cur_us;
+		audit->cur = -1;
+	}
+	if (!phase)
+	{
+		return;
+	}
+	for (cnt = 0; cnt < audit->phase_cnt && strcmp(audit->phases[cnt].name, phase); cnt++);
+	if (cnt == audit->phase_cnt)
+	{
+		if (audit->phase_cnt == AUDIT_MAX_PHASES)
+		{
+			return;
+		}
+		audit->phases[audit->phase_cnt++].name = phase;
+	}
+	audit->phases[cnt].bytes += bytes;
+	audit->cur = cnt;
+	audit->cur_us = now_us;
+}
+
+//--------------------------------------------
+void audit_uid(audit_t *audit, const uint8_t *uid)
+{
+	memcpy(audit->uid, uid, sizeof(audit->uid));
+	audit->uid_valid = 1;
+}
+
+//--------------------------------------------
+void audit_image(audit_t *audit, uint32_t crc)
+{
+	if (audit->image_cnt < AUDIT_MAX_IMAGES)
+	{
+		audit->images[audit->image_cnt++] = crc;
+	}
+}
+
+//--------------------------------------------
+void audit_end(audit_t *audit, const hc32boot_t *session, int result)
+{
+	audit_phase(audit, NULL, 0);
+	if (session)
+	{
+		const hc32boot_stats_t *stats = hc32boot_stats(session);
+
+		audit->stats.frames = stats->frames - audit->stats.frames;
+		audit->stats.tx_bytes = stats->tx_bytes - audit->stats.tx_bytes;
+		audit->stats.rx_bytes = stats->rx_bytes - audit->stats.rx_bytes;
+		audit->stats.retries = stats->retries - audit->stats.retries;
+		audit->stats.timeouts = stats->timeouts - audit->stats.timeouts;
+	}
+	if (log_path)
+	{
+		log_append(audit, result);
+	}
+	if (metrics_path)
+	{
+		metrics_update(audit, result);
+	}
+}
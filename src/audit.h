@@ -0,0 +1,84 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef AUDIT_H_
+#define AUDIT_H_
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define AUDIT_MAX_PHASES         16
+#define AUDIT_MAX_IMAGES         8
+#define AUDIT_RTT_BUCKETS        10
+#define AUDIT_MAX_SAMPLES        4096   // lines of the metrics file
+#define AUDIT_LINE_SIZE          2048
+#define AUDIT_KEY_SIZE           192
+
+//--------------------------------------------
+typedef struct audit_phase
+{
+	const char *name;
+	uint64_t us;
+	uint64_t bytes;
+} audit_phase_t;
+
+//--------------------------------------------
+// the record of one session, one per thread
+typedef struct audit
+{
+	char devname[64];
+	char port[64];           // the metrics label: usb-path if known, the device name otherwise
+	char usb[160];           // USB identity of the port, empty if unknown
+	uint8_t uid[HC32L110_UID_SIZE];
+	int uid_valid;
+	uint32_t images[AUDIT_MAX_IMAGES];   // CRC-32 of the images written
+	int image_cnt;
+	audit_phase_t phases[AUDIT_MAX_PHASES];
+	int phase_cnt;
+	int cur;                 // the phase running, -1 for none
+	uint64_t cur_us;
+	uint64_t start_us;
+	int64_t start_time;
+	// per-packet round trips, counted per bucket (not cumulative)
+	uint32_t rtt_cnt[AUDIT_RTT_BUCKETS + 1];
+	uint64_t rtt_sum_us;
+	uint32_t rtt_max_us;
+	hc32boot_stats_t stats;
+} audit_t;
+
+//--------------------------------------------
+// Audit log (-A): one JSON line per session appended to the file: port and its
+// USB identity, chip UID, CRC-32 of the images, duration and bytes/s of every
+// phase, frames, bytes, retries, timeouts and the result.
+// Metrics (-M): an OpenMetrics text file for the node_exporter textfile
+// collector, counters and histograms of the connect time, the flashloader
+// upload time, the per-packet round trip and the session time, per port.
+// The file is its own state: every session adds to it under a lock and
+// replaces it atomically, so the jobs of -W, -J and separate runs all add up.
+// Either path may be NULL, nothing is recorded without both.
+void audit_open(const char *log_path, const char *metrics_path);
+int audit_enabled(void);
+void audit_begin(audit_t *audit, const char *port);
+// the frame hook collects the round trips of every packet, the counters of the
+// session are recorded from here on
+void audit_attach(audit_t *audit, hc32boot_t *session);
+// ends the running phase and starts a new one, NULL just ends it; bytes: the data the phase moves
+void audit_phase(audit_t *audit, const char *phase, uint32_t bytes);
+void audit_uid(audit_t *audit, const uint8_t *uid);
+void audit_image(audit_t *audit, uint32_t crc);
+// session may be NULL (the port did not open), result 0 for success
+void audit_end(audit_t *audit, const hc32boot_t *session, int result);
+
+#endif /* AUDIT_H_ */
@@ -0,0 +1,30 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stddef.h>     /* size_t */
+
+//--------------------------------------------
+#define CRC32_INIT       0
+
+//--------------------------------------------
+// 8-bit additive checksum used by the HC32L110 bootloader and flashloader frames
+uint8_t sum8(const void *buf, size_t len);
+// CRC-32/ISO-HDLC (poly 0x04c11db7 reflected), pass CRC32_INIT for the first block
+uint32_t crc32(uint32_t crc, const void *buf, size_t len);
+
+#endif /* CHECKSUM_H_ */
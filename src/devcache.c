@@ -0,0 +1,307 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stdio.h>      /* printf, fopen, rename */
+#include <string.h>     /* memcmp, memset */
+#ifdef _WIN32
+#include <process.h>    /* _getpid */
+#define getpid _getpid
+#else
+#include <unistd.h>     /* getpid */
+#endif
+#include "checksum.h"
+#include "hc32boot.h"
+#include "devcache.h"
+
+//--------------------------------------------
+#define DEVCACHE_MAGIC           "HC32DEV\001"
+#define DEVCACHE_PATH_SIZE       1024
+#define DEVCACHE_SECTOR_CNT      (HC32L110_FLASH_SIZE / HC32L110_SECTOR_SIZE)
+
+//--------------------------------------------
+// record file, native byte order
+typedef struct devcache_record
+{
+	char magic[8];
+	uint8_t uid[HC32L110_UID_SIZE];
+	uint16_t sum;            // 16-bit sum of the whole flash, as the flashloader computes it
+	uint32_t image_crc;      // the image last written
+	uint32_t sector_crc[DEVCACHE_SECTOR_CNT];
+} devcache_record_t;
+
+//--------------------------------------------
+static int record_path(char *path, size_t size, const char *dir, const uint8_t *uid)
+{
+	int len = snprintf(path, size, "%s/", dir);
+	int cnt;
+
+	for (cnt = 0; cnt < HC32L110_UID_SIZE && len > 0 && (size_t)len < size; cnt++)
+	{
+		len += snprintf(path + len, size - len, "%02x", uid[cnt]);
+	}
+	if (len > 0 && (size_t)len < size)
+	{
+		len += snprintf(path + len, size - len, ".hc32dev");
+	}
+	return len > 0 && (size_t)len < size ? 0 : -1;
+}
+
+//--------------------------------------------
+static int record_load(devcache_record_t *rec, const char *path, const uint8_t *uid)
+{
+	FILE *file;
+	int res;
+
+	if ((file = fopen(path, "rb")) == NULL)
+	{
+		return -1;
+	}
+	res = fread(rec, sizeof(*rec), 1, file) != 1;
+	fclose(file);
+	if (res || memcmp(rec->magic, DEVCACHE_MAGIC, sizeof(rec->magic)) || memcmp(rec->uid, uid, sizeof(rec->uid)))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// written to a temporary file and renamed, a reader never sees half a record
+static int record_store(const devcache_record_t *rec, const char *path)
+{
+	char tmp[DEVCACHE_PATH_SIZE + 16];
+	FILE *file;
+	int res;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	if ((file = fopen(tmp, "wb")) == NULL)
+	{
+		return -1;
+	}
+	res = fwrite(rec, sizeof(*rec), 1, file) != 1;
+	res |= fclose(file) != 0;
+#ifdef _WIN32
+	// rename does not replace a file on Windows
+	remove(path);
+#endif
+	if (res || rename(tmp, path))
+	{
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int run(hc32boot_t *session, int type, uint32_t addr, uint32_t size, uint8_t *data)
+{
+	hc32boot_op_t op;
+
+	memset(&op, 0, sizeof(op));
+	op.type = type;
+	op.addr = addr;
+	op.size = size;
+	op.data = data;
+	if (hc32boot_submit(session, &op) || hc32boot_wait(session))
+	{
+		printf("ERROR: Connection error.\n");
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int device_sum(hc32boot_t *session, uint16_t *sum)
+{
+	uint8_t buf[2];
+
+	if (run(session, HC32BOOT_OP_SUM, 0, HC32L110_FLASH_SIZE, buf))
+	{
+		return -1;
+	}
+	*sum = (uint16_t)(buf[0] | buf[1] << 8);
+	return 0;
+}
+
+//--------------------------------------------
+int devcache_write(hc32boot_t *session, const char *dir, const hc32boot_image_t *image, int verify)
+{
+	static uint8_t state[HC32L110_FLASH_SIZE];
+	static uint8_t buf[HC32L110_FLASH_SIZE];
+	char path[DEVCACHE_PATH_SIZE];
+	devcache_record_t old;
+	devcache_record_t rec;
+	int changed[DEVCACHE_SECTOR_CNT];
+	int changed_cnt = 0;
+	int trusted = 0;
+	uint16_t sum;
+	int cnt;
+
+	// the flash as it has to be: the image, erased bytes everywhere else
+	memset(&rec, 0, sizeof(rec));
+	memcpy(rec.magic, DEVCACHE_MAGIC, sizeof(rec.magic));
+	memset(state, 0xff, sizeof(state));
+	hc32boot_image_get(image, image->addr, state + image->addr, image->size);
+	for (cnt = 0; cnt < DEVCACHE_SECTOR_CNT; cnt++)
+	{
+		rec.sector_crc[cnt] = crc32(CRC32_INIT, state + cnt * HC32L110_SECTOR_SIZE, HC32L110_SECTOR_SIZE);
+	}
+	for (cnt = 0; cnt < HC32L110_FLASH_SIZE; cnt++)
+	{
+		rec.sum += state[cnt];
+	}
+	rec.image_crc = image->crc;
+
+	if (run(session, HC32BOOT_OP_READ, HC32L110_UID_ADDR, HC32L110_UID_SIZE, rec.uid) ||
+		record_path(path, sizeof(path), dir, rec.uid))
+	{
+		return -1;
+	}
+	if (!record_load(&old, path, rec.uid))
+	{
+		// one command tells whether the board still holds what was recorded
+		if (device_sum(session, &sum))
+		{
+			return -1;
+		}
+		trusted = sum == old.sum;
+		if (!trusted)
+		{
+			printf("The flash memory has changed since the last write through the device cache.\n");
+		}
+	}
+	for (cnt = 0; cnt < DEVCACHE_SECTOR_CNT; cnt++)
+	{
+		changed[cnt] = !trusted || old.sector_crc[cnt] != rec.sector_crc[cnt];
+		changed_cnt += changed[cnt];
+	}
+	printf("Device UID %.*s: %s, %d of %d sectors to write.\n", 2 * HC32L110_UID_SIZE, strrchr(path, '/') + 1,
+		trusted ? "device cache confirmed" : "unknown state", changed_cnt, DEVCACHE_SECTOR_CNT);
+
+	if (changed_cnt)
+	{
+		// a run that fails half way leaves no record to be trusted
+		remove(path);
+	}
+	if (!trusted)
+	{
+		printf("Erase Flash memory.\n");
+		if (run(session, HC32BOOT_OP_ERASE, 0, 0, NULL))
+		{
+			return -1;
+		}
+	}
+	for (cnt = 0; cnt < DEVCACHE_SECTOR_CNT; cnt++)
+	{
+		uint32_t addr;
+		uint32_t end;
+		int last;
+
+		if (!changed[cnt])
+		{
+			continue;
+		}
+		// neighbouring changed sectors are one erase and one write
+		for (last = cnt; last + 1 < DEVCACHE_SECTOR_CNT && changed[last + 1]; last++);
+		addr = cnt * HC32L110_SECTOR_SIZE;
+		end = (last + 1) * HC32L110_SECTOR_SIZE;
+		if (trusted)
+		{
+			printf("Erase Flash memory 0x%04X-0x%04X.\n", addr, end - 1);
+			if (run(session, HC32BOOT_OP_ERASE, addr, end - addr, NULL))
+			{
+				return -1;
+			}
+		}
+		// erased bytes need no writing
+		addr = addr < image->addr ? image->addr : addr;
+		end = end > image->addr + image->size ? image->addr + image->size : end;
+		if (addr < end)
+		{
+			printf("Write Flash memory 0x%04X-0x%04X.\n", addr, end - 1);
+			if (run(session, HC32BOOT_OP_WRITE, addr, end - addr, state + addr))
+			{
+				return -1;
+			}
+			if (verify)
+			{
+				if (run(session, HC32BOOT_OP_READ, addr, end - addr, buf + addr))
+				{
+					return -1;
+				}
+				if (memcmp(buf + addr, state + addr, end - addr))
+				{
+					printf("ERROR: Verification of 0x%04X-0x%04X failed.\n", addr, end - 1);
+					return -1;
+				}
+			}
+		}
+		cnt = last;
+	}
+
+	// the record is stored only for a result confirmed by the board
+	if (changed_cnt)
+	{
+		if (device_sum(session, &sum))
+		{
+			return -1;
+		}
+		if (sum != rec.sum)
+		{
+			printf("ERROR: The flash memory sum 0x%04X differs from the expected 0x%04X.\n", sum, rec.sum);
+			return -1;
+		}
+		if (verify)
+		{
+			printf("Verification passed.\n");
+		}
+	}
+	if (record_store(&rec, path))
+	{
+		printf("Warning: Could not store the device cache record %s.\n", path);
+	}
+	return 0;
+}
+
+//--------------------------------------------
+void devcache_plan(const hc32boot_image_t *image, int verify,
+	void (*plan)(void *arg, const char *phase, const hc32boot_op_t *op), void *arg)
+{
+	hc32boot_op_t op;
+
+	// a board without a record: UID, chip erase, the image, the sum
+	memset(&op, 0, sizeof(op));
+	op.type = HC32BOOT_OP_READ;
+	op.addr = HC32L110_UID_ADDR;
+	op.size = HC32L110_UID_SIZE;
+	plan(arg, "devcache", &op);
+	op.type = HC32BOOT_OP_ERASE;
+	op.addr = 0;
+	op.size = 0;
+	plan(arg, "erase", &op);
+	op.type = HC32BOOT_OP_WRITE;
+	op.addr = image->addr;
+	op.size = image->size;
+	plan(arg, "write", &op);
+	if (verify)
+	{
+		op.type = HC32BOOT_OP_READ;
+		plan(arg, "verify", &op);
+	}
+	op.type = HC32BOOT_OP_SUM;
+	op.addr = 0;
+	op.size = HC32L110_FLASH_SIZE;
+	plan(arg, "devcache", &op);
+}
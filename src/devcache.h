@@ -0,0 +1,34 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef DEVCACHE_H_
+#define DEVCACHE_H_
+
+#include "hc32boot.h"
+
+//--------------------------------------------
+// Device state cache: <dir>/<uid>.hc32dev records what this tool last left
+// in the flash of every board, the CRC-32 of each sector and the 16-bit sum
+// of the whole flash. A write through the cache makes the flash equal to an
+// erase followed by a write of the image: when one checksum command of the
+// flashloader confirms the record, only the sectors that differ from it are
+// erased and written, otherwise the whole flash is. Prints the progress and
+// the errors, the record is updated once the result is confirmed.
+int devcache_write(hc32boot_t *session, const char *dir, const hc32boot_image_t *image, int verify);
+// calls plan for every operation devcache_write() submits to a board it has no record of,
+// the worst case: the board is not known before the port is opened
+void devcache_plan(const hc32boot_image_t *image, int verify,
+	void (*plan)(void *arg, const char *phase, const hc32boot_op_t *op), void *arg);
+
+#endif /* DEVCACHE_H_ */
@@ -0,0 +1,1940 @@
+/*
+* Copyright (c) 2022, 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdlib.h>     /* calloc, free */
+#include <string.h>     /* memcpy, strcmp */
+#include <assert.h>     /* assert */
+#include <errno.h>      /* ECANCELED */
+#ifdef _WIN32
+#include <windows.h>    /* Windows stuff */
+#include "gettimeofday.h"
+#undef sleep
+#define sleep(a) Sleep(a)
+#else
+#include <sys/time.h>   /* gettimeofday */
+#include <unistd.h>     /* usleep */
+#include <poll.h>       /* poll */
+#include <sys/ioctl.h>  /* ioctl, FIONREAD */
+#define sleep(a) usleep((a) * 1000)
+#endif
+#include "checksum.h"
+#include "hc32boot.h"
+#include "uring.h"
+#include "trace.h"
+
+//--------------------------------------------
+static const uint8_t buf_connect[] = {
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
+	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff
+};
+static const uint8_t buf_ramcode[] = {
+	0xb8, 0x0a, 0x00, 0x20, 0x09, 0x00, 0x00, 0x20, 0x72, 0xb6, 0x03, 0x48, 0x01, 0x68, 0x81, 0xf3,
+	0x08, 0x88, 0x02, 0x48, 0x00, 0x47, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x95, 0x07, 0x00, 0x20,
+	0xc0, 0x68, 0x01, 0x68, 0x6e, 0x48, 0x01, 0x62, 0x6e, 0x4a, 0x89, 0x18, 0x6e, 0x4a, 0x91, 0x42,
+	0x01, 0xd3, 0x06, 0x21, 0x81, 0x71, 0x70, 0x47, 0x80, 0xb5, 0x00, 0xf0, 0xe7, 0xf8, 0x6b, 0x48,
+	0x01, 0x68, 0x03, 0x22, 0x0a, 0x43, 0x02, 0x60, 0x00, 0x21, 0x09, 0x60, 0x01, 0x68, 0xca, 0x06,
+	0xd2, 0x0f, 0xfb, 0xd1, 0x01, 0xbd, 0x10, 0xb5, 0x04, 0x00, 0x60, 0x68, 0x80, 0x21, 0x09, 0x02,
+	0x88, 0x42, 0x05, 0xd3, 0x62, 0x49, 0x40, 0x18, 0x80, 0x21, 0x89, 0x00, 0x88, 0x42, 0x10, 0xd2,
+	0x00, 0xf0, 0xcc, 0xf8, 0x5d, 0x48, 0x01, 0x68, 0x03, 0x22, 0x91, 0x43, 0x02, 0x22, 0x0a, 0x43,
+	0x02, 0x60, 0x00, 0x21, 0x62, 0x68, 0x11, 0x60, 0x01, 0x68, 0xca, 0x06, 0xd2, 0x0f, 0x03, 0xd0,
+	0xfa, 0xe7, 0x05, 0x20, 0x52, 0x49, 0x88, 0x71, 0x10, 0xbd, 0x80, 0xb5, 0x01, 0x00, 0x4a, 0x69,
+	0x48, 0x68, 0x80, 0x23, 0x1b, 0x02, 0x9a, 0x42, 0x05, 0xd3, 0x52, 0x4b, 0x98, 0x42, 0x07, 0xd3,
+	0x51, 0x4b, 0x9a, 0x42, 0x04, 0xd2, 0x0a, 0x89, 0xc9, 0x68, 0x00, 0xf0, 0x01, 0xf9, 0x01, 0xbd,
+	0x05, 0x20, 0x47, 0x49, 0x88, 0x71, 0x01, 0xbd, 0x80, 0xb5, 0x01, 0x89, 0x44, 0x4a, 0x91, 0x80,
+	0x02, 0x89, 0xc1, 0x68, 0x40, 0x68, 0x00, 0xf0, 0x28, 0xf9, 0x01, 0xbd, 0x1c, 0xb5, 0x00, 0x21,
+	0x6a, 0x46, 0x11, 0x80, 0xc1, 0x68, 0x09, 0x68, 0x40, 0x68, 0x3d, 0x4c, 0x42, 0x18, 0x52, 0x1e,
+	0x80, 0x23, 0x1b, 0x02, 0x9a, 0x42, 0x02, 0xd3, 0x05, 0x20, 0xa0, 0x71, 0x02, 0xe0, 0x6a, 0x46,
+	0x00, 0xf0, 0xbf, 0xf8, 0x3d, 0x48, 0x69, 0x46, 0x09, 0x88, 0x01, 0x72, 0x69, 0x46, 0x09, 0x88,
+	0x09, 0x0a, 0x41, 0x72, 0x02, 0x20, 0xa0, 0x80, 0x13, 0xbd, 0x7c, 0xb5, 0x00, 0x22, 0x00, 0x92,
+	0xc1, 0x68, 0x09, 0x68, 0x2e, 0x4e, 0x01, 0x25, 0xb5, 0x80, 0x34, 0x4c, 0x22, 0x72, 0x6a, 0x46,
+	0x40, 0x68, 0x00, 0xf0, 0xb3, 0xf8, 0x00, 0x28, 0x02, 0xd0, 0x00, 0x98, 0x30, 0x60, 0x73, 0xbd,
+	0x25, 0x72, 0x73, 0xbd, 0x01, 0x20, 0x26, 0x49, 0x88, 0x80, 0x2c, 0x49, 0x2c, 0x4a, 0x12, 0x78,
+	0xff, 0x2a, 0x00, 0xd1, 0x00, 0x20, 0x08, 0x72, 0x70, 0x47, 0x80, 0xb5, 0xee, 0x20, 0x69, 0x46,
+	0x08, 0x70, 0x01, 0x22, 0x26, 0x48, 0x00, 0xf0, 0xab, 0xf8, 0x01, 0x22, 0x69, 0x46, 0x25, 0x48,
+	0x00, 0xf0, 0xa6, 0xf8, 0x01, 0xbd, 0x70, 0x47, 0x10, 0xb5, 0x19, 0x4c, 0x10, 0xe0, 0x02, 0x20,
+	0xa0, 0x71, 0x20, 0x00, 0x00, 0xf0, 0x52, 0xf9, 0xa0, 0x88, 0x00, 0xf0, 0x6e, 0xf9, 0x60, 0x7a,
+	0x01, 0x28, 0x05, 0xd1, 0xa0, 0x79, 0x00, 0x28, 0x02, 0xd1, 0x20, 0x6a, 0x00, 0xf0, 0x8a, 0xf9,
+	0x00, 0xf0, 0x6b, 0xf9, 0x00, 0xf0, 0xee, 0xf8, 0x01, 0x28, 0xf9, 0xd1, 0x18, 0x21, 0x20, 0x00,
+	0x08, 0x30, 0x00, 0xf0, 0xc5, 0xf9, 0x20, 0x00, 0x08, 0x30, 0x00, 0xf0, 0xfa, 0xf8, 0xa0, 0x71,
+	0xe1, 0x68, 0x21, 0x60, 0x00, 0x21, 0xa1, 0x80, 0x00, 0x28, 0xda, 0xd1, 0x0e, 0x48, 0x61, 0x7a,
+	0x89, 0x00, 0x41, 0x58, 0x00, 0x29, 0xd2, 0xd0, 0x20, 0x00, 0x08, 0x30, 0x88, 0x47, 0xd0, 0xe7,
+	0x10, 0x0a, 0x00, 0x20, 0x80, 0xda, 0xff, 0xff, 0xc1, 0x1c, 0x0f, 0x00, 0x20, 0x00, 0x02, 0x40,
+	0x00, 0xf6, 0xef, 0xff, 0x00, 0x0a, 0x10, 0x00, 0x00, 0x0c, 0x10, 0x00, 0x04, 0x08, 0x00, 0x20,
+	0xfc, 0x0b, 0x10, 0x00, 0xf6, 0x0b, 0x10, 0x00, 0xd4, 0x06, 0x00, 0x20, 0x4d, 0x48, 0x4e, 0x49,
+	0x01, 0x60, 0x4e, 0x49, 0x01, 0x60, 0x70, 0x47, 0x10, 0xb5, 0x4d, 0x49, 0x4a, 0x4a, 0xca, 0x62,
+	0x4a, 0x4b, 0xcb, 0x62, 0x44, 0x01, 0x0c, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x17, 0x24, 0x44, 0x43,
+	0x4c, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x1b, 0x24, 0x44, 0x43, 0x8c, 0x60, 0xca, 0x62, 0xcb, 0x62,
+	0x44, 0x4c, 0x44, 0x43, 0xcc, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x43, 0x4c, 0x44, 0x43, 0x0c, 0x61,
+	0xca, 0x62, 0xcb, 0x62, 0x18, 0x24, 0x44, 0x43, 0x4c, 0x61, 0xca, 0x62, 0xcb, 0x62, 0xf0, 0x24,
+	0x44, 0x43, 0x8c, 0x61, 0xca, 0x62, 0xcb, 0x62, 0xfa, 0x24, 0xa4, 0x00, 0x60, 0x43, 0xc8, 0x61,
+	0xca, 0x62, 0xcb, 0x62, 0x00, 0x20, 0x08, 0x62, 0xca, 0x62, 0xcb, 0x62, 0x37, 0x48, 0x08, 0x63,
+	0x10, 0xbd, 0x30, 0xb5, 0x00, 0x23, 0x00, 0x24, 0x03, 0xe0, 0x05, 0x78, 0x5b, 0x19, 0x40, 0x1c,
+	0x64, 0x1c, 0x8c, 0x42, 0xf9, 0xd3, 0x13, 0x80, 0x00, 0x20, 0x30, 0xbd, 0x30, 0xb5, 0x03, 0x00,
+	0x00, 0x24, 0x00, 0xe0, 0x64, 0x1c, 0x8c, 0x42, 0x08, 0xd2, 0x1d, 0x00, 0x6b, 0x1c, 0x2d, 0x78,
+	0xff, 0x2d, 0xf7, 0xd0, 0x00, 0x19, 0x10, 0x60, 0x01, 0x20, 0x30, 0xbd, 0x00, 0x20, 0x30, 0xbd,
+	0x70, 0xb4, 0x27, 0x4b, 0x20, 0x4c, 0xdc, 0x60, 0x20, 0x4c, 0xdc, 0x60, 0x01, 0x24, 0x1d, 0x68,
+	0x03, 0x26, 0xb5, 0x43, 0x25, 0x43, 0x1d, 0x60, 0x00, 0x26, 0xb6, 0x18, 0xb6, 0x08, 0xb6, 0x00,
+	0x95, 0x1b, 0x10, 0xd1, 0x85, 0x07, 0x0e, 0xd1, 0x15, 0x00, 0x18, 0xd0, 0x1d, 0x4d, 0x1e, 0x68,
+	0x36, 0x09, 0x26, 0x40, 0xfb, 0xd1, 0x0e, 0x68, 0x06, 0x60, 0x09, 0x1d, 0x00, 0x1d, 0x52, 0x19,
+	0x16, 0x04, 0xf4, 0xd1, 0x0b, 0xe0, 0x15, 0x00, 0x09, 0xd0, 0x1d, 0x68, 0x2d, 0x09, 0x25, 0x40,
+	0xfb, 0xd1, 0x0d, 0x78, 0x05, 0x70, 0x49, 0x1c, 0x40, 0x1c, 0x52, 0x1e, 0xf5, 0xd1, 0x18, 0x68,
+	0x00, 0x09, 0x20, 0x40, 0xfb, 0xd1, 0x70, 0xbc, 0x70, 0x47, 0x10, 0xb5, 0x00, 0x23, 0x04, 0xe0,
+	0x04, 0x78, 0x0c, 0x70, 0x40, 0x1c, 0x49, 0x1c, 0x5b, 0x1c, 0x9c, 0xb2, 0x94, 0x42, 0xf7, 0xd3,
+	0x00, 0x20, 0x10, 0xbd, 0x2c, 0x00, 0x02, 0x40, 0x5a, 0x5a, 0x00, 0x00, 0xa5, 0xa5, 0x00, 0x00,
+	0x00, 0x00, 0x02, 0x40, 0x50, 0x46, 0x00, 0x00, 0xe0, 0x22, 0x02, 0x00, 0xff, 0xff, 0x00, 0x00,
+	0x20, 0x00, 0x02, 0x40, 0xfc, 0xff, 0x00, 0x00, 0x10, 0xb5, 0x0a, 0x00, 0x00, 0x21, 0x00, 0x23,
+	0x03, 0xe0, 0x04, 0x78, 0x09, 0x19, 0x40, 0x1c, 0x5b, 0x1c, 0x9c, 0xb2, 0x94, 0x42, 0xf8, 0xd3,
+	0xc8, 0xb2, 0x10, 0xbd, 0x48, 0x48, 0x01, 0x88, 0x09, 0x29, 0x0b, 0xdb, 0x47, 0x49, 0x4a, 0x78,
+	0x05, 0x2a, 0x09, 0xd0, 0x8a, 0x79, 0xc9, 0x79, 0x09, 0x02, 0x11, 0x43, 0x09, 0x31, 0x00, 0x88,
+	0x81, 0x42, 0x04, 0xd0, 0x00, 0x20, 0x70, 0x47, 0x00, 0x88, 0x09, 0x28, 0xfa, 0xd1, 0x01, 0x20,
+	0x70, 0x47, 0x38, 0xb5, 0x04, 0x00, 0x00, 0x20, 0x00, 0x25, 0x3b, 0x4a, 0x11, 0x88, 0x10, 0x80,
+	0x3a, 0x48, 0x02, 0x78, 0x22, 0x70, 0x42, 0x78, 0x62, 0x70, 0x82, 0x78, 0xc3, 0x78, 0x1b, 0x02,
+	0x13, 0x43, 0x02, 0x79, 0x12, 0x04, 0x1a, 0x43, 0x43, 0x79, 0x1b, 0x06, 0x13, 0x43, 0x63, 0x60,
+	0x83, 0x79, 0xc2, 0x79, 0x12, 0x02, 0x1a, 0x43, 0x22, 0x81, 0x63, 0x68, 0x9b, 0x18, 0x5b, 0x1e,
+	0x63, 0x61, 0x23, 0x78, 0x49, 0x2b, 0x16, 0xd1, 0x63, 0x78, 0x0b, 0x2b, 0x01, 0xda, 0x00, 0x2b,
+	0x01, 0xd1, 0x02, 0x25, 0x10, 0xe0, 0x00, 0x2a, 0x02, 0xd0, 0x02, 0x00, 0x08, 0x32, 0xe2, 0x60,
+	0x42, 0x18, 0x52, 0x1e, 0x12, 0x78, 0x22, 0x74, 0x49, 0x1e, 0x89, 0xb2, 0xff, 0xf7, 0xa4, 0xff,
+	0x21, 0x7c, 0x88, 0x42, 0x00, 0xd0, 0x01, 0x25, 0x28, 0x00, 0x32, 0xbd, 0x38, 0xb5, 0x04, 0x00,
+	0x1e, 0x4d, 0xa0, 0x79, 0x68, 0x70, 0x20, 0x68, 0xa8, 0x70, 0x20, 0x68, 0x00, 0x0a, 0xe8, 0x70,
+	0x20, 0x68, 0x00, 0x0c, 0x28, 0x71, 0x20, 0x68, 0x00, 0x0e, 0x68, 0x71, 0xa0, 0x88, 0xa8, 0x71,
+	0xa0, 0x88, 0x00, 0x0a, 0xe8, 0x71, 0xa1, 0x88, 0x08, 0x31, 0x89, 0xb2, 0x28, 0x00, 0xff, 0xf7,
+	0x83, 0xff, 0xa1, 0x88, 0x69, 0x18, 0x08, 0x72, 0x31, 0xbd, 0x80, 0xb5, 0x01, 0x00, 0x09, 0x31,
+	0x89, 0xb2, 0x0e, 0x48, 0x00, 0xf0, 0x38, 0xf8, 0x01, 0xbd, 0x38, 0xb5, 0x00, 0xf0, 0x48, 0xf8,
+	0x00, 0x23, 0x09, 0x49, 0x0a, 0x88, 0x00, 0x2a, 0x01, 0xd1, 0x49, 0x28, 0x0a, 0xd1, 0x07, 0x4a,
+	0x0c, 0x88, 0x07, 0x4d, 0xac, 0x42, 0x04, 0xda, 0x0b, 0x88, 0x5c, 0x1c, 0x0c, 0x80, 0xd0, 0x54,
+	0x31, 0xbd, 0x13, 0x70, 0x0b, 0x80, 0x31, 0xbd, 0x34, 0x0a, 0x00, 0x20, 0x04, 0x08, 0x00, 0x20,
+	0x09, 0x02, 0x00, 0x00, 0x30, 0xb5, 0x00, 0x21, 0x00, 0x22, 0x09, 0x4b, 0xd4, 0xb2, 0xa5, 0x00,
+	0x5d, 0x59, 0xa8, 0x42, 0x0a, 0xd0, 0x52, 0x1c, 0xd4, 0xb2, 0x0c, 0x2c, 0xf6, 0xdb, 0x00, 0xbf,
+	0x15, 0xa0, 0x40, 0x5a, 0x03, 0x49, 0x08, 0x60, 0x48, 0x60, 0x30, 0xbd, 0x61, 0x00, 0xf6, 0xe7,
+	0x74, 0x06, 0x00, 0x20, 0x00, 0x0c, 0x00, 0x40, 0x30, 0xb5, 0x00, 0x22, 0x80, 0x23, 0xdb, 0x05,
+	0x0a, 0xe0, 0x04, 0x5d, 0x1c, 0x60, 0x1c, 0x69, 0xa5, 0x07, 0xed, 0x0f, 0xfb, 0xd0, 0x5c, 0x69,
+	0x02, 0x25, 0xac, 0x43, 0x5c, 0x61, 0x52, 0x1c, 0x94, 0xb2, 0x8c, 0x42, 0xf1, 0xd3, 0x30, 0xbd,
+	0x80, 0x20, 0xc0, 0x05, 0x01, 0x69, 0xc9, 0x07, 0xfc, 0xd5, 0x41, 0x69, 0x01, 0x22, 0x91, 0x43,
+	0x41, 0x61, 0x00, 0x68, 0xc0, 0xb2, 0x70, 0x47, 0x70, 0xff, 0xa0, 0xff, 0xb8, 0xff, 0xdc, 0xff,
+	0xe8, 0xff, 0xf4, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfa, 0xff, 0xfd, 0xff, 0xfe, 0xff,
+	0x00, 0x22, 0x00, 0xbf, 0x09, 0x42, 0x02, 0xd0, 0x49, 0x1e, 0x42, 0x54, 0xfc, 0xd1, 0x70, 0x47,
+	0xf8, 0xb5, 0x2d, 0x4c, 0x2d, 0x48, 0xa0, 0x60, 0x2d, 0x4d, 0xa5, 0x60, 0x20, 0x68, 0xe0, 0x21,
+	0x49, 0x00, 0x01, 0x43, 0x21, 0x60, 0x2b, 0x48, 0x2b, 0x49, 0x82, 0x88, 0x0a, 0x40, 0xe2, 0x60,
+	0x42, 0x88, 0x0a, 0x40, 0xe2, 0x60, 0x00, 0x88, 0x01, 0x40, 0xe1, 0x60, 0x23, 0x48, 0xa0, 0x60,
+	0xa5, 0x60, 0x20, 0x68, 0x25, 0x49, 0x01, 0x40, 0x21, 0x60, 0x06, 0x20, 0xff, 0xf7, 0x44, 0xfe,
+	0x00, 0x21, 0x23, 0x48, 0x01, 0x60, 0x03, 0x20, 0x22, 0x4a, 0x23, 0x4b, 0x23, 0x4e, 0x27, 0x6a,
+	0xff, 0x07, 0x26, 0x62, 0x13, 0xd5, 0x19, 0x4e, 0xa6, 0x60, 0xa5, 0x60, 0x65, 0x68, 0x96, 0x0d,
+	0x2e, 0x43, 0x66, 0x60, 0x05, 0x24, 0x1c, 0x60, 0x15, 0x68, 0x80, 0x26, 0x2e, 0x43, 0x16, 0x60,
+	0xd1, 0x64, 0x9c, 0x62, 0x11, 0x6c, 0x02, 0x23, 0x99, 0x43, 0x11, 0x64, 0x0a, 0xe0, 0x98, 0x63,
+	0x14, 0x6c, 0x20, 0x25, 0xac, 0x43, 0x14, 0x64, 0xd1, 0x64, 0xd8, 0x63, 0x11, 0x6c, 0x40, 0x23,
+	0x0b, 0x43, 0x13, 0x64, 0x12, 0x49, 0x13, 0x4a, 0x0a, 0x60, 0x4a, 0x60, 0xc8, 0x60, 0x0c, 0x48,
+	0x90, 0x21, 0x89, 0x00, 0x01, 0x60, 0x01, 0x68, 0x10, 0x22, 0x0a, 0x43, 0x02, 0x60, 0xff, 0xf7,
+	0xbb, 0xfd, 0x00, 0x20, 0xf2, 0xbd, 0x00, 0xbf, 0x00, 0x20, 0x00, 0x40, 0x5a, 0x5a, 0x00, 0x00,
+	0xa5, 0xa5, 0x00, 0x00, 0x02, 0x0c, 0x10, 0x00, 0xff, 0x07, 0x00, 0x00, 0x3f, 0xfe, 0xff, 0xff,
+	0x04, 0x00, 0x00, 0x40, 0x80, 0x0d, 0x02, 0x40, 0x9c, 0x0c, 0x02, 0x40, 0x01, 0x01, 0x00, 0xf0,
+	0x00, 0x0c, 0x00, 0x40, 0x70, 0xff, 0x00, 0x00, 0x70, 0xb4, 0x01, 0x23, 0x00, 0x24, 0x13, 0xe0,
+	0x01, 0x68, 0x00, 0x1d, 0x19, 0x42, 0x02, 0xd0, 0x4d, 0x46, 0x6d, 0x1e, 0x49, 0x19, 0x0c, 0x60,
+	0x09, 0x1d, 0x12, 0x1f, 0x04, 0x2a, 0xfa, 0xd2, 0x0d, 0x00, 0x96, 0x07, 0x01, 0xd5, 0x0c, 0x80,
+	0xad, 0x1c, 0x1a, 0x40, 0x00, 0xd0, 0x2c, 0x70, 0x02, 0x68, 0x00, 0x1d, 0x00, 0x2a, 0xe7, 0xd1,
+	0x70, 0xbc, 0x70, 0x47, 0x80, 0x25, 0x00, 0x00, 0x40, 0x38, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x00,
+	0x00, 0x96, 0x00, 0x00, 0x00, 0xe1, 0x00, 0x00, 0x00, 0xc2, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x84, 0x03, 0x00, 0x00, 0x08, 0x07, 0x00,
+	0x00, 0x8c, 0x0a, 0x00, 0x30, 0xb4, 0x01, 0x22, 0x01, 0x68, 0x00, 0x1d, 0x00, 0x29, 0x0f, 0xd0,
+	0x03, 0x68, 0xc3, 0x18, 0x44, 0x68, 0x08, 0x30, 0x14, 0x42, 0x02, 0xd0, 0x4d, 0x46, 0x6d, 0x1e,
+	0x64, 0x19, 0x1d, 0x68, 0x25, 0x60, 0x1b, 0x1d, 0x24, 0x1d, 0x09, 0x1f, 0xec, 0xd0, 0xf8, 0xe7,
+	0x30, 0xbc, 0x70, 0x47, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0x00, 0x20, 0x39, 0x00, 0x00, 0x20,
+	0x57, 0x00, 0x00, 0x20, 0x9b, 0x00, 0x00, 0x20, 0xc9, 0x00, 0x00, 0x20, 0xdd, 0x00, 0x00, 0x20,
+	0x1b, 0x01, 0x00, 0x20, 0x45, 0x01, 0x00, 0x20, 0x5b, 0x01, 0x00, 0x20, 0x77, 0x01, 0x00, 0x20,
+	0x10, 0xb5, 0x07, 0x49, 0x79, 0x44, 0x18, 0x31, 0x06, 0x4c, 0x7c, 0x44, 0x16, 0x34, 0x04, 0xe0,
+	0x08, 0x1d, 0x0a, 0x68, 0x89, 0x18, 0x88, 0x47, 0x01, 0x00, 0xa1, 0x42, 0xf8, 0xd1, 0x10, 0xbd,
+	0x08, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x11, 0xff, 0xff, 0xff, 0x34, 0x02, 0x00, 0x00,
+	0x04, 0x08, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x6d, 0xff, 0xff, 0xff, 0x04, 0x00, 0x00, 0x00,
+	0x60, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x01, 0x20, 0xc0, 0x46,
+	0x00, 0x28, 0x01, 0xd0, 0xff, 0xf7, 0xd4, 0xff, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0x20, 0x00, 0xbf,
+	0x00, 0xbf, 0xff, 0xf7, 0xf5, 0xfe, 0x00, 0xf0, 0x00, 0xf8, 0x80, 0xb5, 0x00, 0xf0, 0x02, 0xf8,
+	0x01, 0xbd, 0x00, 0x00, 0x07, 0x46, 0x38, 0x46, 0x00, 0xf0, 0x02, 0xf8, 0xfb, 0xe7, 0x00, 0x00,
+	0x80, 0xb5, 0x00, 0xbf, 0x00, 0xbf, 0x02, 0x4a, 0x11, 0x00, 0x18, 0x20, 0xab, 0xbe, 0xfb, 0xe7,
+	0x26, 0x00, 0x02, 0x00, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0xbf, 0xff, 0xf7, 0xd6, 0xff,
+	0x00, 0x00, 0x00, 0x00, 0x9f
+};
+static const uint8_t buf_upload[] = {
+	0x00, 0x00, 0x00, 0x00, 0x20, 0xa4, 0x07, 0x00, 0x00, 0xcb
+};
+// stage-1 bootstrap stub, see stub/stub.s; the last two words are the baud rate ratio and the image size
+static const uint8_t buf_stub[] = {
+	0xb8, 0x0a, 0x00, 0x20, 0x09, 0x00, 0x00, 0x20, 0x72, 0xb6, 0x27, 0x48, 0x27, 0x49, 0x00, 0x22,
+	0x27, 0x4b, 0x84, 0x58, 0x8c, 0x50, 0x04, 0x32, 0x9a, 0x42, 0xfa, 0xd3, 0x25, 0x48, 0x00, 0x47,
+	0x25, 0x4d, 0x26, 0x4e, 0x30, 0x68, 0x80, 0x46, 0x01, 0x21, 0x09, 0x04, 0x0f, 0x1a, 0x24, 0x4a,
+	0x00, 0x23, 0x97, 0x42, 0x02, 0xd3, 0xbf, 0x1a, 0x01, 0x33, 0xfa, 0xe7, 0x5a, 0x24, 0x00, 0x2f,
+	0x02, 0xd1, 0x00, 0x2b, 0x00, 0xd0, 0xa5, 0x24, 0xc8, 0x1a, 0x00, 0xf0, 0x20, 0xf8, 0xa5, 0x2c,
+	0x01, 0xd1, 0x30, 0x60, 0x70, 0x60, 0x14, 0x48, 0x1a, 0x49, 0x00, 0x22, 0x2b, 0x69, 0xdb, 0x07,
+	0xfc, 0xd5, 0x6b, 0x69, 0x01, 0x27, 0xbb, 0x43, 0x6b, 0x61, 0x2b, 0x68, 0x03, 0x70, 0xd2, 0x18,
+	0x01, 0x30, 0x01, 0x39, 0xf2, 0xd1, 0xd4, 0xb2, 0x00, 0xf0, 0x09, 0xf8, 0x40, 0x46, 0x30, 0x60,
+	0x70, 0x60, 0x09, 0x48, 0x01, 0x68, 0x81, 0xf3, 0x08, 0x88, 0x41, 0x68, 0x08, 0x47, 0x02, 0x27,
+	0x6b, 0x69, 0xbb, 0x43, 0x6b, 0x61, 0x2c, 0x60, 0x2b, 0x69, 0x9b, 0x07, 0xfc, 0xd5, 0x6b, 0x69,
+	0xbb, 0x43, 0x6b, 0x61, 0x70, 0x47, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x08, 0x00, 0x20,
+	0xc8, 0x00, 0x00, 0x00, 0x21, 0x08, 0x00, 0x20, 0x00, 0x00, 0x00, 0x40, 0x00, 0x0c, 0x00, 0x40,
+	0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+static const uint8_t buf_execute[] = {
+	0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0
+};
+
+
+//--------------------------------------------
+size_t hc32boot_frame_build(uint8_t *frame, uint8_t cmd, uint32_t addr, uint16_t size, const uint8_t *data)
+{
+	size_t len = HC32BOOT_FRAME_HEADER_SIZE;
+
+	frame[0] = HC32BOOT_FRAME_HEADER;
+	frame[1] = cmd;
+	frame[2] = (uint8_t)addr;
+	frame[3] = (uint8_t)(addr >> 8);
+	frame[4] = (uint8_t)(addr >> 16);
+	frame[5] = (uint8_t)(addr >> 24);
+	frame[6] = (uint8_t)size;
+	frame[7] = (uint8_t)(size >> 8);
+	if (data)
+	{
+		memcpy(frame + HC32BOOT_FRAME_HEADER_SIZE, data, size);
+		len += size;
+	}
+	frame[len] = sum8(frame, len);
+	return len + 1;
+}
+
+//--------------------------------------------
+void hc32boot_resp_init(hc32boot_resp_t *resp)
+{
+	resp->cnt = 0;
+}
+
+//--------------------------------------------
+size_t hc32boot_resp_need(const hc32boot_resp_t *resp)
+{
+	if (resp->cnt < HC32BOOT_FRAME_HEADER_SIZE)
+	{
+		return HC32BOOT_FRAME_HEADER_SIZE - resp->cnt;
+	}
+	return HC32BOOT_FRAME_HEADER_SIZE + hc32boot_resp_size(resp) + 1 - resp->cnt;
+}
+
+//--------------------------------------------
+int hc32boot_resp_feed(hc32boot_resp_t *resp, const uint8_t *data, size_t len)
+{
+	assert(len <= hc32boot_resp_need(resp));
+
+	memcpy(resp->buf + resp->cnt, data, len);
+	resp->cnt += len;
+	if (resp->cnt >= 1 && resp->buf[0] != HC32BOOT_FRAME_HEADER)
+	{
+		return HC32BOOT_RESP_ERROR;
+	}
+	// non-zero status: checksum error, unknown command or address out of range
+	if (resp->cnt >= 2 && resp->buf[1] != 0)
+	{
+		return HC32BOOT_RESP_ERROR;
+	}
+	if (resp->cnt < HC32BOOT_FRAME_HEADER_SIZE)
+	{
+		return HC32BOOT_RESP_MORE;
+	}
+	if (hc32boot_resp_size(resp) > READ_PACKET_MAX_DATA_SIZE)
+	{
+		return HC32BOOT_RESP_ERROR;
+	}
+	if (hc32boot_resp_need(resp))
+	{
+		return HC32BOOT_RESP_MORE;
+	}
+	if (sum8(resp->buf, resp->cnt - 1) != resp->buf[resp->cnt - 1])
+	{
+		return HC32BOOT_RESP_ERROR;
+	}
+	return HC32BOOT_RESP_DONE;
+}
+
+//--------------------------------------------
+uint32_t hc32boot_resp_addr(const hc32boot_resp_t *resp)
+{
+	return (uint32_t)resp->buf[5] << 24 | (uint32_t)resp->buf[4] << 16 | (uint32_t)resp->buf[3] << 8 | resp->buf[2];
+}
+
+//--------------------------------------------
+uint16_t hc32boot_resp_size(const hc32boot_resp_t *resp)
+{
+	return (uint16_t)resp->buf[7] << 8 | resp->buf[6];
+}
+
+//--------------------------------------------
+int hc32boot_image_prepare(hc32boot_image_t *image, uint32_t addr, uint8_t *data, uint32_t size, uint16_t pkt_size)
+{
+	uint32_t sector;
+	uint32_t done;
+
+	assert(image);
+	assert(data);
+
+	if (!size || addr + size > HC32L110_FLASH_SIZE)
+	{
+		return -1;
+	}
+	if (!pkt_size || pkt_size > WRITE_PACKET_MAX_DATA_SIZE)
+	{
+		pkt_size = WRITE_PACKET_MAX_DATA_SIZE;
+	}
+	memset(image, 0, sizeof(*image));
+	image->addr = addr;
+	image->size = size;
+	image->data = data;
+	image->crc = crc32(CRC32_INIT, data, size);
+
+	image->sector_first = addr / HC32L110_SECTOR_SIZE;
+	image->sector_cnt = (addr + size - 1) / HC32L110_SECTOR_SIZE - image->sector_first + 1;
+	for (sector = 0; sector < image->sector_cnt; sector++)
+	{
+		uint32_t start = (image->sector_first + sector) * HC32L110_SECTOR_SIZE;
+		uint32_t end = start + HC32L110_SECTOR_SIZE;
+		start = start < addr ? addr : start;
+		end = end > addr + size ? addr + size : end;
+		image->sector_crc[sector] = crc32(CRC32_INIT, data + (start - addr), end - start);
+	}
+
+	image->pkt_size = pkt_size;
+	image->frame_cnt = (size + pkt_size - 1) / pkt_size;
+	image->frame_stride = HC32BOOT_FRAME_HEADER_SIZE + pkt_size + 1;
+	image->frames = malloc(image->frame_cnt * image->frame_stride);
+	if (!image->frames)
+	{
+		return -1;
+	}
+	for (done = 0; done < size; done += pkt_size)
+	{
+		uint16_t len = size - done > pkt_size ? pkt_size : (uint16_t)(size - done);
+		hc32boot_frame_build(image->frames + done / pkt_size * image->frame_stride, HC32BOOT_CMD_WRITE, addr + done, len, data + done);
+	}
+	return 0;
+}
+
+//--------------------------------------------
+void hc32boot_image_free(hc32boot_image_t *image)
+{
+	free(image->frames);
+	free(image->overlay_map);
+	free(image->overlay);
+	image->frames = NULL;
+	image->overlay_map = NULL;
+	image->overlay = NULL;
+	image->overlay_cnt = 0;
+}
+
+//--------------------------------------------
+const uint8_t *hc32boot_image_frame(const hc32boot_image_t *image, size_t index)
+{
+	assert(index < image->frame_cnt);
+
+	if (image->overlay_map && image->overlay_map[index])
+	{
+		return image->overlay + (image->overlay_map[index] - 1) * image->frame_stride;
+	}
+	return image->frames + index * image->frame_stride;
+}
+
+//--------------------------------------------
+// copies the image contents, patches included
+int hc32boot_image_get(const hc32boot_image_t *image, uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	uint32_t offset;
+
+	if (addr < image->addr || addr + len > image->addr + image->size)
+	{
+		return -1;
+	}
+	for (offset = addr - image->addr; len; )
+	{
+		const uint8_t *frame = hc32boot_image_frame(image, offset / image->pkt_size);
+		uint32_t pos = offset % image->pkt_size;
+		uint32_t cnt = image->pkt_size - pos > len ? len : image->pkt_size - pos;
+		memcpy(buf, frame + HC32BOOT_FRAME_HEADER_SIZE + pos, cnt);
+		buf += cnt;
+		offset += cnt;
+		len -= cnt;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+int hc32boot_image_patch(hc32boot_image_t *image, uint32_t addr, const uint8_t *bytes, uint32_t len)
+{
+	uint8_t buf[HC32L110_SECTOR_SIZE];
+	uint32_t offset;
+	uint32_t sector;
+
+	assert(image);
+	assert(bytes);
+
+	if (!image->frames || addr < image->addr || addr + len > image->addr + image->size)
+	{
+		return -1;
+	}
+	if (!image->overlay_map && (image->overlay_map = calloc(image->frame_cnt, sizeof(uint32_t))) == NULL)
+	{
+		return -1;
+	}
+	for (offset = addr - image->addr; len; )
+	{
+		size_t index = offset / image->pkt_size;
+		uint32_t pos = offset % image->pkt_size;
+		uint32_t cnt = image->pkt_size - pos > len ? len : image->pkt_size - pos;
+		const uint8_t *shared = image->frames + index * image->frame_stride;
+		uint16_t size = (uint16_t)shared[7] << 8 | shared[6];
+		uint8_t *frame;
+
+		if (!image->overlay_map[index])
+		{
+			uint8_t *overlay = realloc(image->overlay, (image->overlay_cnt + 1) * image->frame_stride);
+			if (!overlay)
+			{
+				return -1;
+			}
+			image->overlay = overlay;
+			memcpy(image->overlay + image->overlay_cnt * image->frame_stride, shared, HC32BOOT_FRAME_HEADER_SIZE + size + 1);
+			image->overlay_map[index] = ++image->overlay_cnt;
+		}
+		frame = image->overlay + (image->overlay_map[index] - 1) * image->frame_stride;
+		memcpy(frame + HC32BOOT_FRAME_HEADER_SIZE + pos, bytes, cnt);
+		frame[HC32BOOT_FRAME_HEADER_SIZE + size] = sum8(frame, HC32BOOT_FRAME_HEADER_SIZE + size);
+		bytes += cnt;
+		offset += cnt;
+		len -= cnt;
+	}
+
+	image->crc = CRC32_INIT;
+	for (sector = 0; sector < image->sector_cnt; sector++)
+	{
+		uint32_t start = (image->sector_first + sector) * HC32L110_SECTOR_SIZE;
+		uint32_t end = start + HC32L110_SECTOR_SIZE;
+		start = start < image->addr ? image->addr : start;
+		end = end > image->addr + image->size ? image->addr + image->size : end;
+		hc32boot_image_get(image, start, buf, end - start);
+		image->sector_crc[sector] = crc32(CRC32_INIT, buf, end - start);
+		image->crc = crc32(image->crc, buf, end - start);
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// what the session expects to receive after the transmission
+#define RX_NONE                  0
+#define RX_CONNECT_ACK           1   // 0x11 from the ROM bootloader
+#define RX_SUCCESS_ACK           2   // 0x01 from the ROM bootloader
+#define RX_EXECUTE_ACK           3   // 11 bytes once the flashloader starts
+#define RX_RESP                  4   // flashloader response frame
+#define RX_BYTE                  5   // any single byte, stored in rx_byte
+#define RX_BANNER                6   // the boot banner of the current operation, anywhere in the stream
+
+//--------------------------------------------
+// The ROM bootloader answers the connect pattern within a fixed window after reset,
+// the settle time lets it finish receiving the rest of the pattern.
+#define CONNECT_ACK_TIMEOUT      20
+#define CONNECT_SETTLE_TIME      200
+
+//--------------------------------------------
+// Timeout model: every deadline is the wire time of both directions, plus the
+// flash busy time of the command and the link latency, multiplied by the
+// safety factor. The margin covers the host scheduling jitter.
+#define UART_BITS_PER_BYTE       10    // 8N1
+#define TIMEOUT_SAFETY_FACTOR    2
+#define TIMEOUT_MARGIN_MS        10
+#define DEFAULT_LATENCY_US       50000 // until measured, covers a 16 ms USB-UART latency timer
+#define EXECUTE_ACK_SIZE         11
+// HC32L110 flash timing (datasheet maximums)
+#define FLASH_PROGRAM_US         32    // per 32-bit word
+#define FLASH_SECTOR_ERASE_US    5000
+#define FLASH_CHIP_ERASE_US      40000
+#define CHECKSUM_SECTOR_US       2000  // the flashloader summing loop, per sector
+
+//--------------------------------------------
+// two-stage load
+#define FLASHLOADER_ADDR         0x20000000
+#define FLASHLOADER_SIZE         (sizeof(buf_ramcode) - 1)  // the last byte is the ROM upload checksum
+#define STUB_BAUDRATE_SWITCHED   0xa5
+#define STUB_BAUDRATE_KEPT       0x5a
+
+//--------------------------------------------
+// link calibration
+#define RTT_OVERHEAD_DIVISOR     32    // accepted round trip cost per packet, in parts of its wire time
+
+//--------------------------------------------
+struct hc32boot
+{
+	HANDLE dev;
+	int dev_closed;
+	hc32boot_config_t cfg;
+	// operation queue, the first entry is the current operation
+	hc32boot_op_t queue[HC32BOOT_OP_QUEUE_SIZE];
+	size_t queue_cnt;
+	int step;
+	int failed;
+	uint32_t done;
+	uint16_t pkt_size;
+	// transmission in progress
+	const uint8_t *tx;
+	size_t tx_len;
+	// reception in progress
+	int rx_kind;
+	size_t rx_cnt;
+	hc32boot_resp_t resp;
+	size_t deadline_ms;
+	// nothing is sent before this time
+	size_t resume_ms;
+	uint8_t frame[HC32BOOT_FRAME_MAX_SIZE];
+	hc32boot_link_t link;
+	uint64_t probe_us;
+	int baudrate;            // current baud rate of the port
+	size_t connect_until_ms; // HC32BOOT_RESET_NONE: the connect pattern is repeated until this time
+	uint8_t rx_byte;
+	uint8_t stub[sizeof(buf_stub) + 1];
+	hc32boot_stats_t stats;
+	void (*frame_hook)(void *arg, int cmd, uint32_t rtt_us);
+	void *frame_arg;
+	uint64_t frame_us;       // the frame hook and the probes: when the transmission of the frame started
+	int frame_cmd;
+	// the probes only
+	uint32_t frame_addr;
+	uint64_t frame_rx;       // rx_bytes when the frame was sent
+	uint64_t op_us;          // when the current operation started, 0 before
+};
+
+//--------------------------------------------
+static size_t get_time_ms(void)
+{
+	struct timeval current_time;
+
+	gettimeofday(&current_time, NULL);
+	return current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
+}
+
+//--------------------------------------------
+static uint64_t get_time_us(void)
+{
+	struct timeval current_time;
+
+	gettimeofday(&current_time, NULL);
+	return (uint64_t)current_time.tv_sec * 1000000 + current_time.tv_usec;
+}
+
+//--------------------------------------------
+static uint32_t wire_time_us(const hc32boot_t *s, size_t len)
+{
+	return (uint32_t)(len * UART_BITS_PER_BYTE * 1000000ULL / s->baudrate);
+}
+
+//--------------------------------------------
+static size_t timeout_ms(const hc32boot_t *s, size_t tx_len, size_t rx_len, uint32_t busy_us)
+{
+	uint64_t us = (uint64_t)wire_time_us(s, tx_len + rx_len) + busy_us + s->link.latency_us;
+
+	return (size_t)(us * TIMEOUT_SAFETY_FACTOR / 1000) + TIMEOUT_MARGIN_MS;
+}
+
+//--------------------------------------------
+static void exchange(hc32boot_t *s, const uint8_t *tx, size_t tx_len, int rx_kind, size_t timeout_ms)
+{
+	s->tx = tx;
+	s->tx_len = tx_len;
+	s->rx_kind = rx_kind;
+	s->rx_cnt = 0;
+	hc32boot_resp_init(&s->resp);
+	s->deadline_ms = get_time_ms() + timeout_ms;
+	if (s->frame_hook || TRACE_ENABLED)
+	{
+		s->frame_us = get_time_us();
+		s->frame_cmd = rx_kind == RX_RESP ? tx[1] : -1;
+		s->frame_addr = rx_kind == RX_RESP ? (uint32_t)tx[5] << 24 | (uint32_t)tx[4] << 16 | (uint32_t)tx[3] << 8 | tx[2] : 0;
+		s->frame_rx = s->stats.rx_bytes;
+	}
+	TRACE5(frame__submit, s->frame_cmd, s->frame_addr, tx_len, timeout_ms, s->frame_us);
+}
+
+//--------------------------------------------
+static void hold(hc32boot_t *s, size_t ms)
+{
+	s->resume_ms = get_time_ms() + ms;
+}
+
+//--------------------------------------------
+static void op_complete(hc32boot_t *s, int result)
+{
+	hc32boot_op_t op = s->queue[0];
+
+	TRACE4(op__done, op.type, result, s->op_us ? get_time_us() - s->op_us : 0, get_time_us());
+	s->op_us = 0;
+	memmove(&s->queue[0], &s->queue[1], (s->queue_cnt - 1) * sizeof(s->queue[0]));
+	s->queue_cnt--;
+	s->step = 0;
+	s->done = 0;
+	s->tx_len = 0;
+	s->rx_kind = RX_NONE;
+	if (result)
+	{
+		s->failed = 1;
+	}
+	if (op.complete)
+	{
+		op.complete(op.arg, &op, result);
+	}
+}
+
+//--------------------------------------------
+static void op_fail(hc32boot_t *s)
+{
+	// the target state is unknown after an error, the remaining operations are dropped
+	while (s->queue_cnt)
+	{
+		op_complete(s, -1);
+	}
+}
+
+//--------------------------------------------
+static void op_progress(hc32boot_t *s)
+{
+	if (s->queue[0].progress)
+	{
+		s->queue[0].progress(s->queue[0].arg, &s->queue[0], s->done);
+	}
+}
+
+//--------------------------------------------
+// Picks the link parameters from the round trips measured with empty commands.
+static void link_choose(hc32boot_link_t *link, int baudrate)
+{
+	uint32_t byte_us = (uint32_t)(UART_BITS_PER_BYTE * 1000000ULL / baudrate);
+	uint32_t probe_wire_us = (uint32_t)(2 * (HC32BOOT_FRAME_HEADER_SIZE + 1) * UART_BITS_PER_BYTE * 1000000ULL / baudrate);
+
+	// Smaller packets detect a lost frame sooner and are cheaper to retry, they are
+	// used only as long as the round trip is a small part of the packet wire time.
+	for (link->pkt_size = 64; link->pkt_size < READ_PACKET_MAX_DATA_SIZE; link->pkt_size += 64)
+	{
+		if ((uint64_t)link->rtt_max_us * RTT_OVERHEAD_DIVISOR <= (uint64_t)link->pkt_size * byte_us)
+		{
+			break;
+		}
+	}
+	link->depth = 1;
+	// what the wire time does not explain: USB-UART latency timers, driver and scheduling delays
+	link->latency_us = link->rtt_max_us > probe_wire_us ? link->rtt_max_us - probe_wire_us : 0;
+	link->calibrated = 1;
+}
+
+//--------------------------------------------
+static void put_le32(uint8_t *buf, uint32_t value)
+{
+	buf[0] = (uint8_t)value;
+	buf[1] = (uint8_t)(value >> 8);
+	buf[2] = (uint8_t)(value >> 16);
+	buf[3] = (uint8_t)(value >> 24);
+}
+
+//--------------------------------------------
+static int set_baudrate(hc32boot_t *s, int baudrate)
+{
+	if (serial_set_baudrate(s->dev, baudrate))
+	{
+		return -1;
+	}
+	s->baudrate = baudrate;
+	return 0;
+}
+
+//--------------------------------------------
+// Two-stage flashloader load: the stub goes through the ROM bootloader at the
+// session baud rate and receives the flashloader image at the boot baud rate.
+static void load_bootstrap(hc32boot_t *s)
+{
+	switch (s->step++)
+	{
+	case 0:
+		// the stub divides the UART timer period by the ratio
+		if (s->cfg.boot_baudrate % s->cfg.baudrate)
+		{
+			op_fail(s);
+			break;
+		}
+		memcpy(s->stub, buf_stub, sizeof(buf_stub));
+		put_le32(s->stub + sizeof(buf_stub) - 8, (uint32_t)(s->cfg.boot_baudrate / s->cfg.baudrate));
+		put_le32(s->stub + sizeof(buf_stub) - 4, (uint32_t)FLASHLOADER_SIZE);
+		s->stub[sizeof(buf_stub)] = sum8(s->stub, sizeof(buf_stub));
+		// same layout as buf_upload: command, address, size, two zero bytes, sum8
+		memset(s->frame, 0, 10);
+		put_le32(s->frame + 1, FLASHLOADER_ADDR);
+		s->frame[5] = (uint8_t)sizeof(buf_stub);
+		s->frame[6] = (uint8_t)(sizeof(buf_stub) >> 8);
+		s->frame[9] = sum8(s->frame, 9);
+		TRACE3(phase, "stub", HC32BOOT_OP_LOAD, get_time_us());
+		exchange(s, s->frame, 10, RX_SUCCESS_ACK, timeout_ms(s, 10, 1, 0));
+		break;
+	case 1:
+	case 3:
+		hold(s, 5);
+		break;
+	case 2:
+		exchange(s, s->stub, sizeof(s->stub), RX_SUCCESS_ACK, timeout_ms(s, sizeof(s->stub), 1, 0));
+		break;
+	case 4:
+		TRACE3(phase, "execute", HC32BOOT_OP_LOAD, get_time_us());
+		exchange(s, buf_execute, sizeof(buf_execute), RX_EXECUTE_ACK, timeout_ms(s, sizeof(buf_execute), EXECUTE_ACK_SIZE, 0));
+		break;
+	case 5:
+		// the stub tells whether the boot baud rate fits its UART clock
+		exchange(s, NULL, 0, RX_BYTE, timeout_ms(s, 0, 1, 0));
+		break;
+	case 6:
+		if ((s->rx_byte != STUB_BAUDRATE_SWITCHED && s->rx_byte != STUB_BAUDRATE_KEPT) ||
+			(s->rx_byte == STUB_BAUDRATE_SWITCHED && set_baudrate(s, s->cfg.boot_baudrate)))
+		{
+			op_fail(s);
+			break;
+		}
+		TRACE3(phase, "upload", HC32BOOT_OP_LOAD, get_time_us());
+		exchange(s, buf_ramcode, FLASHLOADER_SIZE, RX_BYTE, timeout_ms(s, FLASHLOADER_SIZE, 1, 0));
+		break;
+	case 7:
+		// the stub answers with the sum of the received image, then starts it at the session baud rate
+		if (s->rx_byte != sum8(buf_ramcode, FLASHLOADER_SIZE) || set_baudrate(s, s->cfg.baudrate))
+		{
+			op_fail(s);
+			break;
+		}
+		TRACE3(phase, "running", HC32BOOT_OP_LOAD, get_time_us());
+		hold(s, 10);
+		break;
+	default:
+		op_complete(s, 0);
+		break;
+	}
+}
+
+//--------------------------------------------
+static void reset_set(hc32boot_t *s)
+{
+	if (s->cfg.reset_line == HC32BOOT_RESET_RTS)
+	{
+		serial_set_rts(s->dev);
+	}
+	else if (s->cfg.reset_line == HC32BOOT_RESET_DTR)
+	{
+		serial_set_dtr(s->dev);
+	}
+}
+
+//--------------------------------------------
+static void reset_clr(hc32boot_t *s)
+{
+	if (s->cfg.reset_line == HC32BOOT_RESET_RTS)
+	{
+		serial_clr_rts(s->dev);
+	}
+	else if (s->cfg.reset_line == HC32BOOT_RESET_DTR)
+	{
+		serial_clr_dtr(s->dev);
+	}
+}
+
+//--------------------------------------------
+// Starts the next step of the current operation once the previous exchange is finished.
+static void op_advance(hc32boot_t *s)
+{
+	hc32boot_op_t *op = &s->queue[0];
+	size_t len;
+
+	switch (op->type)
+	{
+	case HC32BOOT_OP_CONNECT:
+		switch (s->step++)
+		{
+		case 0:
+			serial_flush(s->dev);
+			if (s->cfg.reset_line == HC32BOOT_RESET_NONE)
+			{
+				// the pattern is sent until the target is reset and answers
+				s->connect_until_ms = get_time_ms() + s->cfg.reset_ms;
+				break;
+			}
+			TRACE3(phase, "reset", op->type, get_time_us());
+			reset_set(s);
+			hold(s, s->cfg.reset_ms);
+			break;
+		case 1:
+			// the target is released from reset while the connect pattern is being sent
+			TRACE3(phase, "connect", op->type, get_time_us());
+			exchange(s, buf_connect, sizeof(buf_connect), RX_CONNECT_ACK, CONNECT_ACK_TIMEOUT);
+			if (serial_write(s->dev, s->tx, s->tx_len) < 0)
+			{
+				s->dev_closed = 1;
+				op_fail(s);
+				return;
+			}
+			s->tx_len = 0;
+			reset_clr(s);
+			break;
+		case 2:
+			TRACE3(phase, "connected", op->type, get_time_us());
+			hold(s, CONNECT_SETTLE_TIME);
+			break;
+		default:
+			serial_flush(s->dev);
+			op_complete(s, 0);
+			break;
+		}
+		break;
+	case HC32BOOT_OP_LOAD:
+		if (s->cfg.boot_baudrate && s->cfg.boot_baudrate != s->cfg.baudrate)
+		{
+			load_bootstrap(s);
+			break;
+		}
+		switch (s->step++)
+		{
+		case 0:
+			TRACE3(phase, "upload", op->type, get_time_us());
+			exchange(s, buf_upload, sizeof(buf_upload), RX_SUCCESS_ACK, timeout_ms(s, sizeof(buf_upload), 1, 0));
+			break;
+		case 1:
+		case 3:
+			hold(s, 5);
+			break;
+		case 2:
+			exchange(s, buf_ramcode, sizeof(buf_ramcode), RX_SUCCESS_ACK, timeout_ms(s, sizeof(buf_ramcode), 1, 0));
+			break;
+		case 4:
+			TRACE3(phase, "execute", op->type, get_time_us());
+			exchange(s, buf_execute, sizeof(buf_execute), RX_EXECUTE_ACK, timeout_ms(s, sizeof(buf_execute), EXECUTE_ACK_SIZE, 0));
+			break;
+		case 5:
+			TRACE3(phase, "running", op->type, get_time_us());
+			hold(s, 10);
+			break;
+		default:
+			op_complete(s, 0);
+			break;
+		}
+		break;
+	case HC32BOOT_OP_READ:
+	case HC32BOOT_OP_WRITE:
+		switch (s->step)
+		{
+		case 0:
+			if (s->done >= op->size)
+			{
+				op_complete(s, 0);
+				break;
+			}
+			s->step = 1;
+			hold(s, 1);
+			break;
+		case 1:
+			if (op->image)
+			{
+				// prepared frames: their packet size wins, a bigger one never costs throughput
+				s->pkt_size = (op->size - s->done > op->image->pkt_size) ? op->image->pkt_size : (uint16_t)(op->size - s->done);
+				exchange(s, hc32boot_image_frame(op->image, s->done / op->image->pkt_size),
+					HC32BOOT_FRAME_HEADER_SIZE + s->pkt_size + 1, RX_RESP, timeout_ms(s, HC32BOOT_FRAME_HEADER_SIZE + s->pkt_size + 1,
+					HC32BOOT_FRAME_HEADER_SIZE + 1, FLASH_PROGRAM_US * ((s->pkt_size + 3) / 4)));
+				s->step = 2;
+				break;
+			}
+			s->pkt_size = (op->size - s->done > s->link.pkt_size) ? s->link.pkt_size : (uint16_t)(op->size - s->done);
+			if (op->type == HC32BOOT_OP_READ)
+			{
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_READ, op->addr + s->done, s->pkt_size, NULL);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, len + s->pkt_size, 0));
+			}
+			else
+			{
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_WRITE, op->addr + s->done, s->pkt_size, op->data + s->done);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, HC32BOOT_FRAME_HEADER_SIZE + 1,
+					FLASH_PROGRAM_US * ((s->pkt_size + 3) / 4)));
+			}
+			s->step = 2;
+			break;
+		default:
+			// the flashloader echoes the requested address (and size for reads), a mismatch means a stale or corrupted frame
+			if (hc32boot_resp_addr(&s->resp) != op->addr + s->done ||
+				(op->type == HC32BOOT_OP_READ && hc32boot_resp_size(&s->resp) != s->pkt_size))
+			{
+				TRACE5(frame__bad, s->frame_cmd, s->frame_addr, TRACE_BAD_ECHO, 0, get_time_us());
+				op_fail(s);
+				break;
+			}
+			if (op->type == HC32BOOT_OP_READ)
+			{
+				memcpy(op->data + s->done, s->resp.buf + HC32BOOT_FRAME_HEADER_SIZE, s->pkt_size);
+			}
+			s->done += s->pkt_size;
+			op_progress(s);
+			s->step = 0;
+			op_advance(s);
+			break;
+		}
+		break;
+	case HC32BOOT_OP_ERASE:
+		if (op->size)
+		{
+			// every sector from addr to addr + size, sector 0 included
+			uint32_t first = op->addr & ~(HC32L110_SECTOR_SIZE - 1);
+			if (s->step)
+			{
+				s->done += HC32L110_SECTOR_SIZE;
+				op_progress(s);
+			}
+			s->step = 1;
+			if (first + s->done < op->addr + op->size)
+			{
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_SECTOR_ERASE, first + s->done, 0, NULL);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, len, FLASH_SECTOR_ERASE_US));
+			}
+			else
+			{
+				op_complete(s, 0);
+			}
+		}
+		else if (s->step++ == 0)
+		{
+			if (op->addr == 0)
+			{
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_CHIP_ERASE, 0, 0, NULL);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, len, FLASH_CHIP_ERASE_US));
+			}
+			else
+			{
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_SECTOR_ERASE, op->addr, 0, NULL);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, len, FLASH_SECTOR_ERASE_US));
+			}
+		}
+		else
+		{
+			op_complete(s, 0);
+		}
+		break;
+	case HC32BOOT_OP_CALIBRATE:
+		if (s->step % 2 == 0)
+		{
+			if (s->step == 0)
+			{
+				s->link.rtt_min_us = UINT32_MAX;
+				s->link.rtt_max_us = 0;
+			}
+			if (s->step == 2 * HC32BOOT_CALIBRATE_PROBES)
+			{
+				link_choose(&s->link, s->baudrate);
+				op_complete(s, 0);
+				break;
+			}
+			len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_NOP, 0, 0, NULL);
+			exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, len, 0));
+			s->probe_us = get_time_us();
+		}
+		else
+		{
+			uint32_t rtt_us = (uint32_t)(get_time_us() - s->probe_us);
+			if (rtt_us < s->link.rtt_min_us)
+			{
+				s->link.rtt_min_us = rtt_us;
+			}
+			if (rtt_us > s->link.rtt_max_us)
+			{
+				s->link.rtt_max_us = rtt_us;
+			}
+		}
+		s->step++;
+		break;
+	case HC32BOOT_OP_CHECKSUM:
+		{
+			uint32_t first = op->addr & ~(HC32L110_SECTOR_SIZE - 1);
+			uint8_t size[4];
+
+			if (s->step)
+			{
+				if (hc32boot_resp_size(&s->resp) != 2)
+				{
+					op_fail(s);
+					break;
+				}
+				memcpy(op->data + s->done / HC32L110_SECTOR_SIZE * 2, s->resp.buf + HC32BOOT_FRAME_HEADER_SIZE, 2);
+				s->done += HC32L110_SECTOR_SIZE;
+				op_progress(s);
+			}
+			s->step = 1;
+			if (first + s->done < op->addr + op->size)
+			{
+				put_le32(size, HC32L110_SECTOR_SIZE);
+				len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_CHECKSUM, first + s->done, sizeof(size), size);
+				exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, HC32BOOT_FRAME_HEADER_SIZE + 2 + 1, CHECKSUM_SECTOR_US));
+			}
+			else
+			{
+				op_complete(s, 0);
+			}
+		}
+		break;
+	case HC32BOOT_OP_SUM:
+		if (s->step++ == 0)
+		{
+			uint8_t size[4];
+
+			put_le32(size, op->size);
+			len = hc32boot_frame_build(s->frame, HC32BOOT_CMD_CHECKSUM, op->addr, sizeof(size), size);
+			exchange(s, s->frame, len, RX_RESP, timeout_ms(s, len, HC32BOOT_FRAME_HEADER_SIZE + 2 + 1,
+				CHECKSUM_SECTOR_US * ((op->size + HC32L110_SECTOR_SIZE - 1) / HC32L110_SECTOR_SIZE)));
+		}
+		else if (hc32boot_resp_size(&s->resp) != 2)
+		{
+			op_fail(s);
+		}
+		else
+		{
+			memcpy(op->data, s->resp.buf + HC32BOOT_FRAME_HEADER_SIZE, 2);
+			op_complete(s, 0);
+		}
+		break;
+	case HC32BOOT_OP_RUN:
+		switch (s->step++)
+		{
+		case 0:
+			if (s->cfg.reset_line == HC32BOOT_RESET_NONE)
+			{
+				op_fail(s);
+				break;
+			}
+			serial_flush(s->dev);
+			TRACE3(phase, "reset", op->type, get_time_us());
+			reset_set(s);
+			hold(s, s->cfg.reset_ms);
+			break;
+		case 1:
+			// the application talks at its own rate from the first byte on
+			if (s->cfg.run_baudrate && set_baudrate(s, s->cfg.run_baudrate))
+			{
+				op_fail(s);
+				break;
+			}
+			serial_flush(s->dev);
+			// without the connect pattern the ROM bootloader starts the application
+			TRACE3(phase, "release", op->type, get_time_us());
+			reset_clr(s);
+			s->probe_us = get_time_us();
+			if (op->size)
+			{
+				exchange(s, NULL, 0, RX_BANNER, op->addr);
+				break;
+			}
+			op_complete(s, 0);
+			break;
+		default:
+			s->done = (uint32_t)((get_time_us() - s->probe_us) / 1000);
+			op_progress(s);
+			op_complete(s, 0);
+			break;
+		}
+		break;
+	default:
+		op_fail(s);
+		break;
+	}
+}
+
+#if TRACE_ENABLED
+//--------------------------------------------
+// why hc32boot_resp_feed() refused the response, for the frame__bad probe
+static int resp_error(const hc32boot_resp_t *resp)
+{
+	if (resp->buf[0] != HC32BOOT_FRAME_HEADER)
+	{
+		return TRACE_BAD_HEADER;
+	}
+	if (resp->cnt >= 2 && resp->buf[1] != 0)
+	{
+		return TRACE_BAD_STATUS;
+	}
+	if (hc32boot_resp_need(resp))
+	{
+		return TRACE_BAD_SIZE;
+	}
+	return TRACE_BAD_CHECKSUM;
+}
+#endif
+
+//--------------------------------------------
+// Returns 1 when the expected reception is complete, 0 if more is needed, -1 on error.
+static int receive(hc32boot_t *s)
+{
+	uint8_t buf[HC32BOOT_FRAME_MAX_SIZE];
+	int res;
+
+	switch (s->rx_kind)
+	{
+	case RX_CONNECT_ACK:
+	case RX_SUCCESS_ACK:
+		res = serial_read(s->dev, buf, 1);
+		if (res <= 0)
+		{
+			break;
+		}
+		s->stats.rx_bytes++;
+		if (s->rx_kind == RX_CONNECT_ACK)
+		{
+			// anything else is the echo of the connect pattern
+			return buf[0] == 0x11;
+		}
+		if (buf[0] != 0x01)
+		{
+			TRACE5(frame__bad, s->frame_cmd, s->frame_addr, TRACE_BAD_NAK, buf[0], get_time_us());
+			return -1;
+		}
+		return 1;
+	case RX_EXECUTE_ACK:
+		res = serial_read(s->dev, buf, EXECUTE_ACK_SIZE - s->rx_cnt);
+		if (res <= 0)
+		{
+			break;
+		}
+		s->rx_cnt += res;
+		s->stats.rx_bytes += res;
+		return s->rx_cnt == EXECUTE_ACK_SIZE;
+	case RX_BYTE:
+		res = serial_read(s->dev, &s->rx_byte, 1);
+		if (res <= 0)
+		{
+			break;
+		}
+		s->stats.rx_bytes++;
+		return 1;
+	case RX_BANNER:
+		// byte by byte, a window of the banner size slides over the output of the application
+		while ((res = serial_read(s->dev, buf, 1)) > 0)
+		{
+			hc32boot_op_t *op = &s->queue[0];
+
+			s->stats.rx_bytes++;
+			if (s->rx_cnt == op->size)
+			{
+				memmove(s->resp.buf, s->resp.buf + 1, --s->rx_cnt);
+			}
+			s->resp.buf[s->rx_cnt++] = buf[0];
+			if (s->rx_cnt == op->size && !memcmp(s->resp.buf, op->data, op->size))
+			{
+				return 1;
+			}
+		}
+		break;
+	case RX_RESP:
+		// never read past the end of the response, the rest of the stream belongs to the next one
+		res = serial_read(s->dev, buf, hc32boot_resp_need(&s->resp));
+		if (res <= 0)
+		{
+			break;
+		}
+		s->stats.rx_bytes += res;
+		res = hc32boot_resp_feed(&s->resp, buf, res);
+		if (res == HC32BOOT_RESP_ERROR)
+		{
+			TRACE5(frame__bad, s->frame_cmd, s->frame_addr, resp_error(&s->resp), s->resp.cnt >= 2 ? s->resp.buf[1] : 0, get_time_us());
+		}
+		return res == HC32BOOT_RESP_DONE ? 1 : res;
+	default:
+		return 1;
+	}
+	if (res < 0)
+	{
+		// serial_read() closes the port on errors
+		s->dev_closed = 1;
+	}
+	return res;
+}
+
+//--------------------------------------------
+hc32boot_t *hc32boot_open(const char *port, const hc32boot_config_t *cfg)
+{
+	hc32boot_t *s;
+	port_settings_t set = { 0 };
+
+	assert(port);
+	assert(cfg);
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+	{
+		return NULL;
+	}
+	s->cfg = *cfg;
+	s->baudrate = cfg->baudrate;
+	s->link.pkt_size = READ_PACKET_MAX_DATA_SIZE;
+	s->link.depth = 1;
+	s->link.latency_us = DEFAULT_LATENCY_US;
+	if (cfg->flow_control && cfg->reset_line == HC32BOOT_RESET_RTS)
+	{
+		free(s);
+		return NULL;
+	}
+	set.baudrate = cfg->baudrate;
+	set.low_latency = cfg->low_latency;
+	set.flow_control = cfg->flow_control;
+	if (serial_open(port, &set, &s->dev) < 0)
+	{
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+//--------------------------------------------
+void hc32boot_close(hc32boot_t *session)
+{
+	if (!session)
+	{
+		return;
+	}
+	if (!session->dev_closed)
+	{
+		serial_close(session->dev);
+	}
+	free(session);
+}
+
+//--------------------------------------------
+HANDLE hc32boot_handle(const hc32boot_t *session)
+{
+	return session->dev;
+}
+
+//--------------------------------------------
+int hc32boot_submit(hc32boot_t *session, const hc32boot_op_t *op)
+{
+	if (session->queue_cnt >= HC32BOOT_OP_QUEUE_SIZE || session->dev_closed)
+	{
+		return -1;
+	}
+	if (op->image && (op->type != HC32BOOT_OP_WRITE || !op->image->frames))
+	{
+		return -1;
+	}
+	if ((op->type == HC32BOOT_OP_READ || op->type == HC32BOOT_OP_WRITE) && !op->data && !op->image)
+	{
+		return -1;
+	}
+	if ((op->type == HC32BOOT_OP_CHECKSUM || op->type == HC32BOOT_OP_SUM) && (!op->data || !op->size))
+	{
+		return -1;
+	}
+	if (op->type == HC32BOOT_OP_RUN && op->size && (!op->data || op->size > HC32BOOT_BANNER_MAX_SIZE))
+	{
+		return -1;
+	}
+	if (!session->queue_cnt)
+	{
+		session->failed = 0;
+	}
+	session->queue[session->queue_cnt] = *op;
+	if (op->image)
+	{
+		session->queue[session->queue_cnt].addr = op->image->addr;
+		session->queue[session->queue_cnt].size = op->image->size;
+		session->queue[session->queue_cnt].data = op->image->data;
+	}
+	session->queue_cnt++;
+	return 0;
+}
+
+//--------------------------------------------
+int hc32boot_process(hc32boot_t *session)
+{
+	hc32boot_t *s = session;
+
+	while (s->queue_cnt)
+	{
+		int res;
+
+		if (s->tx_len)
+		{
+			res = serial_write(s->dev, s->tx, s->tx_len);
+			if (res < 0)
+			{
+				// serial_write() closes the port on errors
+				s->dev_closed = 1;
+				op_fail(s);
+				return HC32BOOT_ERROR;
+			}
+			s->tx += res;
+			s->tx_len -= res;
+			s->stats.tx_bytes += res;
+			if (s->tx_len)
+			{
+				return HC32BOOT_BUSY;
+			}
+		}
+		if (s->rx_kind != RX_NONE)
+		{
+			uint64_t rx_bytes = s->stats.rx_bytes;
+
+			res = receive(s);
+			if (TRACE_ENABLED && rx_bytes == s->frame_rx && s->stats.rx_bytes != rx_bytes)
+			{
+				TRACE4(frame__rx, s->frame_cmd, s->frame_addr, get_time_us() - s->frame_us, get_time_us());
+			}
+			if (res < 0)
+			{
+				op_fail(s);
+				return HC32BOOT_ERROR;
+			}
+			if (res == 0)
+			{
+				if (get_time_ms() > s->deadline_ms && s->rx_kind == RX_CONNECT_ACK && get_time_ms() < s->connect_until_ms)
+				{
+					// no reset line: try again, the target may be reset at any moment
+					s->rx_kind = RX_NONE;
+					s->step = 1;
+					s->stats.retries++;
+					TRACE2(retry, s->stats.retries, get_time_us());
+					continue;
+				}
+				if (get_time_ms() > s->deadline_ms)
+				{
+					s->stats.timeouts++;
+					TRACE4(timeout, s->frame_cmd, s->frame_addr, get_time_us() - s->frame_us, get_time_us());
+					op_fail(s);
+					return HC32BOOT_ERROR;
+				}
+				return HC32BOOT_BUSY;
+			}
+			if (s->rx_kind == RX_RESP)
+			{
+				s->stats.frames++;
+				if (s->frame_hook)
+				{
+					s->frame_hook(s->frame_arg, s->frame_cmd, (uint32_t)(get_time_us() - s->frame_us));
+				}
+			}
+			TRACE5(frame__done, s->frame_cmd, s->frame_addr, s->stats.rx_bytes - s->frame_rx, get_time_us() - s->frame_us, get_time_us());
+			s->rx_kind = RX_NONE;
+		}
+		if (get_time_ms() < s->resume_ms)
+		{
+			return HC32BOOT_BUSY;
+		}
+		if (TRACE_ENABLED && !s->op_us)
+		{
+			s->op_us = get_time_us();
+			TRACE4(op__start, s->queue[0].type, s->queue[0].addr, s->queue[0].size, s->op_us);
+		}
+		op_advance(s);
+		if (s->failed && !s->queue_cnt)
+		{
+			return HC32BOOT_ERROR;
+		}
+	}
+	return HC32BOOT_IDLE;
+}
+
+//--------------------------------------------
+int hc32boot_timeout(const hc32boot_t *session)
+{
+	size_t now_ms;
+	size_t until_ms;
+
+	if (!session->queue_cnt)
+	{
+		return -1;
+	}
+	if (session->tx_len)
+	{
+		return 0;
+	}
+	until_ms = session->rx_kind != RX_NONE ? session->deadline_ms : session->resume_ms;
+	now_ms = get_time_ms();
+	// one extra millisecond: the deadline is only missed once it is exceeded
+	return until_ms >= now_ms ? (int)(until_ms - now_ms) + 1 : 0;
+}
+
+//--------------------------------------------
+int hc32boot_want_write(const hc32boot_t *session)
+{
+	return session->tx_len != 0;
+}
+
+//--------------------------------------------
+int hc32boot_wait(hc32boot_t *session)
+{
+	int res;
+
+	while ((res = hc32boot_process(session)) == HC32BOOT_BUSY)
+	{
+#ifdef _WIN32
+		// the port is opened with a 1 ms read timeout, polling is good enough
+		sleep(hc32boot_timeout(session) ? 1 : 0);
+#else
+		struct pollfd pfd;
+
+		pfd.fd = session->dev;
+		pfd.events = hc32boot_want_write(session) ? POLLOUT : POLLIN;
+		poll(&pfd, 1, hc32boot_timeout(session));
+#endif
+	}
+	return res == HC32BOOT_ERROR || session->failed ? -1 : 0;
+}
+
+//--------------------------------------------
+const hc32boot_link_t *hc32boot_link(const hc32boot_t *session)
+{
+	return &session->link;
+}
+
+//--------------------------------------------
+const hc32boot_stats_t *hc32boot_stats(const hc32boot_t *session)
+{
+	return &session->stats;
+}
+
+//--------------------------------------------
+void hc32boot_set_frame_hook(hc32boot_t *session, void (*frame)(void *arg, int cmd, uint32_t rtt_us), void *arg)
+{
+	session->frame_hook = frame;
+	session->frame_arg = arg;
+}
+
+//--------------------------------------------
+static const hc32boot_region_t regions[] =
+{
+	{ "flash", 0, HC32L110_FLASH_SIZE, 1 },
+	{ "sram", HC32L110_SRAM_ADDR, HC32L110_SRAM_SIZE, 0 },
+	{ "uid", HC32L110_UID_ADDR, HC32L110_UID_SIZE, 0 },
+};
+
+//--------------------------------------------
+const hc32boot_region_t *hc32boot_region(const char *name)
+{
+	size_t cnt;
+
+	for (cnt = 0; cnt < sizeof(regions) / sizeof(regions[0]); cnt++)
+	{
+		if (!strcmp(regions[cnt].name, name))
+		{
+			return &regions[cnt];
+		}
+	}
+	return NULL;
+}
+
+//--------------------------------------------
+const hc32boot_region_t *hc32boot_region_of(uint32_t addr, uint32_t size)
+{
+	size_t cnt;
+
+	for (cnt = 0; cnt < sizeof(regions) / sizeof(regions[0]); cnt++)
+	{
+		if (addr >= regions[cnt].addr && size <= regions[cnt].size && addr - regions[cnt].addr <= regions[cnt].size - size)
+		{
+			return &regions[cnt];
+		}
+	}
+	return NULL;
+}
+
+//--------------------------------------------
+uint32_t hc32boot_flashloader_crc(void)
+{
+	return crc32(CRC32_INIT, buf_ramcode, FLASHLOADER_SIZE);
+}
+
+//--------------------------------------------
+void hc32boot_link_estimate(const hc32boot_config_t *cfg, uint32_t latency_us, hc32boot_link_t *link)
+{
+	memset(link, 0, sizeof(*link));
+	link->rtt_min_us = link->rtt_max_us = (uint32_t)(2 * (HC32BOOT_FRAME_HEADER_SIZE + 1) * UART_BITS_PER_BYTE * 1000000ULL / cfg->baudrate) + latency_us;
+	link_choose(link, cfg->baudrate);
+}
+
+//--------------------------------------------
+typedef struct plan
+{
+	const hc32boot_config_t *cfg;
+	uint32_t latency_us;
+	void (*cb)(void *arg, const hc32boot_plan_step_t *step);
+	void *arg;
+} plan_t;
+
+//--------------------------------------------
+static void plan_step(const plan_t *p, const char *what, int cmd, uint32_t addr, uint32_t size,
+	uint32_t tx_len, uint32_t rx_len, int baudrate, uint32_t busy_us)
+{
+	hc32boot_plan_step_t step;
+
+	step.what = what;
+	step.cmd = cmd;
+	step.addr = addr;
+	step.size = size;
+	step.tx_len = tx_len;
+	step.rx_len = rx_len;
+	step.baudrate = baudrate;
+	step.busy_us = busy_us;
+	step.time_us = busy_us;
+	if (tx_len || rx_len)
+	{
+		step.time_us += (uint32_t)((tx_len + rx_len) * UART_BITS_PER_BYTE * 1000000ULL / baudrate) + p->latency_us;
+	}
+	p->cb(p->arg, &step);
+}
+
+//--------------------------------------------
+static void plan_hold(const plan_t *p, const char *what, uint32_t ms)
+{
+	plan_step(p, what, -1, 0, 0, 0, 0, p->cfg->baudrate, ms * 1000);
+}
+
+//--------------------------------------------
+// a flashloader command frame and its response
+static void plan_frame(const plan_t *p, const char *what, int cmd, uint32_t addr, uint32_t tx_data, uint32_t rx_data, uint32_t busy_us)
+{
+	plan_step(p, what, cmd, addr, cmd == HC32BOOT_CMD_READ ? rx_data : tx_data,
+		HC32BOOT_FRAME_HEADER_SIZE + tx_data + 1, HC32BOOT_FRAME_HEADER_SIZE + rx_data + 1, p->cfg->baudrate, busy_us);
+}
+
+//--------------------------------------------
+int hc32boot_plan(const hc32boot_config_t *cfg, const hc32boot_link_t *link, const hc32boot_op_t *op,
+	void (*step)(void *arg, const hc32boot_plan_step_t *step), void *arg)
+{
+	plan_t p = { cfg, link->latency_us, step, arg };
+	uint32_t first = op->addr & ~(HC32L110_SECTOR_SIZE - 1);
+	uint32_t done;
+
+	switch (op->type)
+	{
+	case HC32BOOT_OP_CONNECT:
+		if (cfg->reset_line != HC32BOOT_RESET_NONE)
+		{
+			plan_hold(&p, "reset hold", (uint32_t)cfg->reset_ms);
+		}
+		plan_step(&p, "connect pattern", -1, 0, 0, sizeof(buf_connect), 1, cfg->baudrate, 0);
+		plan_hold(&p, "settle", CONNECT_SETTLE_TIME);
+		break;
+	case HC32BOOT_OP_LOAD:
+		if (cfg->boot_baudrate && cfg->boot_baudrate != cfg->baudrate)
+		{
+			plan_step(&p, "upload command", -1, FLASHLOADER_ADDR, 0, 10, 1, cfg->baudrate, 0);
+			plan_hold(&p, "pause", 5);
+			plan_step(&p, "stub", -1, FLASHLOADER_ADDR, sizeof(buf_stub), sizeof(buf_stub) + 1, 1, cfg->baudrate, 0);
+			plan_hold(&p, "pause", 5);
+			plan_step(&p, "execute", -1, FLASHLOADER_ADDR, 0, sizeof(buf_execute), EXECUTE_ACK_SIZE, cfg->baudrate, 0);
+			plan_step(&p, "stub baud rate", -1, 0, 0, 0, 1, cfg->baudrate, 0);
+			plan_step(&p, "flashloader", -1, FLASHLOADER_ADDR, FLASHLOADER_SIZE, FLASHLOADER_SIZE, 1, cfg->boot_baudrate, 0);
+		}
+		else
+		{
+			plan_step(&p, "upload command", -1, FLASHLOADER_ADDR, 0, sizeof(buf_upload), 1, cfg->baudrate, 0);
+			plan_hold(&p, "pause", 5);
+			plan_step(&p, "flashloader", -1, FLASHLOADER_ADDR, FLASHLOADER_SIZE, sizeof(buf_ramcode), 1, cfg->baudrate, 0);
+			plan_hold(&p, "pause", 5);
+			plan_step(&p, "execute", -1, FLASHLOADER_ADDR, 0, sizeof(buf_execute), EXECUTE_ACK_SIZE, cfg->baudrate, 0);
+		}
+		plan_hold(&p, "start", 10);
+		break;
+	case HC32BOOT_OP_CALIBRATE:
+		for (done = 0; done < HC32BOOT_CALIBRATE_PROBES; done++)
+		{
+			plan_frame(&p, "nop", HC32BOOT_CMD_NOP, 0, 0, 0, 0);
+		}
+		break;
+	case HC32BOOT_OP_READ:
+	case HC32BOOT_OP_WRITE:
+		{
+			uint32_t addr = op->image ? op->image->addr : op->addr;
+			uint32_t size = op->image ? op->image->size : op->size;
+			uint32_t pkt_size = op->image ? op->image->pkt_size : link->pkt_size;
+
+			for (done = 0; done < size; done += pkt_size)
+			{
+				uint32_t len = size - done < pkt_size ? size - done : pkt_size;
+
+				// the session pauses 1 ms before every packet
+				if (op->type == HC32BOOT_OP_READ)
+				{
+					plan_frame(&p, "read", HC32BOOT_CMD_READ, addr + done, 0, len, 1000);
+				}
+				else
+				{
+					plan_frame(&p, "write", HC32BOOT_CMD_WRITE, addr + done, len, 0, 1000 + FLASH_PROGRAM_US * ((len + 3) / 4));
+				}
+			}
+		}
+		break;
+	case HC32BOOT_OP_ERASE:
+		if (!op->size)
+		{
+			if (op->addr)
+			{
+				plan_frame(&p, "sector erase", HC32BOOT_CMD_SECTOR_ERASE, op->addr, 0, 0, FLASH_SECTOR_ERASE_US);
+			}
+			else
+			{
+				plan_frame(&p, "chip erase", HC32BOOT_CMD_CHIP_ERASE, 0, 0, 0, FLASH_CHIP_ERASE_US);
+			}
+			break;
+		}
+		for (done = 0; first + done < op->addr + op->size; done += HC32L110_SECTOR_SIZE)
+		{
+			plan_frame(&p, "sector erase", HC32BOOT_CMD_SECTOR_ERASE, first + done, 0, 0, FLASH_SECTOR_ERASE_US);
+		}
+		break;
+	case HC32BOOT_OP_CHECKSUM:
+		for (done = 0; first + done < op->addr + op->size; done += HC32L110_SECTOR_SIZE)
+		{
+			plan_frame(&p, "checksum", HC32BOOT_CMD_CHECKSUM, first + done, 4, 2, CHECKSUM_SECTOR_US);
+		}
+		break;
+	case HC32BOOT_OP_SUM:
+		plan_frame(&p, "checksum", HC32BOOT_CMD_CHECKSUM, op->addr, 4, 2,
+			CHECKSUM_SECTOR_US * ((op->size + HC32L110_SECTOR_SIZE - 1) / HC32L110_SECTOR_SIZE));
+		break;
+	case HC32BOOT_OP_RUN:
+		if (cfg->reset_line == HC32BOOT_RESET_NONE)
+		{
+			return -1;
+		}
+		plan_hold(&p, "reset hold", (uint32_t)cfg->reset_ms);
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// the state of one session in hc32boot_wait_all()
+#define WAIT_BUSY                1
+#define WAIT_READY               2   // the port has signalled, process it
+#define WAIT_ARMED_IN            4   // io_uring: multishot read readiness poll armed
+#define WAIT_ARMED_OUT           8   // io_uring: single write readiness poll armed
+#define WAIT_PARKED              16  // next had nothing for the session, it is asked again on every wakeup
+
+//--------------------------------------------
+typedef struct wait
+{
+	hc32boot_t **sessions;
+	int *state;
+	int *results;
+	size_t cnt;
+	int (*next)(void *arg, size_t index, int result);
+	void *arg;
+} wait_t;
+
+//--------------------------------------------
+// runs the session until it waits for the port or a deadline, a queue that has
+// run empty is refilled by next
+static void wait_step(wait_t *w, size_t index)
+{
+	hc32boot_t *s = w->sessions[index];
+	int *state = &w->state[index];
+
+	for (;;)
+	{
+		int res;
+
+		if (*state & WAIT_BUSY)
+		{
+			res = hc32boot_process(s);
+			*state &= ~WAIT_READY;
+			if (res == HC32BOOT_BUSY)
+			{
+				return;
+			}
+			*state &= ~WAIT_BUSY;
+			w->results[index] = res == HC32BOOT_ERROR || s->failed ? -1 : 0;
+		}
+		if (!w->next)
+		{
+			return;
+		}
+		res = w->next(w->arg, index, w->results[index]);
+		*state &= ~WAIT_PARKED;
+		if (res == 0)
+		{
+			*state |= WAIT_PARKED;
+		}
+		if (res <= 0)
+		{
+			return;
+		}
+		*state |= WAIT_BUSY;
+	}
+}
+
+//--------------------------------------------
+// the nearest deadline of the busy sessions, the ones writing are woken up by the port
+static int wait_timeout(const wait_t *w)
+{
+	int timeout = -1;
+
+	for (size_t cnt_s = 0; cnt_s < w->cnt; cnt_s++)
+	{
+		int t;
+
+		if (!(w->state[cnt_s] & WAIT_BUSY))
+		{
+			continue;
+		}
+		if (w->state[cnt_s] & WAIT_READY)
+		{
+			return 0;
+		}
+		if (hc32boot_want_write(w->sessions[cnt_s]))
+		{
+			continue;
+		}
+		t = hc32boot_timeout(w->sessions[cnt_s]);
+		if (t >= 0 && (timeout < 0 || t < timeout))
+		{
+			timeout = t;
+		}
+	}
+	return timeout;
+}
+
+//--------------------------------------------
+// returns when no session is busy, the parked ones included
+static void wait_all_poll(wait_t *w)
+{
+#ifdef _WIN32
+	for (;;)
+	{
+		int busy = 0;
+
+		for (size_t cnt_s = 0; cnt_s < w->cnt; cnt_s++)
+		{
+			if (w->state[cnt_s] & (WAIT_BUSY | WAIT_PARKED))
+			{
+				wait_step(w, cnt_s);
+				busy |= w->state[cnt_s] & WAIT_BUSY;
+			}
+		}
+		if (!busy)
+		{
+			break;
+		}
+		// the ports are opened with a 1 ms read timeout, polling is good enough
+		sleep(wait_timeout(w) ? 1 : 0);
+	}
+#else
+	struct pollfd *pfd = malloc(w->cnt * sizeof(*pfd) + 1);
+
+	if (!pfd)
+	{
+		for (size_t cnt_s = 0; cnt_s < w->cnt; cnt_s++)
+		{
+			w->results[cnt_s] = w->state[cnt_s] & WAIT_BUSY ? -1 : w->results[cnt_s];
+		}
+		return;
+	}
+	for (;;)
+	{
+		nfds_t nfds = 0;
+
+		for (size_t cnt_s = 0; cnt_s < w->cnt; cnt_s++)
+		{
+			if (w->state[cnt_s] & (WAIT_BUSY | WAIT_PARKED))
+			{
+				wait_step(w, cnt_s);
+			}
+			if (w->state[cnt_s] & WAIT_BUSY)
+			{
+				pfd[nfds].fd = w->sessions[cnt_s]->dev;
+				pfd[nfds++].events = hc32boot_want_write(w->sessions[cnt_s]) ? POLLOUT : POLLIN;
+			}
+		}
+		if (!nfds)
+		{
+			break;
+		}
+		poll(pfd, nfds, wait_timeout(w));
+	}
+	free(pfd);
+#endif
+}
+
+#ifndef _WIN32
+//--------------------------------------------
+typedef struct wait_uring
+{
+	int *state;
+	int failed;
+} wait_uring_t;
+
+//--------------------------------------------
+static void wait_uring_cb(void *arg, uint64_t user_data, int res, int more)
+{
+	wait_uring_t *w = arg;
+	int *state = &w->state[user_data >> 1];
+
+	if (res < 0 && res != -ECANCELED)
+	{
+		// e.g. multishot polls not supported (before Linux 5.13)
+		w->failed = 1;
+		return;
+	}
+	*state |= WAIT_READY;
+	if (user_data & 1)
+	{
+		*state &= ~WAIT_ARMED_OUT;
+	}
+	else if (!more)
+	{
+		*state &= ~WAIT_ARMED_IN;
+	}
+}
+
+//--------------------------------------------
+// Every port has one multishot readiness poll for all of its reads, only the
+// ports that signalled or reached a deadline are processed, and all new polls
+// are submitted by the same system call that waits.
+static int wait_all_uring(wait_t *wait)
+{
+	uring_t ring;
+	wait_uring_t w = { wait->state, 0 };
+	int *state = wait->state;
+	size_t cnt = wait->cnt;
+
+	if (uring_init(&ring, cnt > 2048 ? 4096 : (unsigned)cnt * 2))
+	{
+		return -1;
+	}
+	for (;;)
+	{
+		int busy = 0;
+
+		for (size_t cnt_s = 0; cnt_s < cnt && !w.failed; cnt_s++)
+		{
+			hc32boot_t *s = wait->sessions[cnt_s];
+
+			if (!(state[cnt_s] & (WAIT_BUSY | WAIT_PARKED)))
+			{
+				continue;
+			}
+			if ((state[cnt_s] & (WAIT_READY | WAIT_PARKED)) || !hc32boot_timeout(s))
+			{
+				int pending = 0;
+
+				wait_step(wait, cnt_s);
+				// a poll reports new data only, what the session left unread is looked for here
+				if ((state[cnt_s] & WAIT_BUSY) && !ioctl(s->dev, FIONREAD, &pending) && pending > 0)
+				{
+					state[cnt_s] |= WAIT_READY;
+				}
+			}
+			if (!(state[cnt_s] & WAIT_BUSY))
+			{
+				continue;
+			}
+			busy = 1;
+			if (!(state[cnt_s] & WAIT_ARMED_IN))
+			{
+				w.failed |= uring_poll(&ring, s->dev, URING_POLL_IN, 1, (uint64_t)cnt_s << 1) != 0;
+				state[cnt_s] |= WAIT_ARMED_IN;
+			}
+			if (hc32boot_want_write(s) && !(state[cnt_s] & WAIT_ARMED_OUT))
+			{
+				w.failed |= uring_poll(&ring, s->dev, URING_POLL_OUT, 0, (uint64_t)cnt_s << 1 | 1) != 0;
+				state[cnt_s] |= WAIT_ARMED_OUT;
+			}
+		}
+		if (!busy || w.failed)
+		{
+			break;
+		}
+		w.failed = uring_wait(&ring, wait_timeout(wait), wait_uring_cb, &w) != 0;
+	}
+	uring_exit(&ring);
+	return w.failed ? -1 : 0;
+}
+#endif
+
+//--------------------------------------------
+static int wait_run(wait_t *w)
+{
+	w->state = malloc(w->cnt * sizeof(*w->state) + 1);
+	if (!w->state)
+	{
+		return -1;
+	}
+	for (size_t cnt_s = 0; cnt_s < w->cnt; cnt_s++)
+	{
+		w->state[cnt_s] = WAIT_BUSY | WAIT_READY;
+		w->results[cnt_s] = 0;
+	}
+#ifdef _WIN32
+	wait_all_poll(w);
+#else
+	if (wait_all_uring(w))
+	{
+		// not built in, not supported by the kernel or failed: the sessions go on with poll()
+		wait_all_poll(w);
+	}
+#endif
+	free(w->state);
+	return 0;
+}
+
+//--------------------------------------------
+int hc32boot_wait_all(hc32boot_t *sessions[], int results[], size_t cnt)
+{
+	wait_t w = { sessions, NULL, results, cnt, NULL, NULL };
+	int failed = 0;
+
+	if (wait_run(&w))
+	{
+		return -1;
+	}
+	for (size_t cnt_s = 0; cnt_s < cnt; cnt_s++)
+	{
+		failed += results[cnt_s] != 0;
+	}
+	return failed;
+}
+
+//--------------------------------------------
+int hc32boot_wait_each(hc32boot_t *sessions[], size_t cnt, int (*next)(void *arg, size_t index, int result), void *arg)
+{
+	wait_t w = { sessions, NULL, NULL, cnt, next, arg };
+	int res;
+
+	w.results = malloc(cnt * sizeof(*w.results) + 1);
+	if (!w.results)
+	{
+		return -1;
+	}
+	res = wait_run(&w);
+	free(w.results);
+	return res;
+}
+
+//--------------------------------------------
+const char *hc32boot_wait_backend(void)
+{
+	uring_t ring;
+
+	if (uring_init(&ring, 2))
+	{
+		return "poll";
+	}
+	uring_exit(&ring);
+	return "io_uring";
+}
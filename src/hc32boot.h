@@ -0,0 +1,258 @@
+/*
+* Copyright (c) 2022, 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef HC32BOOT_H_
+#define HC32BOOT_H_
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stddef.h>     /* size_t */
+#include "serial.h"
+
+//--------------------------------------------
+#define HC32L110_FLASH_SIZE              0x4000
+#define READ_PACKET_MAX_DATA_SIZE        0x200
+#define WRITE_PACKET_MAX_DATA_SIZE       0x200
+#define HC32L110_SECTOR_SIZE             0x200
+#define HC32L110_UID_ADDR                0x00100E74
+#define HC32L110_UID_SIZE                10
+#define HC32L110_SRAM_ADDR               0x20000000
+#define HC32L110_SRAM_SIZE               0x1000
+
+//--------------------------------------------
+// A named region of the memory map the flashloader can read.
+typedef struct hc32boot_region
+{
+	const char *name;
+	uint32_t addr;
+	uint32_t size;
+	int writable;            // the flashloader writes and erases it
+} hc32boot_region_t;
+
+//--------------------------------------------
+// flashloader frame: 0x49, command/status, address (LE32), size (LE16), data, sum8
+#define HC32BOOT_FRAME_HEADER                0x49
+#define HC32BOOT_FRAME_HEADER_SIZE           8
+#define HC32BOOT_FRAME_MAX_SIZE              (HC32BOOT_FRAME_HEADER_SIZE + 0x200 + 1)
+
+//--------------------------------------------
+// flashloader commands
+#define HC32BOOT_CMD_CHIP_ERASE              2
+#define HC32BOOT_CMD_SECTOR_ERASE            3
+#define HC32BOOT_CMD_WRITE                   4
+#define HC32BOOT_CMD_READ                    5
+#define HC32BOOT_CMD_CHECKSUM                6   // 16-bit sum of the bytes, the size (LE32) is the data
+#define HC32BOOT_CMD_NOP                     10  // answered with an empty OK frame
+
+//--------------------------------------------
+#define HC32BOOT_RESP_MORE                   0
+#define HC32BOOT_RESP_DONE                   1
+#define HC32BOOT_RESP_ERROR                 -1
+
+//--------------------------------------------
+typedef struct hc32boot_resp
+{
+	uint8_t buf[HC32BOOT_FRAME_MAX_SIZE];
+	size_t cnt;
+} hc32boot_resp_t;
+
+//--------------------------------------------
+size_t hc32boot_frame_build(uint8_t *frame, uint8_t cmd, uint32_t addr, uint16_t size, const uint8_t *data);
+void hc32boot_resp_init(hc32boot_resp_t *resp);
+size_t hc32boot_resp_need(const hc32boot_resp_t *resp);
+int hc32boot_resp_feed(hc32boot_resp_t *resp, const uint8_t *data, size_t len);
+uint32_t hc32boot_resp_addr(const hc32boot_resp_t *resp);
+uint16_t hc32boot_resp_size(const hc32boot_resp_t *resp);
+
+//--------------------------------------------
+// session operations
+#define HC32BOOT_OP_CONNECT                  1   // reset the target and enter the ROM bootloader
+#define HC32BOOT_OP_LOAD                     2   // upload and start the flashloader
+#define HC32BOOT_OP_READ                     3   // read size bytes at addr into data
+#define HC32BOOT_OP_WRITE                    4   // write size bytes from data at addr
+#define HC32BOOT_OP_ERASE                    5   // size 0: chip erase if addr is 0, sector erase at addr otherwise;
+                                                 // size set: erase every sector from addr to addr + size
+#define HC32BOOT_OP_CALIBRATE                6   // measure the link round-trip time, needs the flashloader
+#define HC32BOOT_OP_RUN                      7   // reset the target (reset line needed) without the connect pattern,
+                                                 // the application starts;
+                                                 // size set: wait up to addr ms for the size bytes at data (a boot banner),
+                                                 // progress is called with the boot time in ms once they are received
+#define HC32BOOT_OP_CHECKSUM                 8   // 16-bit sum of every sector from addr to addr + size, computed
+                                                 // by the flashloader, into data (LE16 per sector)
+#define HC32BOOT_OP_SUM                      9   // 16-bit sum of size bytes at addr in one command, computed
+                                                 // by the flashloader, into data (LE16)
+
+#define HC32BOOT_CALIBRATE_PROBES            8
+
+#define HC32BOOT_OP_QUEUE_SIZE               8
+#define HC32BOOT_BANNER_MAX_SIZE             64
+
+//--------------------------------------------
+// hc32boot_process() results
+#define HC32BOOT_IDLE                        0
+#define HC32BOOT_BUSY                        1
+#define HC32BOOT_ERROR                      -1
+
+//--------------------------------------------
+// A write image prepared in advance: CRC-32 of the data and of every flash
+// sector it touches, and all write frames, ready to be sent as they are.
+typedef struct hc32boot_image
+{
+	uint32_t addr;
+	uint32_t size;
+	uint8_t *data;
+	uint32_t crc;
+	uint32_t sector_first;   // index of the first sector touched
+	uint32_t sector_cnt;
+	uint32_t sector_crc[HC32L110_FLASH_SIZE / HC32L110_SECTOR_SIZE];
+	uint16_t pkt_size;
+	size_t frame_cnt;
+	size_t frame_stride;     // every frame but the last one is this long
+	uint8_t *frames;
+	// patched frames are private copies, the frames above are never modified
+	uint32_t *overlay_map;   // per frame: 0 for the shared frame, n for overlay frame n - 1
+	uint8_t *overlay;
+	uint32_t overlay_cnt;
+} hc32boot_image_t;
+
+//--------------------------------------------
+int hc32boot_image_prepare(hc32boot_image_t *image, uint32_t addr, uint8_t *data, uint32_t size, uint16_t pkt_size);
+void hc32boot_image_free(hc32boot_image_t *image);
+const uint8_t *hc32boot_image_frame(const hc32boot_image_t *image, size_t index);
+int hc32boot_image_get(const hc32boot_image_t *image, uint32_t addr, uint8_t *buf, uint32_t len);
+// rebuilds only the frames the patch touches, the CRCs are updated
+int hc32boot_image_patch(hc32boot_image_t *image, uint32_t addr, const uint8_t *bytes, uint32_t len);
+
+//--------------------------------------------
+typedef struct hc32boot_op
+{
+	int type;
+	uint32_t addr;
+	uint32_t size;
+	uint8_t *data;
+	// write only: addr, size and data are taken from the image, its frames are sent as they are
+	const hc32boot_image_t *image;
+	// optional callbacks, progress is called after every frame
+	void (*progress)(void *arg, const struct hc32boot_op *op, uint32_t done);
+	void (*complete)(void *arg, const struct hc32boot_op *op, int result);
+	void *arg;
+} hc32boot_op_t;
+
+//--------------------------------------------
+// the modem line that keeps the target powered off/in reset while it is set
+#define HC32BOOT_RESET_RTS                   0
+#define HC32BOOT_RESET_DTR                   1
+#define HC32BOOT_RESET_NONE                  2   // reset by other means: the connect pattern is repeated for reset_ms
+
+//--------------------------------------------
+typedef struct hc32boot_config
+{
+	int baudrate;
+	int reset_ms;            // how long the target is kept powered off/in reset
+	int low_latency;         // see port_settings_t
+	int boot_baudrate;       // two-stage load: the flashloader is sent at this rate by a stub, 0 to disable
+	int run_baudrate;        // HC32BOOT_OP_RUN: the application baud rate, 0 to keep the current one
+	int reset_line;          // HC32BOOT_RESET_xxx
+	int flow_control;        // RTS/CTS, RTS can not be the reset line then
+} hc32boot_config_t;
+
+//--------------------------------------------
+// link parameters, chosen by HC32BOOT_OP_CALIBRATE
+typedef struct hc32boot_link
+{
+	int calibrated;
+	uint32_t rtt_min_us;     // round trip of an empty command, wire time included
+	uint32_t rtt_max_us;
+	uint16_t pkt_size;       // read/write packet data size
+	int depth;               // frames in flight, the flashloader has a single receive buffer
+	uint32_t latency_us;     // round trip time not explained by the wire time, used for the timeouts
+} hc32boot_link_t;
+
+//--------------------------------------------
+// counters of a session since hc32boot_open()
+typedef struct hc32boot_stats
+{
+	uint32_t frames;         // flashloader frames answered
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint32_t retries;        // connect patterns repeated (HC32BOOT_RESET_NONE), nothing else is retried
+	uint32_t timeouts;
+} hc32boot_stats_t;
+
+//--------------------------------------------
+// one exchange or wait of an operation, as hc32boot_plan() estimates it
+typedef struct hc32boot_plan_step
+{
+	const char *what;        // e.g. "write", "sector erase", "reset hold"
+	int cmd;                 // flashloader command, -1 for the ROM bootloader and the waits
+	uint32_t addr;
+	uint32_t size;           // data bytes
+	uint32_t tx_len;         // bytes on the wire, host to target
+	uint32_t rx_len;         // bytes on the wire, target to host
+	int baudrate;
+	uint32_t busy_us;        // flash program/erase time or the time the session waits
+	uint32_t time_us;        // wire time both ways + busy time + link latency
+} hc32boot_plan_step_t;
+
+//--------------------------------------------
+typedef struct hc32boot hc32boot_t;
+
+//--------------------------------------------
+// A session owns one serial port. Operations are queued with
+// hc32boot_submit() and executed by hc32boot_process(), which never blocks:
+// call it whenever the port handle is readable/writable or the time returned
+// by hc32boot_timeout() expires. hc32boot_wait() does exactly that for one
+// session until the queue is empty.
+hc32boot_t *hc32boot_open(const char *port, const hc32boot_config_t *cfg);
+void hc32boot_close(hc32boot_t *session);
+HANDLE hc32boot_handle(const hc32boot_t *session);
+int hc32boot_submit(hc32boot_t *session, const hc32boot_op_t *op);
+int hc32boot_process(hc32boot_t *session);
+int hc32boot_timeout(const hc32boot_t *session);
+int hc32boot_want_write(const hc32boot_t *session);
+int hc32boot_wait(hc32boot_t *session);
+// Runs the queues of many sessions at once until all are empty, results as
+// hc32boot_wait() per session, returns the number of sessions that failed.
+// With io_uring built in (make IO_URING=1) and supported by the kernel one
+// multishot readiness poll per port replaces the poll() set rebuilt on every
+// wakeup, only the ports that signalled or reached a deadline are processed.
+int hc32boot_wait_all(hc32boot_t *sessions[], int results[], size_t cnt);
+// hc32boot_wait_all() for sessions that get their work as they go: next is
+// called whenever the queue of a session has run empty (and once at the start),
+// with the result of the operations run since the last call. It returns 1 after
+// submitting more, 0 when it has nothing yet (it is asked again on every wakeup)
+// and -1 when the session is done. Returns once no session is busy, -1 if out of memory.
+int hc32boot_wait_each(hc32boot_t *sessions[], size_t cnt, int (*next)(void *arg, size_t index, int result), void *arg);
+// "io_uring" or "poll"
+const char *hc32boot_wait_backend(void);
+const hc32boot_link_t *hc32boot_link(const hc32boot_t *session);
+const hc32boot_stats_t *hc32boot_stats(const hc32boot_t *session);
+// called for every flashloader frame answered, with its command and the time
+// from the start of the transmission to the end of the response, NULL to stop
+void hc32boot_set_frame_hook(hc32boot_t *session, void (*frame)(void *arg, int cmd, uint32_t rtt_us), void *arg);
+// the regions known: flash, sram, uid; NULL for an unknown name
+const hc32boot_region_t *hc32boot_region(const char *name);
+// the region holding the whole range, NULL if none does
+const hc32boot_region_t *hc32boot_region_of(uint32_t addr, uint32_t size);
+// CRC-32 of the flashloader firmware built in, identifies its version
+uint32_t hc32boot_flashloader_crc(void);
+// The link a calibration would choose for this round-trip latency (what the
+// wire time of an empty command does not explain), for hc32boot_plan().
+void hc32boot_link_estimate(const hc32boot_config_t *cfg, uint32_t latency_us, hc32boot_link_t *link);
+// Dry run of an operation without a port: calls step for every frame and wait
+// the session would issue, with the same frame sizes, packet size and flash
+// timing. The banner wait of HC32BOOT_OP_RUN is not counted.
+int hc32boot_plan(const hc32boot_config_t *cfg, const hc32boot_link_t *link, const hc32boot_op_t *op,
+	void (*step)(void *arg, const hc32boot_plan_step_t *step), void *arg);
+
+#endif /* HC32BOOT_H_ */
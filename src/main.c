@@ -22,6 +22,7 @@
 #include <assert.h>     /* assert */
 #ifdef _WIN32
 #include <windows.h>    /* Windows stuff */
+#include <process.h>    /* _beginthreadex */
 #include "getopt.h"
 #include "gettimeofday.h"
 #undef sleep
@@ -32,6 +33,7 @@
 #include <sys/time.h>   /* gettimeofday */
 #include <fcntl.h>      /* open */
 #include <unistd.h>     /* usleep, getopt, write, close */
+#include <pthread.h>    /* pthread_create */
 #define sleep(a) usleep((a) * 1000)
 extern char *optarg;
 #ifndef HANDLE
@@ -39,475 +41,137 @@ extern char *optarg;
 #endif
 #endif
 #include "serial.h"
-
-//--------------------------------------------
-#define HC32L110_FLASH_SIZE              0x4000
-#define READ_PACKET_MAX_DATA_SIZE        0x200
-#define WRITE_PACKET_MAX_DATA_SIZE       0x200
+#include "checksum.h"
+#include "hc32boot.h"
+#include "patch.h"
+#include "watch.h"
+#include "manifest.h"
+#include "probe.h"
+#include "devcache.h"
+#include "station.h"
+#include "progress.h"
+#include "plan.h"
+#include "audit.h"
+#include "shell.h"
 
 //--------------------------------------------
 static uint32_t flash_addr;
 static uint16_t flash_size;
+static int boot_baudrate;
+static int watch_jobs;
+static int run_baudrate;
+static int banner_ms = 5000;
+static int reset_line = HC32BOOT_RESET_RTS;
+static uint32_t plan_latency_us;
+static const hc32boot_region_t *read_region;
 static FILE *file;
 
-//--------------------------------------------
-static uint8_t sum8(uint8_t *buf, size_t len)
-{
-	uint8_t sum = 0;
-	for (size_t cnt = 0; cnt < len; cnt++)
-	{
-		sum += buf[cnt];
-	}
-	return sum;
-}
-#if 0
-//--------------------------------------------
-static uint8_t crc8(uint8_t *buf, size_t len)
-{
-	uint8_t crc = 0xff;
-	size_t i, j;
-	for (i = 0; i < len; i++)
-	{
-		crc ^= buf[i];
-		for (j = 0; j < 8; j++)
-		{
-			if ((crc & 0x80) != 0)
-			{
-				crc = (uint8_t)((crc << 1) ^ 0x31);
-			}
-			else
-			{
-				crc <<= 1;
-			}
-		}
-	}
-	return crc;
-}
-#endif
-
-//--------------------------------------------
-static const uint8_t buf_connect[] = {
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff,
-	0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff, 0x18, 0xff
-};
-static const uint8_t buf_ramcode[] = {
-	0xb8, 0x0a, 0x00, 0x20, 0x09, 0x00, 0x00, 0x20, 0x72, 0xb6, 0x03, 0x48, 0x01, 0x68, 0x81, 0xf3,
-	0x08, 0x88, 0x02, 0x48, 0x00, 0x47, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x95, 0x07, 0x00, 0x20,
-	0xc0, 0x68, 0x01, 0x68, 0x6e, 0x48, 0x01, 0x62, 0x6e, 0x4a, 0x89, 0x18, 0x6e, 0x4a, 0x91, 0x42,
-	0x01, 0xd3, 0x06, 0x21, 0x81, 0x71, 0x70, 0x47, 0x80, 0xb5, 0x00, 0xf0, 0xe7, 0xf8, 0x6b, 0x48,
-	0x01, 0x68, 0x03, 0x22, 0x0a, 0x43, 0x02, 0x60, 0x00, 0x21, 0x09, 0x60, 0x01, 0x68, 0xca, 0x06,
-	0xd2, 0x0f, 0xfb, 0xd1, 0x01, 0xbd, 0x10, 0xb5, 0x04, 0x00, 0x60, 0x68, 0x80, 0x21, 0x09, 0x02,
-	0x88, 0x42, 0x05, 0xd3, 0x62, 0x49, 0x40, 0x18, 0x80, 0x21, 0x89, 0x00, 0x88, 0x42, 0x10, 0xd2,
-	0x00, 0xf0, 0xcc, 0xf8, 0x5d, 0x48, 0x01, 0x68, 0x03, 0x22, 0x91, 0x43, 0x02, 0x22, 0x0a, 0x43,
-	0x02, 0x60, 0x00, 0x21, 0x62, 0x68, 0x11, 0x60, 0x01, 0x68, 0xca, 0x06, 0xd2, 0x0f, 0x03, 0xd0,
-	0xfa, 0xe7, 0x05, 0x20, 0x52, 0x49, 0x88, 0x71, 0x10, 0xbd, 0x80, 0xb5, 0x01, 0x00, 0x4a, 0x69,
-	0x48, 0x68, 0x80, 0x23, 0x1b, 0x02, 0x9a, 0x42, 0x05, 0xd3, 0x52, 0x4b, 0x98, 0x42, 0x07, 0xd3,
-	0x51, 0x4b, 0x9a, 0x42, 0x04, 0xd2, 0x0a, 0x89, 0xc9, 0x68, 0x00, 0xf0, 0x01, 0xf9, 0x01, 0xbd,
-	0x05, 0x20, 0x47, 0x49, 0x88, 0x71, 0x01, 0xbd, 0x80, 0xb5, 0x01, 0x89, 0x44, 0x4a, 0x91, 0x80,
-	0x02, 0x89, 0xc1, 0x68, 0x40, 0x68, 0x00, 0xf0, 0x28, 0xf9, 0x01, 0xbd, 0x1c, 0xb5, 0x00, 0x21,
-	0x6a, 0x46, 0x11, 0x80, 0xc1, 0x68, 0x09, 0x68, 0x40, 0x68, 0x3d, 0x4c, 0x42, 0x18, 0x52, 0x1e,
-	0x80, 0x23, 0x1b, 0x02, 0x9a, 0x42, 0x02, 0xd3, 0x05, 0x20, 0xa0, 0x71, 0x02, 0xe0, 0x6a, 0x46,
-	0x00, 0xf0, 0xbf, 0xf8, 0x3d, 0x48, 0x69, 0x46, 0x09, 0x88, 0x01, 0x72, 0x69, 0x46, 0x09, 0x88,
-	0x09, 0x0a, 0x41, 0x72, 0x02, 0x20, 0xa0, 0x80, 0x13, 0xbd, 0x7c, 0xb5, 0x00, 0x22, 0x00, 0x92,
-	0xc1, 0x68, 0x09, 0x68, 0x2e, 0x4e, 0x01, 0x25, 0xb5, 0x80, 0x34, 0x4c, 0x22, 0x72, 0x6a, 0x46,
-	0x40, 0x68, 0x00, 0xf0, 0xb3, 0xf8, 0x00, 0x28, 0x02, 0xd0, 0x00, 0x98, 0x30, 0x60, 0x73, 0xbd,
-	0x25, 0x72, 0x73, 0xbd, 0x01, 0x20, 0x26, 0x49, 0x88, 0x80, 0x2c, 0x49, 0x2c, 0x4a, 0x12, 0x78,
-	0xff, 0x2a, 0x00, 0xd1, 0x00, 0x20, 0x08, 0x72, 0x70, 0x47, 0x80, 0xb5, 0xee, 0x20, 0x69, 0x46,
-	0x08, 0x70, 0x01, 0x22, 0x26, 0x48, 0x00, 0xf0, 0xab, 0xf8, 0x01, 0x22, 0x69, 0x46, 0x25, 0x48,
-	0x00, 0xf0, 0xa6, 0xf8, 0x01, 0xbd, 0x70, 0x47, 0x10, 0xb5, 0x19, 0x4c, 0x10, 0xe0, 0x02, 0x20,
-	0xa0, 0x71, 0x20, 0x00, 0x00, 0xf0, 0x52, 0xf9, 0xa0, 0x88, 0x00, 0xf0, 0x6e, 0xf9, 0x60, 0x7a,
-	0x01, 0x28, 0x05, 0xd1, 0xa0, 0x79, 0x00, 0x28, 0x02, 0xd1, 0x20, 0x6a, 0x00, 0xf0, 0x8a, 0xf9,
-	0x00, 0xf0, 0x6b, 0xf9, 0x00, 0xf0, 0xee, 0xf8, 0x01, 0x28, 0xf9, 0xd1, 0x18, 0x21, 0x20, 0x00,
-	0x08, 0x30, 0x00, 0xf0, 0xc5, 0xf9, 0x20, 0x00, 0x08, 0x30, 0x00, 0xf0, 0xfa, 0xf8, 0xa0, 0x71,
-	0xe1, 0x68, 0x21, 0x60, 0x00, 0x21, 0xa1, 0x80, 0x00, 0x28, 0xda, 0xd1, 0x0e, 0x48, 0x61, 0x7a,
-	0x89, 0x00, 0x41, 0x58, 0x00, 0x29, 0xd2, 0xd0, 0x20, 0x00, 0x08, 0x30, 0x88, 0x47, 0xd0, 0xe7,
-	0x10, 0x0a, 0x00, 0x20, 0x80, 0xda, 0xff, 0xff, 0xc1, 0x1c, 0x0f, 0x00, 0x20, 0x00, 0x02, 0x40,
-	0x00, 0xf6, 0xef, 0xff, 0x00, 0x0a, 0x10, 0x00, 0x00, 0x0c, 0x10, 0x00, 0x04, 0x08, 0x00, 0x20,
-	0xfc, 0x0b, 0x10, 0x00, 0xf6, 0x0b, 0x10, 0x00, 0xd4, 0x06, 0x00, 0x20, 0x4d, 0x48, 0x4e, 0x49,
-	0x01, 0x60, 0x4e, 0x49, 0x01, 0x60, 0x70, 0x47, 0x10, 0xb5, 0x4d, 0x49, 0x4a, 0x4a, 0xca, 0x62,
-	0x4a, 0x4b, 0xcb, 0x62, 0x44, 0x01, 0x0c, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x17, 0x24, 0x44, 0x43,
-	0x4c, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x1b, 0x24, 0x44, 0x43, 0x8c, 0x60, 0xca, 0x62, 0xcb, 0x62,
-	0x44, 0x4c, 0x44, 0x43, 0xcc, 0x60, 0xca, 0x62, 0xcb, 0x62, 0x43, 0x4c, 0x44, 0x43, 0x0c, 0x61,
-	0xca, 0x62, 0xcb, 0x62, 0x18, 0x24, 0x44, 0x43, 0x4c, 0x61, 0xca, 0x62, 0xcb, 0x62, 0xf0, 0x24,
-	0x44, 0x43, 0x8c, 0x61, 0xca, 0x62, 0xcb, 0x62, 0xfa, 0x24, 0xa4, 0x00, 0x60, 0x43, 0xc8, 0x61,
-	0xca, 0x62, 0xcb, 0x62, 0x00, 0x20, 0x08, 0x62, 0xca, 0x62, 0xcb, 0x62, 0x37, 0x48, 0x08, 0x63,
-	0x10, 0xbd, 0x30, 0xb5, 0x00, 0x23, 0x00, 0x24, 0x03, 0xe0, 0x05, 0x78, 0x5b, 0x19, 0x40, 0x1c,
-	0x64, 0x1c, 0x8c, 0x42, 0xf9, 0xd3, 0x13, 0x80, 0x00, 0x20, 0x30, 0xbd, 0x30, 0xb5, 0x03, 0x00,
-	0x00, 0x24, 0x00, 0xe0, 0x64, 0x1c, 0x8c, 0x42, 0x08, 0xd2, 0x1d, 0x00, 0x6b, 0x1c, 0x2d, 0x78,
-	0xff, 0x2d, 0xf7, 0xd0, 0x00, 0x19, 0x10, 0x60, 0x01, 0x20, 0x30, 0xbd, 0x00, 0x20, 0x30, 0xbd,
-	0x70, 0xb4, 0x27, 0x4b, 0x20, 0x4c, 0xdc, 0x60, 0x20, 0x4c, 0xdc, 0x60, 0x01, 0x24, 0x1d, 0x68,
-	0x03, 0x26, 0xb5, 0x43, 0x25, 0x43, 0x1d, 0x60, 0x00, 0x26, 0xb6, 0x18, 0xb6, 0x08, 0xb6, 0x00,
-	0x95, 0x1b, 0x10, 0xd1, 0x85, 0x07, 0x0e, 0xd1, 0x15, 0x00, 0x18, 0xd0, 0x1d, 0x4d, 0x1e, 0x68,
-	0x36, 0x09, 0x26, 0x40, 0xfb, 0xd1, 0x0e, 0x68, 0x06, 0x60, 0x09, 0x1d, 0x00, 0x1d, 0x52, 0x19,
-	0x16, 0x04, 0xf4, 0xd1, 0x0b, 0xe0, 0x15, 0x00, 0x09, 0xd0, 0x1d, 0x68, 0x2d, 0x09, 0x25, 0x40,
-	0xfb, 0xd1, 0x0d, 0x78, 0x05, 0x70, 0x49, 0x1c, 0x40, 0x1c, 0x52, 0x1e, 0xf5, 0xd1, 0x18, 0x68,
-	0x00, 0x09, 0x20, 0x40, 0xfb, 0xd1, 0x70, 0xbc, 0x70, 0x47, 0x10, 0xb5, 0x00, 0x23, 0x04, 0xe0,
-	0x04, 0x78, 0x0c, 0x70, 0x40, 0x1c, 0x49, 0x1c, 0x5b, 0x1c, 0x9c, 0xb2, 0x94, 0x42, 0xf7, 0xd3,
-	0x00, 0x20, 0x10, 0xbd, 0x2c, 0x00, 0x02, 0x40, 0x5a, 0x5a, 0x00, 0x00, 0xa5, 0xa5, 0x00, 0x00,
-	0x00, 0x00, 0x02, 0x40, 0x50, 0x46, 0x00, 0x00, 0xe0, 0x22, 0x02, 0x00, 0xff, 0xff, 0x00, 0x00,
-	0x20, 0x00, 0x02, 0x40, 0xfc, 0xff, 0x00, 0x00, 0x10, 0xb5, 0x0a, 0x00, 0x00, 0x21, 0x00, 0x23,
-	0x03, 0xe0, 0x04, 0x78, 0x09, 0x19, 0x40, 0x1c, 0x5b, 0x1c, 0x9c, 0xb2, 0x94, 0x42, 0xf8, 0xd3,
-	0xc8, 0xb2, 0x10, 0xbd, 0x48, 0x48, 0x01, 0x88, 0x09, 0x29, 0x0b, 0xdb, 0x47, 0x49, 0x4a, 0x78,
-	0x05, 0x2a, 0x09, 0xd0, 0x8a, 0x79, 0xc9, 0x79, 0x09, 0x02, 0x11, 0x43, 0x09, 0x31, 0x00, 0x88,
-	0x81, 0x42, 0x04, 0xd0, 0x00, 0x20, 0x70, 0x47, 0x00, 0x88, 0x09, 0x28, 0xfa, 0xd1, 0x01, 0x20,
-	0x70, 0x47, 0x38, 0xb5, 0x04, 0x00, 0x00, 0x20, 0x00, 0x25, 0x3b, 0x4a, 0x11, 0x88, 0x10, 0x80,
-	0x3a, 0x48, 0x02, 0x78, 0x22, 0x70, 0x42, 0x78, 0x62, 0x70, 0x82, 0x78, 0xc3, 0x78, 0x1b, 0x02,
-	0x13, 0x43, 0x02, 0x79, 0x12, 0x04, 0x1a, 0x43, 0x43, 0x79, 0x1b, 0x06, 0x13, 0x43, 0x63, 0x60,
-	0x83, 0x79, 0xc2, 0x79, 0x12, 0x02, 0x1a, 0x43, 0x22, 0x81, 0x63, 0x68, 0x9b, 0x18, 0x5b, 0x1e,
-	0x63, 0x61, 0x23, 0x78, 0x49, 0x2b, 0x16, 0xd1, 0x63, 0x78, 0x0b, 0x2b, 0x01, 0xda, 0x00, 0x2b,
-	0x01, 0xd1, 0x02, 0x25, 0x10, 0xe0, 0x00, 0x2a, 0x02, 0xd0, 0x02, 0x00, 0x08, 0x32, 0xe2, 0x60,
-	0x42, 0x18, 0x52, 0x1e, 0x12, 0x78, 0x22, 0x74, 0x49, 0x1e, 0x89, 0xb2, 0xff, 0xf7, 0xa4, 0xff,
-	0x21, 0x7c, 0x88, 0x42, 0x00, 0xd0, 0x01, 0x25, 0x28, 0x00, 0x32, 0xbd, 0x38, 0xb5, 0x04, 0x00,
-	0x1e, 0x4d, 0xa0, 0x79, 0x68, 0x70, 0x20, 0x68, 0xa8, 0x70, 0x20, 0x68, 0x00, 0x0a, 0xe8, 0x70,
-	0x20, 0x68, 0x00, 0x0c, 0x28, 0x71, 0x20, 0x68, 0x00, 0x0e, 0x68, 0x71, 0xa0, 0x88, 0xa8, 0x71,
-	0xa0, 0x88, 0x00, 0x0a, 0xe8, 0x71, 0xa1, 0x88, 0x08, 0x31, 0x89, 0xb2, 0x28, 0x00, 0xff, 0xf7,
-	0x83, 0xff, 0xa1, 0x88, 0x69, 0x18, 0x08, 0x72, 0x31, 0xbd, 0x80, 0xb5, 0x01, 0x00, 0x09, 0x31,
-	0x89, 0xb2, 0x0e, 0x48, 0x00, 0xf0, 0x38, 0xf8, 0x01, 0xbd, 0x38, 0xb5, 0x00, 0xf0, 0x48, 0xf8,
-	0x00, 0x23, 0x09, 0x49, 0x0a, 0x88, 0x00, 0x2a, 0x01, 0xd1, 0x49, 0x28, 0x0a, 0xd1, 0x07, 0x4a,
-	0x0c, 0x88, 0x07, 0x4d, 0xac, 0x42, 0x04, 0xda, 0x0b, 0x88, 0x5c, 0x1c, 0x0c, 0x80, 0xd0, 0x54,
-	0x31, 0xbd, 0x13, 0x70, 0x0b, 0x80, 0x31, 0xbd, 0x34, 0x0a, 0x00, 0x20, 0x04, 0x08, 0x00, 0x20,
-	0x09, 0x02, 0x00, 0x00, 0x30, 0xb5, 0x00, 0x21, 0x00, 0x22, 0x09, 0x4b, 0xd4, 0xb2, 0xa5, 0x00,
-	0x5d, 0x59, 0xa8, 0x42, 0x0a, 0xd0, 0x52, 0x1c, 0xd4, 0xb2, 0x0c, 0x2c, 0xf6, 0xdb, 0x00, 0xbf,
-	0x15, 0xa0, 0x40, 0x5a, 0x03, 0x49, 0x08, 0x60, 0x48, 0x60, 0x30, 0xbd, 0x61, 0x00, 0xf6, 0xe7,
-	0x74, 0x06, 0x00, 0x20, 0x00, 0x0c, 0x00, 0x40, 0x30, 0xb5, 0x00, 0x22, 0x80, 0x23, 0xdb, 0x05,
-	0x0a, 0xe0, 0x04, 0x5d, 0x1c, 0x60, 0x1c, 0x69, 0xa5, 0x07, 0xed, 0x0f, 0xfb, 0xd0, 0x5c, 0x69,
-	0x02, 0x25, 0xac, 0x43, 0x5c, 0x61, 0x52, 0x1c, 0x94, 0xb2, 0x8c, 0x42, 0xf1, 0xd3, 0x30, 0xbd,
-	0x80, 0x20, 0xc0, 0x05, 0x01, 0x69, 0xc9, 0x07, 0xfc, 0xd5, 0x41, 0x69, 0x01, 0x22, 0x91, 0x43,
-	0x41, 0x61, 0x00, 0x68, 0xc0, 0xb2, 0x70, 0x47, 0x70, 0xff, 0xa0, 0xff, 0xb8, 0xff, 0xdc, 0xff,
-	0xe8, 0xff, 0xf4, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfa, 0xff, 0xfd, 0xff, 0xfe, 0xff,
-	0x00, 0x22, 0x00, 0xbf, 0x09, 0x42, 0x02, 0xd0, 0x49, 0x1e, 0x42, 0x54, 0xfc, 0xd1, 0x70, 0x47,
-	0xf8, 0xb5, 0x2d, 0x4c, 0x2d, 0x48, 0xa0, 0x60, 0x2d, 0x4d, 0xa5, 0x60, 0x20, 0x68, 0xe0, 0x21,
-	0x49, 0x00, 0x01, 0x43, 0x21, 0x60, 0x2b, 0x48, 0x2b, 0x49, 0x82, 0x88, 0x0a, 0x40, 0xe2, 0x60,
-	0x42, 0x88, 0x0a, 0x40, 0xe2, 0x60, 0x00, 0x88, 0x01, 0x40, 0xe1, 0x60, 0x23, 0x48, 0xa0, 0x60,
-	0xa5, 0x60, 0x20, 0x68, 0x25, 0x49, 0x01, 0x40, 0x21, 0x60, 0x06, 0x20, 0xff, 0xf7, 0x44, 0xfe,
-	0x00, 0x21, 0x23, 0x48, 0x01, 0x60, 0x03, 0x20, 0x22, 0x4a, 0x23, 0x4b, 0x23, 0x4e, 0x27, 0x6a,
-	0xff, 0x07, 0x26, 0x62, 0x13, 0xd5, 0x19, 0x4e, 0xa6, 0x60, 0xa5, 0x60, 0x65, 0x68, 0x96, 0x0d,
-	0x2e, 0x43, 0x66, 0x60, 0x05, 0x24, 0x1c, 0x60, 0x15, 0x68, 0x80, 0x26, 0x2e, 0x43, 0x16, 0x60,
-	0xd1, 0x64, 0x9c, 0x62, 0x11, 0x6c, 0x02, 0x23, 0x99, 0x43, 0x11, 0x64, 0x0a, 0xe0, 0x98, 0x63,
-	0x14, 0x6c, 0x20, 0x25, 0xac, 0x43, 0x14, 0x64, 0xd1, 0x64, 0xd8, 0x63, 0x11, 0x6c, 0x40, 0x23,
-	0x0b, 0x43, 0x13, 0x64, 0x12, 0x49, 0x13, 0x4a, 0x0a, 0x60, 0x4a, 0x60, 0xc8, 0x60, 0x0c, 0x48,
-	0x90, 0x21, 0x89, 0x00, 0x01, 0x60, 0x01, 0x68, 0x10, 0x22, 0x0a, 0x43, 0x02, 0x60, 0xff, 0xf7,
-	0xbb, 0xfd, 0x00, 0x20, 0xf2, 0xbd, 0x00, 0xbf, 0x00, 0x20, 0x00, 0x40, 0x5a, 0x5a, 0x00, 0x00,
-	0xa5, 0xa5, 0x00, 0x00, 0x02, 0x0c, 0x10, 0x00, 0xff, 0x07, 0x00, 0x00, 0x3f, 0xfe, 0xff, 0xff,
-	0x04, 0x00, 0x00, 0x40, 0x80, 0x0d, 0x02, 0x40, 0x9c, 0x0c, 0x02, 0x40, 0x01, 0x01, 0x00, 0xf0,
-	0x00, 0x0c, 0x00, 0x40, 0x70, 0xff, 0x00, 0x00, 0x70, 0xb4, 0x01, 0x23, 0x00, 0x24, 0x13, 0xe0,
-	0x01, 0x68, 0x00, 0x1d, 0x19, 0x42, 0x02, 0xd0, 0x4d, 0x46, 0x6d, 0x1e, 0x49, 0x19, 0x0c, 0x60,
-	0x09, 0x1d, 0x12, 0x1f, 0x04, 0x2a, 0xfa, 0xd2, 0x0d, 0x00, 0x96, 0x07, 0x01, 0xd5, 0x0c, 0x80,
-	0xad, 0x1c, 0x1a, 0x40, 0x00, 0xd0, 0x2c, 0x70, 0x02, 0x68, 0x00, 0x1d, 0x00, 0x2a, 0xe7, 0xd1,
-	0x70, 0xbc, 0x70, 0x47, 0x80, 0x25, 0x00, 0x00, 0x40, 0x38, 0x00, 0x00, 0x00, 0x4b, 0x00, 0x00,
-	0x00, 0x96, 0x00, 0x00, 0x00, 0xe1, 0x00, 0x00, 0x00, 0xc2, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x84, 0x03, 0x00, 0x00, 0x08, 0x07, 0x00,
-	0x00, 0x8c, 0x0a, 0x00, 0x30, 0xb4, 0x01, 0x22, 0x01, 0x68, 0x00, 0x1d, 0x00, 0x29, 0x0f, 0xd0,
-	0x03, 0x68, 0xc3, 0x18, 0x44, 0x68, 0x08, 0x30, 0x14, 0x42, 0x02, 0xd0, 0x4d, 0x46, 0x6d, 0x1e,
-	0x64, 0x19, 0x1d, 0x68, 0x25, 0x60, 0x1b, 0x1d, 0x24, 0x1d, 0x09, 0x1f, 0xec, 0xd0, 0xf8, 0xe7,
-	0x30, 0xbc, 0x70, 0x47, 0x00, 0x00, 0x00, 0x00, 0x21, 0x00, 0x00, 0x20, 0x39, 0x00, 0x00, 0x20,
-	0x57, 0x00, 0x00, 0x20, 0x9b, 0x00, 0x00, 0x20, 0xc9, 0x00, 0x00, 0x20, 0xdd, 0x00, 0x00, 0x20,
-	0x1b, 0x01, 0x00, 0x20, 0x45, 0x01, 0x00, 0x20, 0x5b, 0x01, 0x00, 0x20, 0x77, 0x01, 0x00, 0x20,
-	0x10, 0xb5, 0x07, 0x49, 0x79, 0x44, 0x18, 0x31, 0x06, 0x4c, 0x7c, 0x44, 0x16, 0x34, 0x04, 0xe0,
-	0x08, 0x1d, 0x0a, 0x68, 0x89, 0x18, 0x88, 0x47, 0x01, 0x00, 0xa1, 0x42, 0xf8, 0xd1, 0x10, 0xbd,
-	0x08, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00, 0x11, 0xff, 0xff, 0xff, 0x34, 0x02, 0x00, 0x00,
-	0x04, 0x08, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x6d, 0xff, 0xff, 0xff, 0x04, 0x00, 0x00, 0x00,
-	0x60, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x01, 0x20, 0xc0, 0x46,
-	0x00, 0x28, 0x01, 0xd0, 0xff, 0xf7, 0xd4, 0xff, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0x20, 0x00, 0xbf,
-	0x00, 0xbf, 0xff, 0xf7, 0xf5, 0xfe, 0x00, 0xf0, 0x00, 0xf8, 0x80, 0xb5, 0x00, 0xf0, 0x02, 0xf8,
-	0x01, 0xbd, 0x00, 0x00, 0x07, 0x46, 0x38, 0x46, 0x00, 0xf0, 0x02, 0xf8, 0xfb, 0xe7, 0x00, 0x00,
-	0x80, 0xb5, 0x00, 0xbf, 0x00, 0xbf, 0x02, 0x4a, 0x11, 0x00, 0x18, 0x20, 0xab, 0xbe, 0xfb, 0xe7,
-	0x26, 0x00, 0x02, 0x00, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0xbf, 0x00, 0xbf, 0xff, 0xf7, 0xd6, 0xff,
-	0x00, 0x00, 0x00, 0x00, 0x9f
-};
-static const uint8_t buf_upload[] = {
-	0x00, 0x00, 0x00, 0x00, 0x20, 0xa4, 0x07, 0x00, 0x00, 0xcb
-};
-static const uint8_t buf_execute[] = {
-	0xc0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc0
-};
-
-//--------------------------------------------
-static uint8_t buf_cmd[] = {
-	0x49, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-static uint8_t buf_cmd_write[sizeof(buf_cmd) + 0x200] = {
-	0x49, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
-
-
-//--------------------------------------------
-static int serial_read_connect_ack(HANDLE dev, size_t timeout_ms)
-{
-	struct timeval current_time;
-	size_t start_ms;
-	size_t check_ms;
-
-	gettimeofday(&current_time, NULL);
-	start_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-
-	for (;;)
-	{
-		int res;
-		uint8_t ack;
-
-		res = serial_read(dev, &ack, 1);
-		if (res > 0 && ack == 0x11)
-		{
-			return 0;
-		}
-		if (res < 0)
-		{
-			return -1;
-		}
-
-		gettimeofday(&current_time, NULL);
-		check_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-		size_t stop_ms = check_ms - start_ms;
-		if (stop_ms > timeout_ms)
-		{
-			return -1;
-		}
-	}
-}
-
-//--------------------------------------------
-static int serial_read_success_ack(HANDLE dev, size_t timeout_ms)
-{
-	struct timeval current_time;
-	size_t start_ms;
-	size_t check_ms;
-
-	gettimeofday(&current_time, NULL);
-	start_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-
-	for (;;)
-	{
-		volatile int res;
-		uint8_t ack;
-
-		res = serial_read(dev, &ack, 1);
-		if (res > 0)
-		{
-			if (ack == 0x01)
-			{
-				return 0;
-			}
-			else
-			{
-				return -1;
-			}
-		}
-		if (res < 0)
-		{
-			return -1;
-		}
-
-		gettimeofday(&current_time, NULL);
-		check_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-		size_t stop_ms = check_ms - start_ms;
-		if (stop_ms > timeout_ms)
-		{
-			return -1;
-		}
-		sleep(1);
-	}
-}
-
-//--------------------------------------------
-static int serial_read_execute_ack(HANDLE dev, size_t timeout_ms)
-{
-	struct timeval current_time;
-	size_t start_ms;
-	size_t check_ms;
-
-	gettimeofday(&current_time, NULL);
-	start_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-
-	for (;;)
-	{
-		int res;
-		uint8_t ack;
-		static size_t ack_cnt;
-
-		res = serial_read(dev, &ack, 1);
-		if (res > 0)
-		{
-			ack_cnt++;
-			if (ack_cnt == 11)
-			{
-				return 0;
-			}
-		}
-		if (res < 0)
-		{
-			return -1;
-		}
-
-		gettimeofday(&current_time, NULL);
-		check_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-		size_t stop_ms = check_ms - start_ms;
-		if (stop_ms > timeout_ms)
-		{
-			return -1;
-		}
-		sleep(0);
-	}
-}
-
-//--------------------------------------------
-static int serial_read_cmd_read_resp(HANDLE dev, size_t timeout_ms, uint8_t *resp_buf)
-{
-	struct timeval current_time;
-	size_t start_ms;
-	size_t check_ms;
-	size_t buf_cnt = 0;
-	uint16_t flash_size_pkt = 0;
-
-	gettimeofday(&current_time, NULL);
-	start_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-
-	for (;;)
-	{
-		int res;
-
-		res = serial_read(dev, &resp_buf[buf_cnt], 1);
-		if (res > 0)
-		{
-			switch (buf_cnt)
-			{
-			case 0:
-				if (resp_buf[0] != 0x49)
-				{
-					return -1;
-				}
-				break;
-			case 1:
-				if (resp_buf[1] != 0)
-				{
-					return -1;
-				}
-				break;
-			case 7:
-				flash_size_pkt = (uint16_t)resp_buf[7] << 8 | resp_buf[6];
-				if (flash_size_pkt > READ_PACKET_MAX_DATA_SIZE)
-				{
-					return -1;
-				}
-				break;
-			}
-			if (flash_size_pkt > 0 && buf_cnt == 8 + flash_size_pkt)
-			{
-				if (sum8(resp_buf, 8 + flash_size_pkt) != resp_buf[8 + flash_size_pkt])
-				{
-					return -1;
-				}
-				return 0;
-			}
-			buf_cnt++;
-		}
-		if (res < 0)
-		{
-			return -1;
-		}
-
-		gettimeofday(&current_time, NULL);
-		check_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-		size_t stop_ms = check_ms - start_ms;
-		if (stop_ms > timeout_ms)
-		{
-			return -1;
-		}
-	}
-}
-
-//--------------------------------------------
-static int serial_read_cmd_resp(HANDLE dev, size_t timeout_ms, uint8_t *resp_buf)
-{
-	struct timeval current_time;
-	size_t start_ms;
-	size_t check_ms;
-	size_t buf_cnt = 0;
-
-	gettimeofday(&current_time, NULL);
-	start_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-
-	for (;;)
-	{
-		int res;
-
-		res = serial_read(dev, &resp_buf[buf_cnt], 1);
-		if (res > 0)
-		{
-			switch (buf_cnt)
-			{
-			case 0:
-				if (resp_buf[0] != 0x49)
-				{
-					return -1;
-				}
-				break;
-			case 1:
-				if (resp_buf[1] != 0)
-				{
-					return -1;
-				}
-				break;
-			case 8:
-				if (sum8(resp_buf, 8) != resp_buf[8])
-				{
-					return -1;
-				}
-				return 0;
-			}
-			buf_cnt++;
-		}
-		if (res < 0)
-		{
-			return -1;
-		}
-
-		gettimeofday(&current_time, NULL);
-		check_ms = current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
-		size_t stop_ms = check_ms - start_ms;
-		if (stop_ms > timeout_ms)
-		{
-			return -1;
-		}
-	}
-}
-
 //--------------------------------------------
 static void print_usage(void)
 {
 	printf("Usage:\n");
-	printf("  hc32l10-serial-boot -p <serport> [-b] [-l <length>] [-f <file>]\n\n");
+	printf("  hc32l10-serial-boot -p <serport> | -W <jobs> | -J <station> [-b] [-r <file> | -w <file> | -C <file> | -e | -m <manifest> | -i | -I] [-a <address>] [-s <size>] [-x] [-v] [-l] [-f <baudrate>] [-L <line>] [-H] [-g <fd>] [-A <file>] [-M <file>] [-n <ms>] [-D <dir>] [-P <patch>]... [-F <file>] [-R [-B <pattern>] [-T <ms>] [-u <baudrate>]]\n\n");
 	printf("Mandatory arguments for input:\n");
-	printf("  -p <serport>       serial port name\n");
+	printf("  -p <serport>       serial port name or selector (Linux): usb-serial:<serial>, usb-path:<path>, vidpid:<vid>:<pid>\n");
+	printf("  -W <jobs>          instead of -p: watch for new USB serial ports and start a job for each one,\n");
+	printf("                     at most <jobs> at a time (0: no limit), with the -w, -C, -e or -m option (Linux)\n");
+	printf("  -J <station>       instead of -p: run the job queue of the station file on all of its ports at once,\n");
+	printf("                     every job is a manifest (-m) for the next idle port its selector matches\n");
 	printf("Command arguments for input:\n");
 	printf("  -b                 simply switches HC32L110 into serial bootloader mode, then you can use the original HDSC ISP\n");
-	printf("  -r <file>          read flash memory to file\n");
+	printf("  -r <file>          read flash memory to file, or any other region of the memory map with -a\n");
 	printf("  -w <file>          write flash memory from file\n");
+	printf("  -C <file>          compare flash memory with file, stops at the first mismatching packet\n");
 	printf("  -e                 erase flash memory\n");
+	printf("  -m <manifest>      write several regions in one session as listed in the manifest (INI file)\n");
+	printf("  -i                 identify the board: UID and flash checksums computed by the flashloader, as a JSON line\n");
+	printf("  -I                 interactive session: read, dump, write, erase, checksum, probe, run... commands from stdin,\n");
+	printf("                     all on the same connection, help lists them\n");
 	printf("Command-specific input arguments:\n");
-	printf("  -a <address>       data address in hexadecimal notation\n");
-	printf("  -s <size>          data size in hexadecimal notation\n");
+	printf("  -a <address>       data address in hexadecimal notation; with -r also a region: flash, sram or uid\n");
+	printf("  -s <size>          data size in hexadecimal notation, with a region: read only its first <size> bytes\n");
+	printf("  -x                 with -r or -I: read addresses outside the flash, sram and uid regions (peripheral\n");
+	printf("                     registers...), at most 0x4000 bytes at a time\n");
+	printf("  -v                 verify written data by reading it back and comparing CRC-32\n");
+	printf("  -D <dir>           device state cache directory: -w erases and writes only the sectors that changed\n");
+	printf("                     since the last write to the same board (by UID), the whole flash otherwise\n");
+	printf("  -P <addr>=<value>  patch the written data, can be repeated; <value> is one of\n");
+	printf("                     u8:<n>, u16:<n>, u32:<n>, hex:<bytes>, str:<text>,\n");
+	printf("                     counter:<file>[,<format>] (incremented on every use, e.g. counter:sn.txt,SN%%06u),\n");
+	printf("                     crc32:<start>-<end> (CRC-32 of the patched data, applied last)\n");
+	printf("  -F <file>          patches from file, one per line\n");
+	printf("  -R                 reset the target into the application when all operations are done, alone: just reset it\n");
+	printf("  -B <pattern>       with -R: wait for the boot banner of the application and print the boot time\n");
+	printf("  -T <ms>            with -B: the boot banner deadline, 5000 ms by default\n");
+	printf("  -u <baudrate>      with -B: the baud rate of the application, 9600 by default\n");
+	printf("Serial port arguments:\n");
+	printf("  -f <baudrate>      two-stage flashloader load at 19200, 38400, 57600, 115200, 230400 or 460800 baud\n");
+	printf("  -l                 low-latency mode of the USB2UART dongle (Linux, ASYNC_LOW_LATENCY and 1 ms latency timer)\n");
+	printf("  -L <line>          reset/power line: rts (default), dtr or none (reset the board by hand within 5 seconds)\n");
+	printf("  -H                 RTS/CTS hardware flow control, needs -Ldtr or -Lnone\n");
+	printf("Output arguments:\n");
+	printf("  -g <fd>            progress of erase, write, read, verify and compare on this file descriptor:\n");
+	printf("                     JSON lines (phase, bytes done/total, rate, ETA), a progress bar if it is a terminal\n");
+	printf("  -A <file>          append an audit record of every session to the file, a JSON line: port, UID,\n");
+	printf("                     image CRC-32, time and bytes/s per phase, frames, retries, timeouts, result\n");
+	printf("  -M <file>          add every session to the OpenMetrics text file (node_exporter textfile collector):\n");
+	printf("                     histograms of the connect, upload, packet round trip and session times per port\n");
+	printf("  -n <ms>            dry run, the port is not opened: print the frames and waits of the operations,\n");
+	printf("                     the bytes on the wire and the time per phase estimated for this link latency\n");
 	printf("\nExamples:\n");
 #ifdef _WIN32
 	printf("  hc32l10-serial-boot -pCOM9 -b\n");
 	printf("  hc32l10-serial-boot -pCOM9 -rflash.bin\n");
 	printf("  hc32l10-serial-boot -pCOM9 -rflash.bin -a0x1000 -s0x100\n");
+	printf("  hc32l10-serial-boot -pCOM9 -rsram.bin -asram -Lnone\n");
+	printf("  hc32l10-serial-boot -pCOM9 -ruid.bin -auid\n");
+	printf("  hc32l10-serial-boot -pCOM9 -rregs.bin -a40020000 -s100 -x\n");
 	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin\n");
 	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -a0x1000\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -v\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -v -g2\n");
+	printf("  hc32l10-serial-boot -pCOM9 -Cflash.bin\n");
+	printf("  hc32l10-serial-boot -pCOM9 -i -f460800\n");
+	printf("  hc32l10-serial-boot -pCOM9 -I -f460800\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -f460800\n");
+	printf("  hc32l10-serial-boot -n16 -wflash.bin -v -f460800\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -f460800 -Ldtr -H\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -Ddevices -f460800\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -P3f00=counter:sn.txt -P3ffc=crc32:0-3ffc\n");
 	printf("  hc32l10-serial-boot -pCOM9 -e\n");
 	printf("  hc32l10-serial-boot -pCOM9 -e -a0x1000\n");
+	printf("  hc32l10-serial-boot -pCOM9 -mproduct.ini -f460800\n");
+	printf("  hc32l10-serial-boot -Jstation.txt -f460800\n");
+	printf("  hc32l10-serial-boot -Jstation.txt -f460800 -Aaudit.log -Mhc32boot.prom\n");
+	printf("  hc32l10-serial-boot -pCOM9 -wflash.bin -R -B\"Hello\" -u115200\n");
 #else
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -b\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -rflash.bin\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -rflash.bin -a0x1000 -s0x100\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -rsram.bin -asram -Lnone\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -ruid.bin -auid\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -rregs.bin -a40020000 -s100 -x\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -a0x1000\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -v\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -v -g3 3>progress.log\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -Cflash.bin\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -i -f460800\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -I -f460800 <commands.txt\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -l\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -f460800\n");
+	printf("  hc32l10-serial-boot -n16 -wflash.bin -v -f460800\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -f460800 -Ldtr -H\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -Ddevices -f460800\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -P3f00=counter:sn.txt -P3ffc=crc32:0-3ffc\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -e\n");
 	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -e -a0x1000\n");
+	printf("  hc32l10-serial-boot -pusb-path:1-2.3 -wflash.bin\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -mproduct.ini -f460800\n");
+	printf("  hc32l10-serial-boot -W4 -wflash.bin -v -f460800\n");
+	printf("  hc32l10-serial-boot -Jstation.txt -f460800\n");
+	printf("  hc32l10-serial-boot -W4 -wflash.bin -v -f460800 -Aaudit.log -M/var/lib/node_exporter/hc32boot.prom\n");
+	printf("  hc32l10-serial-boot -p/dev/ttyUSB0 -wflash.bin -R -B\"Hello\" -u115200\n");
 #endif
 }
 
@@ -519,13 +183,48 @@ typedef struct options
 	int opt_e;
 	int opt_r;
 	int opt_w;
+	int opt_C;
 	int opt_a;
 	int opt_s;
+	int opt_x;
+	int opt_v;
+	int opt_l;
+	int opt_L;
+	int opt_H;
+	int opt_f;
+	int opt_D;
+	int opt_W;
+	int opt_J;
+	int opt_m;
+	int opt_i;
+	int opt_I;
+	int opt_R;
+	int opt_B;
+	int opt_T;
+	int opt_u;
+	int opt_g;
+	int opt_n;
+	int opt_A;
+	int opt_M;
 	char *opt_p_arg;
 	char *opt_r_arg;
 	char *opt_w_arg;
+	char *opt_C_arg;
 	char *opt_a_arg;
 	char *opt_s_arg;
+	char *opt_f_arg;
+	char *opt_L_arg;
+	char *opt_D_arg;
+	char *opt_W_arg;
+	char *opt_J_arg;
+	char *opt_m_arg;
+	char *opt_B_arg;
+	char *opt_T_arg;
+	char *opt_u_arg;
+	char *opt_g_arg;
+	char *opt_n_arg;
+	char *opt_A_arg;
+	char *opt_M_arg;
 } options_t;
 
 //--------------------------------------------
@@ -536,17 +235,128 @@ typedef struct options
 #define OPTIONS_CHECK_ERROR_OPEN_FILE            -4
 #define OPTIONS_CHECK_ERROR_EMPTY_FILE           -5
 #define OPTIONS_CHECK_ERROR_TOO_BIG_FILE         -6
+#define OPTIONS_CHECK_ERROR_INCORRECT_BAUDRATE   -7
+#define OPTIONS_CHECK_ERROR_INCORRECT_JOBS       -8
+#define OPTIONS_CHECK_ERROR_INCORRECT_BANNER     -9
+#define OPTIONS_CHECK_ERROR_INCORRECT_LINE       -10
+#define OPTIONS_CHECK_ERROR_INCORRECT_FD         -11
+#define OPTIONS_CHECK_ERROR_INCORRECT_LATENCY    -12
 
 //--------------------------------------------
 static int options_check(options_t *ts)
 {
 	// input options
-	if (!ts->opt_p)
+	if (!ts->opt_p && !ts->opt_W && !ts->opt_J && !ts->opt_n)
 	{
 		printf("The -p option is required.\n\n");
 		print_usage();
 		return OPTIONS_CHECK_ERROR_USAGE;
 	}
+	if (ts->opt_J && (ts->opt_p || ts->opt_W || ts->opt_b || ts->opt_r || ts->opt_w || ts->opt_C || ts->opt_e ||
+		ts->opt_m || ts->opt_i || ts->opt_I || ts->opt_R || ts->opt_D || patch_count()))
+	{
+		printf("The -J option replaces the -p option and the operations, the station file lists the ports and the jobs.\n\n");
+		print_usage();
+		return OPTIONS_CHECK_ERROR_USAGE;
+	}
+	if (ts->opt_n)
+	{
+		double value;
+		char *endptr;
+
+		if (ts->opt_W || ts->opt_J)
+		{
+			printf("Invalid options, the -n option plans the operations of one port, it can not be used with -W or -J.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_USAGE;
+		}
+		errno = 0;
+		value = strtod(ts->opt_n_arg, &endptr);
+		if (errno || endptr == ts->opt_n_arg || *endptr != '\0' || value < 0 || value > 1000)
+		{
+			printf("The -n option is wrong.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_INCORRECT_LATENCY;
+		}
+		plan_latency_us = (uint32_t)(value * 1000 + 0.5);
+		if (patch_count())
+		{
+			printf("Warning: The -P and -F options are not applied by the -n option, the counters stay as they are.\n\n");
+		}
+	}
+	if (ts->opt_W)
+	{
+		long value;
+		char *endptr;
+
+		if (ts->opt_p || ts->opt_b || ts->opt_r || ts->opt_I || (!ts->opt_w && !ts->opt_C && !ts->opt_e && !ts->opt_m))
+		{
+			printf("The -W option replaces the -p option and needs the -w, -C, -e or -m option.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_USAGE;
+		}
+		errno = 0;
+		value = strtol(ts->opt_W_arg, &endptr, 10);
+		if (errno || *endptr != '\0' || value < 0 || value > WATCH_MAX_PORTS)
+		{
+			printf("The -W option is wrong.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_INCORRECT_JOBS;
+		}
+		watch_jobs = (int)value;
+	}
+	if (ts->opt_L)
+	{
+		if (!strcmp(ts->opt_L_arg, "rts"))
+		{
+			reset_line = HC32BOOT_RESET_RTS;
+		}
+		else if (!strcmp(ts->opt_L_arg, "dtr"))
+		{
+			reset_line = HC32BOOT_RESET_DTR;
+		}
+		else if (!strcmp(ts->opt_L_arg, "none"))
+		{
+			reset_line = HC32BOOT_RESET_NONE;
+		}
+		else
+		{
+			printf("The -L option is wrong.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_INCORRECT_LINE;
+		}
+	}
+	if (ts->opt_H && reset_line == HC32BOOT_RESET_RTS)
+	{
+		printf("Invalid options, RTS is the reset line, the -H option needs -Ldtr or -Lnone.\n\n");
+		print_usage();
+		return OPTIONS_CHECK_ERROR_USAGE;
+	}
+	if (ts->opt_g)
+	{
+		long value;
+		char *endptr;
+
+		errno = 0;
+		value = strtol(ts->opt_g_arg, &endptr, 10);
+#ifdef _WIN32
+		if (errno || *endptr != '\0' || value < 0 || value > 2)
+#else
+		if (errno || *endptr != '\0' || value < 0 || value > 1023 || fcntl((int)value, F_GETFD) < 0)
+#endif
+		{
+			printf("The -g option is wrong, %s is not an open file descriptor.\n\n", ts->opt_g_arg);
+			print_usage();
+			return OPTIONS_CHECK_ERROR_INCORRECT_FD;
+		}
+		progress_open((int)value);
+	}
+	if (ts->opt_R && reset_line == HC32BOOT_RESET_NONE)
+	{
+		printf("Invalid options, the -R option needs a reset line.\n\n");
+		print_usage();
+		return OPTIONS_CHECK_ERROR_USAGE;
+	}
 	if (ts->opt_b)
 	{
 		if (ts->opt_e)
@@ -561,6 +371,18 @@ static int options_check(options_t *ts)
 		{
 			printf("Warning: The -w option is ignored with the -b option.\n\n");
 		}
+		if (ts->opt_C)
+		{
+			printf("Warning: The -C option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_i)
+		{
+			printf("Warning: The -i option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_I)
+		{
+			printf("Warning: The -I option is ignored with the -b option.\n\n");
+		}
 		if (ts->opt_a)
 		{
 			printf("Warning: The -a option is ignored with the -b option.\n\n");
@@ -569,31 +391,90 @@ static int options_check(options_t *ts)
 		{
 			printf("Warning: The -s option is ignored with the -b option.\n\n");
 		}
+		if (ts->opt_x)
+		{
+			printf("Warning: The -x option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_v)
+		{
+			printf("Warning: The -v option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_f)
+		{
+			printf("Warning: The -f option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_D)
+		{
+			printf("Warning: The -D option is ignored with the -b option.\n\n");
+		}
+		if (patch_count())
+		{
+			printf("Warning: The -P and -F options are ignored with the -b option.\n\n");
+		}
+		if (ts->opt_m)
+		{
+			printf("Warning: The -m option is ignored with the -b option.\n\n");
+		}
+		if (ts->opt_R)
+		{
+			printf("Warning: The -R option is ignored with the -b option.\n\n");
+		}
 	}
 	else
 	{
-		if ((ts->opt_e && ts->opt_r) || (ts->opt_e && ts->opt_w) || (ts->opt_r && ts->opt_w))
+		if (ts->opt_e + ts->opt_r + ts->opt_w + ts->opt_C + ts->opt_i + ts->opt_I > 1 || ((ts->opt_i || ts->opt_I) && ts->opt_m))
 		{
 			printf("Invalid options, you can not do several operations at the same time.\n\n");
 			print_usage();
 			return OPTIONS_CHECK_ERROR_USAGE;
 		}
+		if (ts->opt_m && (ts->opt_r || ts->opt_w || ts->opt_C || ts->opt_e || ts->opt_a || ts->opt_s))
+		{
+			printf("Invalid options, the manifest lists the regions, the -r, -w, -C, -e, -a and -s options can not be used with -m.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_USAGE;
+		}
+		if (ts->opt_x && !ts->opt_r && !ts->opt_I)
+		{
+			printf("Warning: The -x option is ignored without the -r or -I option.\n\n");
+		}
 		if (ts->opt_r)
 		{
-			if ((ts->opt_a && !ts->opt_s) || (!ts->opt_a && ts->opt_s))
+			if (ts->opt_a && (read_region = hc32boot_region(ts->opt_a_arg)) != NULL)
+			{
+				// a region by name, -s reads only the beginning of it
+				flash_addr = read_region->addr;
+				flash_size = (uint16_t)read_region->size;
+				if (ts->opt_s)
+				{
+					unsigned long value;
+					char *endptr;
+
+					errno = 0;
+					value = strtoul(ts->opt_s_arg, &endptr, 16);
+					if (errno || *endptr != '\0' || value == 0 || value > read_region->size)
+					{
+						printf("The -s option is wrong, the %s region is 0x%X bytes long.\n\n", read_region->name, read_region->size);
+						print_usage();
+						return OPTIONS_CHECK_ERROR_INCORRECT_SIZE;
+					}
+					flash_size = (uint16_t)value;
+				}
+			}
+			else if ((ts->opt_a && !ts->opt_s) || (!ts->opt_a && ts->opt_s))
 			{
 				printf("Invalid options, both address and size must be specified to read the flash memory portion.\n\n");
 				print_usage();
 				return OPTIONS_CHECK_ERROR_USAGE;
 			}
-			if (ts->opt_a && ts->opt_s)
+			else if (ts->opt_a && ts->opt_s)
 			{
-				long value;
+				unsigned long value;
 				char *endptr;
 
 				errno = 0;
-				value = strtol(ts->opt_a_arg, &endptr, 16);
-				if (errno || *endptr != '\0' || value < 0 || value >= HC32L110_FLASH_SIZE)
+				value = strtoul(ts->opt_a_arg, &endptr, 16);
+				if (errno || *endptr != '\0' || *ts->opt_a_arg == '-' || value > UINT32_MAX)
 				{
 					printf("The -a option is wrong.\n\n");
 					print_usage();
@@ -601,27 +482,41 @@ static int options_check(options_t *ts)
 				}
 				flash_addr = (uint32_t)value;
 
+				// the data buffer holds the whole flash, larger ranges are read in several runs
 				errno = 0;
-				value = strtol(ts->opt_s_arg, &endptr, 16);
-				if (errno || *endptr != '\0' || value <= 0 || (flash_addr + value) > HC32L110_FLASH_SIZE)
+				value = strtoul(ts->opt_s_arg, &endptr, 16);
+				if (errno || *endptr != '\0' || value == 0 || value > HC32L110_FLASH_SIZE || value - 1 > UINT32_MAX - flash_addr)
 				{
 					printf("The -s option is wrong.\n\n");
 					print_usage();
 					return OPTIONS_CHECK_ERROR_INCORRECT_SIZE;
 				}
 				flash_size = (uint16_t)value;
+				read_region = hc32boot_region_of(flash_addr, flash_size);
+				if (!read_region && !ts->opt_x)
+				{
+					printf("Invalid options, 0x%08X-0x%08X is not within the flash, sram or uid region, the -x option reads it anyway.\n\n",
+						flash_addr, (uint32_t)(flash_addr + flash_size - 1));
+					print_usage();
+					return OPTIONS_CHECK_ERROR_INCORRECT_ADDR;
+				}
 			}
 			else
 			{
+				read_region = hc32boot_region("flash");
 				flash_addr = 0;
 				flash_size = HC32L110_FLASH_SIZE;
 			}
-			if ((file = fopen(ts->opt_r_arg, "wb")) == NULL)
+			// a dry run leaves the file alone
+			if (!ts->opt_n)
 			{
-				printf("FATAL ERROR: Could not open file %s.\n", ts->opt_r_arg);
-				return OPTIONS_CHECK_ERROR_OPEN_FILE;
+				if ((file = fopen(ts->opt_r_arg, "wb")) == NULL)
+				{
+					printf("FATAL ERROR: Could not open file %s.\n", ts->opt_r_arg);
+					return OPTIONS_CHECK_ERROR_OPEN_FILE;
+				}
+				printf("File %s is opened.\n", ts->opt_r_arg);
 			}
-			printf("File %s is opened.\n", ts->opt_r_arg);
 		}
 		if (ts->opt_e)
 		{
@@ -649,11 +544,13 @@ static int options_check(options_t *ts)
 				flash_addr = 0;
 			}
 		}
-		if (ts->opt_w)
+		if (ts->opt_w || ts->opt_C)
 		{
+			const char *name = ts->opt_w ? ts->opt_w_arg : ts->opt_C_arg;
+
 			if (ts->opt_s)
 			{
-				printf("Warning: The -s option is ignored with the -w option.\n\n");
+				printf("Warning: The -s option is ignored with the -%c option.\n\n", ts->opt_w ? 'w' : 'C');
 			}
 			if (ts->opt_a)
 			{
@@ -674,51 +571,413 @@ static int options_check(options_t *ts)
 			{
 				flash_addr = 0;
 			}
-			if ((file = fopen(ts->opt_w_arg, "rb")) == NULL)
+			if ((file = fopen(name, "rb")) == NULL)
 			{
-				printf("FATAL ERROR: Could not open file %s.\n", ts->opt_w_arg);
+				printf("FATAL ERROR: Could not open file %s.\n", name);
 				return OPTIONS_CHECK_ERROR_OPEN_FILE;
 			}
-			printf("File %s is opened.\n", ts->opt_w_arg);
+			printf("File %s is opened.\n", name);
 			fseek(file, 0L, SEEK_END);
 			long length = ftell(file);
 			fseek(file, 0L, SEEK_SET);
 			if (!length)
 			{
-				printf("File %s is empty.\n", ts->opt_w_arg);
+				printf("File %s is empty.\n", name);
 				fclose(file);
-				printf("File %s is closed.\n", ts->opt_w_arg);
+				printf("File %s is closed.\n", name);
 				return OPTIONS_CHECK_ERROR_EMPTY_FILE;
 			}
 			if (flash_addr + length > HC32L110_FLASH_SIZE)
 			{
-				printf("File %s is longer than microcontroller flash size.\n", ts->opt_w_arg);
+				printf("File %s is longer than microcontroller flash size.\n", name);
 				fclose(file);
-				printf("File %s is closed.\n", ts->opt_w_arg);
+				printf("File %s is closed.\n", name);
 				return OPTIONS_CHECK_ERROR_TOO_BIG_FILE;
 			}
 			flash_size = (uint16_t)length;
 		}
-		if (!ts->opt_r && !ts->opt_e && !ts->opt_w)
+		if (ts->opt_f)
 		{
-			ts->opt_b = 1;
-		}
-	}
-	return OPTIONS_CHECK_SUCCESS;
-}
-
-//--------------------------------------------
-int main(int argc, char *argv[])
-{
-	int option;
-	options_t ts = { 0 };
-	port_settings_t set = { 9600, 0 };
-	static HANDLE rx_uart;
+			long value;
+			char *endptr;
 
-	while ((option = getopt(argc, argv, "p:br:ew:a:s:")) != -1)
-	{
-		switch (option)
-		{
+			errno = 0;
+			value = strtol(ts->opt_f_arg, &endptr, 10);
+			// rates supported by the serial port code, the stub needs a multiple of 9600
+			if (errno || *endptr != '\0' || (value != 19200 && value != 38400 && value != 57600 &&
+				value != 115200 && value != 230400 && value != 460800))
+			{
+				printf("The -f option is wrong.\n\n");
+				print_usage();
+				return OPTIONS_CHECK_ERROR_INCORRECT_BAUDRATE;
+			}
+			boot_baudrate = (int)value;
+		}
+		if (ts->opt_v && !ts->opt_w)
+		{
+			printf("Warning: The -v option is ignored without the -w option.\n\n");
+		}
+		if (ts->opt_D && !ts->opt_w)
+		{
+			printf("Warning: The -D option is ignored without the -w option.\n\n");
+		}
+		if ((ts->opt_B || ts->opt_T || ts->opt_u) && !ts->opt_R)
+		{
+			printf("Invalid options, the -B, -T and -u options need the -R option.\n\n");
+			print_usage();
+			return OPTIONS_CHECK_ERROR_USAGE;
+		}
+		if ((ts->opt_T || ts->opt_u) && !ts->opt_B)
+		{
+			printf("Warning: The -T and -u options are ignored without the -B option.\n\n");
+		}
+		if (ts->opt_B)
+		{
+			long value;
+			char *endptr;
+
+			if (!*ts->opt_B_arg || strlen(ts->opt_B_arg) > HC32BOOT_BANNER_MAX_SIZE)
+			{
+				printf("The -B option is wrong, the pattern is empty or longer than %d characters.\n\n", HC32BOOT_BANNER_MAX_SIZE);
+				print_usage();
+				return OPTIONS_CHECK_ERROR_INCORRECT_BANNER;
+			}
+			if (ts->opt_T)
+			{
+				errno = 0;
+				value = strtol(ts->opt_T_arg, &endptr, 10);
+				if (errno || *endptr != '\0' || value <= 0 || value > 600000)
+				{
+					printf("The -T option is wrong.\n\n");
+					print_usage();
+					return OPTIONS_CHECK_ERROR_INCORRECT_BANNER;
+				}
+				banner_ms = (int)value;
+			}
+			if (ts->opt_u)
+			{
+				errno = 0;
+				value = strtol(ts->opt_u_arg, &endptr, 10);
+				if (errno || *endptr != '\0' || value < 1200 || value > 460800)
+				{
+					printf("The -u option is wrong.\n\n");
+					print_usage();
+					return OPTIONS_CHECK_ERROR_INCORRECT_BAUDRATE;
+				}
+				run_baudrate = (int)value;
+			}
+		}
+		if (!ts->opt_r && !ts->opt_e && !ts->opt_w && !ts->opt_C && !ts->opt_m && !ts->opt_i && !ts->opt_I && !ts->opt_R && !ts->opt_J)
+		{
+			ts->opt_b = 1;
+		}
+	}
+	return OPTIONS_CHECK_SUCCESS;
+}
+
+//--------------------------------------------
+// phase: the name of the progress events, NULL for none
+static int session_run(hc32boot_t *session, int type, uint32_t addr, uint32_t size, uint8_t *data, const char *phase)
+{
+	hc32boot_op_t op = { 0 };
+	int res;
+
+	op.type = type;
+	op.addr = addr;
+	op.size = size;
+	op.data = data;
+	if (phase)
+	{
+		op.progress = progress_op;
+		progress_begin(phase, size);
+	}
+	res = hc32boot_submit(session, &op) ? -1 : hc32boot_wait(session);
+	if (phase)
+	{
+		progress_end(res);
+	}
+	return res;
+}
+
+//--------------------------------------------
+// Reads and compares one link packet at a time, the first packet that differs
+// ends the compare: a bad board is rejected after a few round trips.
+static int compare(hc32boot_t *session, const uint8_t *ref, uint8_t *buf)
+{
+	uint32_t pkt_size = hc32boot_link(session)->pkt_size;
+	uint32_t done;
+
+	progress_begin("compare", flash_size);
+	for (done = 0; done < flash_size; done += pkt_size)
+	{
+		uint32_t len = flash_size - done < pkt_size ? flash_size - done : pkt_size;
+		uint32_t cnt;
+
+		progress_update(done);
+		if (session_run(session, HC32BOOT_OP_READ, flash_addr + done, len, buf + done, NULL))
+		{
+			progress_end(-1);
+			printf("ERROR: Connection error.\n");
+			return -1;
+		}
+		if (!memcmp(buf + done, ref + done, len))
+		{
+			continue;
+		}
+		progress_update(done + len);
+		progress_end(-1);
+		printf("ERROR: Flash memory differs from the file in the packet at 0x%04X-0x%04X:\n",
+			flash_addr + done, flash_addr + done + len - 1);
+		for (cnt = 0; cnt < len; cnt++)
+		{
+			uint32_t first = cnt;
+
+			if (buf[done + cnt] == ref[done + cnt])
+			{
+				continue;
+			}
+			while (cnt + 1 < len && buf[done + cnt + 1] != ref[done + cnt + 1])
+			{
+				cnt++;
+			}
+			printf("  0x%04X-0x%04X\n", flash_addr + done + first, flash_addr + done + cnt);
+		}
+		printf("Compare stopped, 0x%04X bytes of 0x%04X compared.\n", done + len, flash_size);
+		return -1;
+	}
+	progress_update(flash_size);
+	progress_end(0);
+	printf("Flash memory matches the file, 0x%04X bytes compared.\n", flash_size);
+	return 0;
+}
+
+//--------------------------------------------
+static void run_progress(void *arg, const hc32boot_op_t *op, uint32_t done)
+{
+	(void)op;
+	*(uint32_t *)arg = done;
+}
+
+//--------------------------------------------
+// The image to write is read, checksummed and framed by a worker thread while
+// the main thread keeps the target in reset and uploads the flashloader.
+typedef struct prepare
+{
+	uint8_t *data;
+	hc32boot_image_t image;
+	manifest_t *manifest;    // the manifest images instead of data and image
+	int result;
+	int started;
+#ifdef _WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+} prepare_t;
+
+//--------------------------------------------
+static void prepare_image(prepare_t *prep)
+{
+	prep->result = -1;
+	if (prep->manifest)
+	{
+		prep->result = manifest_prepare(prep->manifest);
+		return;
+	}
+	if (fread(prep->data, flash_size, 1, file) != 1)
+	{
+		return;
+	}
+	prep->result = hc32boot_image_prepare(&prep->image, flash_addr, prep->data, flash_size, WRITE_PACKET_MAX_DATA_SIZE);
+}
+
+//--------------------------------------------
+#ifdef _WIN32
+static unsigned __stdcall prepare_thread(void *arg)
+{
+	prepare_image(arg);
+	return 0;
+}
+#else
+static void *prepare_thread(void *arg)
+{
+	prepare_image(arg);
+	return NULL;
+}
+#endif
+
+//--------------------------------------------
+static void prepare_start(prepare_t *prep)
+{
+#ifdef _WIN32
+	prep->thread = (HANDLE)_beginthreadex(NULL, 0, prepare_thread, prep, 0, NULL);
+	prep->started = prep->thread != NULL;
+#else
+	prep->started = !pthread_create(&prep->thread, NULL, prepare_thread, prep);
+#endif
+	if (!prep->started)
+	{
+		// no thread, do it now
+		prepare_image(prep);
+	}
+}
+
+//--------------------------------------------
+static int prepare_join(prepare_t *prep)
+{
+	if (prep->started)
+	{
+#ifdef _WIN32
+		WaitForSingleObject(prep->thread, INFINITE);
+		CloseHandle(prep->thread);
+#else
+		pthread_join(prep->thread, NULL);
+#endif
+		prep->started = 0;
+	}
+	return prep->result;
+}
+
+//--------------------------------------------
+// -n: the operations main() would submit, in the same order, without a port
+static int plan_run(const options_t *ts, const hc32boot_config_t *cfg, prepare_t *prep)
+{
+	hc32boot_op_t op = { 0 };
+
+	if (ts->opt_w || prep->manifest)
+	{
+		// the images are framed as for the session, no thread needed
+		prepare_image(prep);
+		if (prep->result)
+		{
+			printf("ERROR: Could not read the file %s.\n", ts->opt_w ? ts->opt_w_arg : ts->opt_m_arg);
+			return EXIT_FAILURE;
+		}
+	}
+	plan_begin(cfg, plan_latency_us);
+	if (!ts->opt_R || ts->opt_b || ts->opt_r || ts->opt_w || ts->opt_C || ts->opt_e || ts->opt_m || ts->opt_i || ts->opt_I)
+	{
+		op.type = HC32BOOT_OP_CONNECT;
+		plan_op("connect", &op);
+		if (ts->opt_b)
+		{
+			goto done;
+		}
+		op.type = HC32BOOT_OP_LOAD;
+		plan_op("load", &op);
+		op.type = HC32BOOT_OP_CALIBRATE;
+		plan_op("calibrate", &op);
+	}
+	if (ts->opt_r)
+	{
+		op.type = HC32BOOT_OP_READ;
+		op.addr = flash_addr;
+		op.size = flash_size;
+		plan_op("read", &op);
+	}
+	if (ts->opt_w && ts->opt_D)
+	{
+		printf("  (-D: planned for a board without a device cache record, the whole flash)\n");
+		devcache_plan(&prep->image, ts->opt_v, plan_manifest_op, NULL);
+	}
+	else if (ts->opt_w)
+	{
+		op.type = HC32BOOT_OP_WRITE;
+		op.image = &prep->image;
+		plan_op("write", &op);
+		op.image = NULL;
+		if (ts->opt_v)
+		{
+			op.type = HC32BOOT_OP_READ;
+			op.addr = flash_addr;
+			op.size = flash_size;
+			plan_op("verify", &op);
+		}
+	}
+	if (ts->opt_i)
+	{
+		op.type = HC32BOOT_OP_READ;
+		op.addr = HC32L110_UID_ADDR;
+		op.size = HC32L110_UID_SIZE;
+		plan_op("identify", &op);
+		op.type = HC32BOOT_OP_CHECKSUM;
+		op.addr = 0;
+		op.size = HC32L110_FLASH_SIZE;
+		plan_op("identify", &op);
+	}
+	if (ts->opt_C)
+	{
+		// the whole file, as if no packet differs
+		op.type = HC32BOOT_OP_READ;
+		op.addr = flash_addr;
+		op.size = flash_size;
+		plan_op("compare", &op);
+	}
+	if (ts->opt_m)
+	{
+		manifest_plan(prep->manifest, plan_manifest_op, NULL);
+	}
+	if (ts->opt_e)
+	{
+		op.type = HC32BOOT_OP_ERASE;
+		op.addr = flash_addr;
+		op.size = 0;
+		plan_op("erase", &op);
+	}
+	if (ts->opt_R)
+	{
+		op.type = HC32BOOT_OP_RUN;
+		plan_op("run", &op);
+	}
+
+done:
+	printf("Estimated time: %.1f s%s.\n", plan_end() / 1000.0, ts->opt_B ? " and the boot of the application" : "");
+	return EXIT_SUCCESS;
+}
+
+//--------------------------------------------
+int main(int argc, char *argv[])
+{
+	int option;
+	int status = EXIT_FAILURE;
+	options_t ts = { 0 };
+	hc32boot_config_t cfg = { 9600, 5000, 0, 0, 0, HC32BOOT_RESET_RTS, 0 };
+	hc32boot_t *session;
+	static uint8_t data[HC32L110_FLASH_SIZE];
+	static prepare_t prep;
+	static manifest_t manifest;
+	static audit_t audit;
+	char port_name[256];
+	static const char optstring[] = "p:br:ew:C:a:s:xvlf:L:Hg:A:M:n:D:P:F:W:J:m:iIRB:T:u:";
+	// the options every -W job is started with
+	static char *watch_args[WATCH_MAX_ARGS + 1];
+	static char watch_opts[WATCH_MAX_ARGS][3];
+	int watch_argc = 0;
+	int watch_dropped = 0;
+
+#ifndef _WIN32
+	// -W jobs write into a pipe, keep their output flowing line by line
+	setvbuf(stdout, NULL, _IOLBF, 0);
+#endif
+
+	while ((option = getopt(argc, argv, optstring)) != -1)
+	{
+		if (option != 'W' && option != '?' && watch_argc >= WATCH_MAX_ARGS - 1)
+		{
+			watch_dropped = 1;
+		}
+		else if (option != 'W' && option != '?')
+		{
+			snprintf(watch_opts[watch_argc], sizeof(watch_opts[0]), "-%c", option);
+			watch_args[watch_argc] = watch_opts[watch_argc];
+			watch_argc++;
+			if (strchr(optstring, option)[1] == ':')
+			{
+				watch_args[watch_argc++] = optarg;
+			}
+		}
+		switch (option)
+		{
 		case 'p':
 			ts.opt_p = 1;
 			ts.opt_p_arg = optarg;
@@ -737,6 +996,10 @@ int main(int argc, char *argv[])
 			ts.opt_w = 1;
 			ts.opt_w_arg = optarg;
 			break;
+		case 'C':
+			ts.opt_C = 1;
+			ts.opt_C_arg = optarg;
+			break;
 		case 'a':
 			ts.opt_a = 1;
 			ts.opt_a_arg = optarg;
@@ -745,6 +1008,95 @@ int main(int argc, char *argv[])
 			ts.opt_s = 1;
 			ts.opt_s_arg = optarg;
 			break;
+		case 'x':
+			ts.opt_x = 1;
+			break;
+		case 'v':
+			ts.opt_v = 1;
+			break;
+		case 'l':
+			ts.opt_l = 1;
+			break;
+		case 'f':
+			ts.opt_f = 1;
+			ts.opt_f_arg = optarg;
+			break;
+		case 'L':
+			ts.opt_L = 1;
+			ts.opt_L_arg = optarg;
+			break;
+		case 'H':
+			ts.opt_H = 1;
+			break;
+		case 'g':
+			ts.opt_g = 1;
+			ts.opt_g_arg = optarg;
+			break;
+		case 'A':
+			ts.opt_A = 1;
+			ts.opt_A_arg = optarg;
+			break;
+		case 'M':
+			ts.opt_M = 1;
+			ts.opt_M_arg = optarg;
+			break;
+		case 'n':
+			ts.opt_n = 1;
+			ts.opt_n_arg = optarg;
+			break;
+		case 'D':
+			ts.opt_D = 1;
+			ts.opt_D_arg = optarg;
+			break;
+		case 'W':
+			ts.opt_W = 1;
+			ts.opt_W_arg = optarg;
+			break;
+		case 'J':
+			ts.opt_J = 1;
+			ts.opt_J_arg = optarg;
+			break;
+		case 'm':
+			ts.opt_m = 1;
+			ts.opt_m_arg = optarg;
+			break;
+		case 'i':
+			ts.opt_i = 1;
+			break;
+		case 'I':
+			ts.opt_I = 1;
+			break;
+		case 'R':
+			ts.opt_R = 1;
+			break;
+		case 'B':
+			ts.opt_B = 1;
+			ts.opt_B_arg = optarg;
+			break;
+		case 'T':
+			ts.opt_T = 1;
+			ts.opt_T_arg = optarg;
+			break;
+		case 'u':
+			ts.opt_u = 1;
+			ts.opt_u_arg = optarg;
+			break;
+		case 'P':
+			if (patch_add(optarg))
+			{
+				printf("The -P option is wrong: %s\n\n", optarg);
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'F':
+			if (patch_add_file(optarg))
+			{
+				printf("The -F option is wrong, could not read or parse %s.\n\n", optarg);
+				print_usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
 		default: // '?'
 			print_usage();
 			exit(EXIT_FAILURE);
@@ -755,10 +1107,84 @@ int main(int argc, char *argv[])
 	{
 		exit(EXIT_FAILURE);
 	}
+	if (ts.opt_W && watch_dropped)
+	{
+		printf("Invalid options, the -W jobs can be started with up to %d option words.\n\n", WATCH_MAX_ARGS - 1);
+		print_usage();
+		exit(EXIT_FAILURE);
+	}
+	if (ts.opt_m && !ts.opt_b && manifest_load(&manifest, ts.opt_m_arg))
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	if (ts.opt_W)
+	{
+		if (file)
+		{
+			fclose(file);
+		}
+		exit(watch_run(argv[0], watch_args, watch_jobs));
+	}
 
-	if (serial_open(ts.opt_p_arg, &set, &rx_uart) < 0)
+	cfg.low_latency = ts.opt_l;
+	cfg.boot_baudrate = boot_baudrate;
+	cfg.run_baudrate = run_baudrate;
+	cfg.reset_line = reset_line;
+	cfg.flow_control = ts.opt_H;
+	audit_open(ts.opt_A ? ts.opt_A_arg : NULL, ts.opt_M ? ts.opt_M_arg : NULL);
+	if (ts.opt_J)
+	{
+		exit(station_run(ts.opt_J_arg, &cfg));
+	}
+	if (ts.opt_n)
+	{
+		prep.data = data;
+		prep.manifest = ts.opt_m && !ts.opt_b ? &manifest : NULL;
+		status = plan_run(&ts, &cfg, &prep);
+		hc32boot_image_free(&prep.image);
+		manifest_free(&manifest);
+		if (file)
+		{
+			fclose(file);
+		}
+		exit(status);
+	}
+
+	switch (serial_resolve(ts.opt_p_arg, port_name, sizeof(port_name)))
+	{
+	case SERIAL_RESOLVE_OK:
+		if (strcmp(port_name, ts.opt_p_arg))
+		{
+			printf("Serial port %s is %s.\n", ts.opt_p_arg, port_name);
+		}
+		break;
+	case SERIAL_RESOLVE_NOT_FOUND:
+		printf("ERROR: No serial port matches %s.\n", ts.opt_p_arg);
+		exit(EXIT_FAILURE);
+	case SERIAL_RESOLVE_AMBIGUOUS:
+		printf("ERROR: Several serial ports match %s, select one by usb-serial: or usb-path:.\n", ts.opt_p_arg);
+		exit(EXIT_FAILURE);
+	default:
+		printf("The -p option is wrong.\n\n");
+		print_usage();
+		exit(EXIT_FAILURE);
+	}
+
+	if (ts.opt_w || (ts.opt_m && !ts.opt_b))
+	{
+		prep.data = data;
+		prep.manifest = ts.opt_m ? &manifest : NULL;
+		prepare_start(&prep);
+	}
+
+	audit_begin(&audit, port_name);
+	if ((session = hc32boot_open(port_name, &cfg)) == NULL)
 	{
 		printf("ERROR: Could not open serial port. Not found or not accessible.\n");
+		audit_end(&audit, NULL, -1);
+		prepare_join(&prep);
+		hc32boot_image_free(&prep.image);
 		if (file)
 		{
 			fclose(file);
@@ -769,18 +1195,26 @@ int main(int argc, char *argv[])
 	{
 		printf("%s", "Connection to serial port established.\n");
 	}
+	audit_attach(&audit, session);
 
-	serial_flush(rx_uart);
-	serial_set_rts(rx_uart);
-	printf("Please wait. The HL32L110 is powered off for 5 second.\n");
-	sleep(5000);
-	serial_write(rx_uart, buf_connect, sizeof(buf_connect));
-	serial_clr_rts(rx_uart);
-	if (!serial_read_connect_ack(rx_uart, 20))
+	if (ts.opt_R && !ts.opt_r && !ts.opt_w && !ts.opt_C && !ts.opt_e && !ts.opt_m && !ts.opt_i && !ts.opt_I)
+	{
+		// nothing to program, just restart the application
+		goto run;
+	}
+
+	if (reset_line == HC32BOOT_RESET_NONE)
+	{
+		printf("Please reset the HL32L110 within 5 seconds.\n");
+	}
+	else
+	{
+		printf("Please wait. The HL32L110 is powered off for 5 second.\n");
+	}
+	audit_phase(&audit, "connect", 0);
+	if (!session_run(session, HC32BOOT_OP_CONNECT, 0, 0, NULL, NULL))
 	{
 		printf("Successfully connected to HL32L110.\n");
-		sleep(200);
-		serial_flush(rx_uart);
 	}
 	else
 	{
@@ -791,122 +1225,244 @@ int main(int argc, char *argv[])
 	if (ts.opt_b)
 	{
 		// just establish the connection with HL32L110
-		printf("Disconnect the wire from the RTS pin of the USB2UART dongle and then run HDSC MCU programmer software.\n");
+		printf("Disconnect the wire from the %s pin of the USB2UART dongle and then run HDSC MCU programmer software.\n",
+			reset_line == HC32BOOT_RESET_DTR ? "DTR" : "RTS");
+		status = EXIT_SUCCESS;
 		goto cleanup;
 	}
 
 	// other options: load the flashloader firmware into the RAM
-	serial_write(rx_uart, buf_upload, sizeof(buf_upload));
-	if (serial_read_success_ack(rx_uart, 2000))
+	audit_phase(&audit, "load", 0);
+	if (session_run(session, HC32BOOT_OP_LOAD, 0, 0, NULL, NULL))
 	{
 		printf("ERROR: Connection error.\n");
 		goto cleanup;
 	}
-	sleep(5);
-	serial_write(rx_uart, buf_ramcode, sizeof(buf_ramcode));
-	if (serial_read_success_ack(rx_uart, 5000))
+	printf("The flashloader firmware has been successfully loaded into the RAM.\n");
+
+	audit_phase(&audit, "calibrate", 0);
+	if (session_run(session, HC32BOOT_OP_CALIBRATE, 0, 0, NULL, NULL))
 	{
 		printf("ERROR: Connection error.\n");
 		goto cleanup;
 	}
-	sleep(5);
-	serial_write(rx_uart, buf_execute, sizeof(buf_execute));
-	if (serial_read_execute_ack(rx_uart, 2000))
+	printf("Link round-trip time: %.1f ms (max %.1f ms), packet size %u bytes.\n",
+		hc32boot_link(session)->rtt_min_us / 1000.0, hc32boot_link(session)->rtt_max_us / 1000.0, hc32boot_link(session)->pkt_size);
+	if (audit_enabled())
 	{
-		printf("ERROR: Connection error.\n");
-		goto cleanup;
+		uint8_t uid[HC32L110_UID_SIZE];
+
+		// the board of the audit record
+		audit_phase(&audit, "uid", HC32L110_UID_SIZE);
+		if (session_run(session, HC32BOOT_OP_READ, HC32L110_UID_ADDR, HC32L110_UID_SIZE, uid, NULL))
+		{
+			printf("ERROR: Connection error.\n");
+			goto cleanup;
+		}
+		audit_uid(&audit, uid);
 	}
-	printf("The flashloader firmware has been successfully loaded into the RAM.\n");
-	sleep(10);
 
 	if (ts.opt_r)
 	{
-		uint16_t flash_size_inc;
-		uint32_t flash_addr_inc;
-
-		printf("Read Flash memory to %s.\n", ts.opt_r_arg);
-		for (flash_size_inc = 0, flash_addr_inc = flash_addr; flash_size_inc < flash_size; flash_addr_inc = flash_addr + flash_size_inc)
-		{
-			uint16_t flash_size_pkt = (flash_size - flash_size_inc > READ_PACKET_MAX_DATA_SIZE) ? READ_PACKET_MAX_DATA_SIZE : flash_size - flash_size_inc;
-			buf_cmd[1] = 5;
-			buf_cmd[2] = flash_addr_inc;
-			buf_cmd[3] = flash_addr_inc >> 8;
-			buf_cmd[4] = flash_addr_inc >> 16;
-			buf_cmd[5] = flash_addr_inc >> 24;
-			buf_cmd[6] = (uint8_t)flash_size_pkt;
-			buf_cmd[7] = (uint8_t)(flash_size_pkt >> 8);
-			buf_cmd[8] = sum8(buf_cmd, sizeof(buf_cmd) - 1);
-			sleep(1);
-			serial_write(rx_uart, buf_cmd, sizeof(buf_cmd));
-			uint8_t resp_buf[9 + READ_PACKET_MAX_DATA_SIZE] = { 0 };
-			if (serial_read_cmd_read_resp(rx_uart, 1000, resp_buf))
-			{
-				printf("ERROR: Connection error.\n");
-				goto cleanup;
-			}
-			flash_size_inc += flash_size_pkt;
-			fwrite(resp_buf + 8, flash_size_pkt, 1, file);
-			fflush(file);
+		if (read_region && read_region->writable)
+		{
+			printf("Read Flash memory to %s.\n", ts.opt_r_arg);
+		}
+		else
+		{
+			printf("Read %s at 0x%08X, 0x%X bytes, to %s.\n", read_region ? read_region->name : "memory", flash_addr, flash_size, ts.opt_r_arg);
 		}
+		audit_phase(&audit, "read", flash_size);
+		if (session_run(session, HC32BOOT_OP_READ, flash_addr, flash_size, data, "read"))
+		{
+			printf("ERROR: Connection error.\n");
+			goto cleanup;
+		}
+		fwrite(data, flash_size, 1, file);
+		printf("CRC-32 of the data read: 0x%08X.\n", crc32(CRC32_INIT, data, flash_size));
 		printf("Operation completed successfully.\n");
 	}
 	if (ts.opt_w)
 	{
-		uint16_t flash_size_inc;
-		uint32_t flash_addr_inc;
+		hc32boot_op_t op = { 0 };
+		hc32boot_image_t *images[] = { &prep.image };
+		uint32_t crc;
 
 		printf("Write Flash memory from %s.\n", ts.opt_w_arg);
-		for (flash_size_inc = 0, flash_addr_inc = flash_addr; flash_size_inc < flash_size; flash_addr_inc = flash_addr + flash_size_inc)
-		{
-			uint16_t flash_size_pkt = (flash_size - flash_size_inc > WRITE_PACKET_MAX_DATA_SIZE) ? WRITE_PACKET_MAX_DATA_SIZE : flash_size - flash_size_inc;
-			buf_cmd_write[2] = flash_addr_inc;
-			buf_cmd_write[3] = flash_addr_inc >> 8;
-			buf_cmd_write[4] = flash_addr_inc >> 16;
-			buf_cmd_write[5] = flash_addr_inc >> 24;
-			buf_cmd_write[6] = (uint8_t)flash_size_pkt;
-			buf_cmd_write[7] = (uint8_t)(flash_size_pkt >> 8);
-			fread(buf_cmd_write + 8, flash_size_pkt, 1, file);
-			buf_cmd_write[8 + flash_size_pkt] = sum8(buf_cmd_write, 8 + flash_size_pkt);
-			sleep(1);
-			serial_write(rx_uart, buf_cmd_write, 8 + flash_size_pkt + 1);
-			uint8_t resp_buf[9] = { 0 };
-			if (serial_read_cmd_resp(rx_uart, 1000, resp_buf))
+		audit_phase(&audit, "write", flash_size);
+		if (prepare_join(&prep))
+		{
+			printf("ERROR: Could not read file %s.\n", ts.opt_w_arg);
+			goto cleanup;
+		}
+		// the image as built, the patches differ from board to board
+		audit_image(&audit, prep.image.crc);
+		if (patch_apply(images, 1))
+		{
+			goto cleanup;
+		}
+		crc = prep.image.crc;
+		printf("Image CRC-32: 0x%08X.\n", crc);
+		if (ts.opt_D)
+		{
+			if (devcache_write(session, ts.opt_D_arg, &prep.image, ts.opt_v))
+			{
+				goto cleanup;
+			}
+		}
+		else
+		{
+			int res;
+
+			op.type = HC32BOOT_OP_WRITE;
+			op.image = &prep.image;
+			op.progress = progress_op;
+			progress_begin("write", prep.image.size);
+			res = hc32boot_submit(session, &op) ? -1 : hc32boot_wait(session);
+			progress_end(res);
+			if (res)
 			{
 				printf("ERROR: Connection error.\n");
 				goto cleanup;
 			}
-			flash_size_inc += flash_size_pkt;
+			if (ts.opt_v)
+			{
+				uint32_t crc_read;
+
+				printf("Verify Flash memory.\n");
+				audit_phase(&audit, "verify", flash_size);
+				if (session_run(session, HC32BOOT_OP_READ, flash_addr, flash_size, data, "verify"))
+				{
+					printf("ERROR: Connection error.\n");
+					goto cleanup;
+				}
+				crc_read = crc32(CRC32_INIT, data, flash_size);
+				if (crc_read != crc)
+				{
+					printf("ERROR: Verification failed, CRC-32 of the flash memory is 0x%08X.\n", crc_read);
+					goto cleanup;
+				}
+				printf("Verification passed.\n");
+			}
+		}
+		printf("Operation completed successfully.\n");
+	}
+	if (ts.opt_i)
+	{
+		probe_t probe;
+
+		audit_phase(&audit, "identify", 0);
+		if (probe_run(session, &probe))
+		{
+			printf("ERROR: Connection error.\n");
+			goto cleanup;
+		}
+		probe_print(&probe);
+	}
+	if (ts.opt_I)
+	{
+		audit_phase(&audit, "shell", 0);
+		if (shell_run(session, ts.opt_x) != EXIT_SUCCESS)
+		{
+			goto cleanup;
 		}
 	}
+	if (ts.opt_C)
+	{
+		static uint8_t ref[HC32L110_FLASH_SIZE];
+
+		printf("Compare Flash memory with %s.\n", ts.opt_C_arg);
+		audit_phase(&audit, "compare", flash_size);
+		if (fread(ref, flash_size, 1, file) != 1)
+		{
+			printf("ERROR: Could not read file %s.\n", ts.opt_C_arg);
+			goto cleanup;
+		}
+		if (compare(session, ref, data))
+		{
+			goto cleanup;
+		}
+		printf("Operation completed successfully.\n");
+	}
+	if (ts.opt_m)
+	{
+		uint32_t bytes = 0;
+		int cnt;
+
+		if (prepare_join(&prep))
+		{
+			printf("ERROR: Could not read the files of the manifest %s.\n", ts.opt_m_arg);
+			goto cleanup;
+		}
+		for (cnt = 0; cnt < manifest.region_cnt; cnt++)
+		{
+			audit_image(&audit, manifest.regions[cnt].image.crc);
+			bytes += manifest.regions[cnt].size;
+		}
+		audit_phase(&audit, "manifest", bytes);
+		if (manifest_run(&manifest, session, ""))
+		{
+			goto cleanup;
+		}
+		printf("Operation completed successfully.\n");
+	}
 	if (ts.opt_e)
 	{
 		printf("Erase Flash memory.\n");
-		if (flash_addr == 0)
+		audit_phase(&audit, "erase", 0);
+		if (session_run(session, HC32BOOT_OP_ERASE, flash_addr, 0, NULL, "erase"))
 		{
-			// Chip erase
-			buf_cmd[1] = 2;
+			printf("ERROR: Connection error.\n");
+			goto cleanup;
 		}
-		else
+	}
+
+run:
+	if (ts.opt_R)
+	{
+		hc32boot_op_t op = { 0 };
+		uint32_t boot_ms = 0;
+
+		printf("Please wait. The HL32L110 is reset into the application.\n");
+		audit_phase(&audit, "run", 0);
+		op.type = HC32BOOT_OP_RUN;
+		if (ts.opt_B)
 		{
-			// Sector erase
-			buf_cmd[1] = 3;
-			buf_cmd[2] = flash_addr;
-			buf_cmd[3] = flash_addr >> 8;
-			buf_cmd[4] = flash_addr >> 16;
-			buf_cmd[5] = flash_addr >> 24;
+			op.addr = (uint32_t)banner_ms;
+			op.size = (uint32_t)strlen(ts.opt_B_arg);
+			op.data = (uint8_t *)ts.opt_B_arg;
+			op.progress = run_progress;
+			op.arg = &boot_ms;
 		}
-		buf_cmd[8] = sum8(buf_cmd, sizeof(buf_cmd) - 1);
-		serial_write(rx_uart, buf_cmd, sizeof(buf_cmd));
-		uint8_t resp_buf[9] = { 0 };
-		if (serial_read_cmd_resp(rx_uart, 1000, resp_buf))
+		if (hc32boot_submit(session, &op) || hc32boot_wait(session))
 		{
-			printf("ERROR: Connection error.\n");
+			if (ts.opt_B)
+			{
+				printf("ERROR: The boot banner \"%s\" was not received within %d ms.\n", ts.opt_B_arg, banner_ms);
+			}
+			else
+			{
+				printf("ERROR: Connection error.\n");
+			}
 			goto cleanup;
 		}
+		if (ts.opt_B)
+		{
+			printf("The application has booted in %u ms.\n", boot_ms);
+		}
+		else
+		{
+			printf("The application has been started.\n");
+		}
 	}
+	status = EXIT_SUCCESS;
 
 cleanup:
-	serial_close(rx_uart);
+	audit_end(&audit, session, status == EXIT_SUCCESS ? 0 : -1);
+	prepare_join(&prep);
+	hc32boot_image_free(&prep.image);
+	manifest_free(&manifest);
+	hc32boot_close(session);
 	printf("Connection to the serial port closed.\n");
 
 	if (file)
@@ -919,5 +1475,5 @@ cleanup:
 	getchar();
 #endif
 
-	exit(EXIT_SUCCESS);
+	exit(status);
 }
@@ -0,0 +1,481 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stdlib.h>     /* malloc, strtoul */
+#include <stdio.h>      /* printf, fopen */
+#include <string.h>     /* strcmp, memset */
+#include <ctype.h>      /* isspace */
+#include <errno.h>      /* errno */
+#include "checksum.h"
+#include "hc32boot.h"
+#include "patch.h"
+#include "manifest.h"
+
+//--------------------------------------------
+#define MANIFEST_LINE_SIZE       512
+
+//--------------------------------------------
+static char *trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+	{
+		str++;
+	}
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+	{
+		*--end = '\0';
+	}
+	return str;
+}
+
+//--------------------------------------------
+static int set_key(manifest_region_t *region, const char *key, const char *value)
+{
+	if (!strcmp(key, "file"))
+	{
+		if (strlen(value) >= sizeof(region->file))
+		{
+			return -1;
+		}
+		strcpy(region->file, value);
+	}
+	else if (!strcmp(key, "addr"))
+	{
+		unsigned long addr;
+		char *endptr;
+
+		errno = 0;
+		addr = strtoul(value, &endptr, 16);
+		if (errno || endptr == value || *endptr != '\0' || addr >= HC32L110_FLASH_SIZE)
+		{
+			return -1;
+		}
+		region->addr = (uint32_t)addr;
+	}
+	else if (!strcmp(key, "erase"))
+	{
+		if (!strcmp(value, "none"))
+		{
+			region->erase = MANIFEST_ERASE_NONE;
+		}
+		else if (!strcmp(value, "sectors"))
+		{
+			region->erase = MANIFEST_ERASE_SECTORS;
+		}
+		else if (!strcmp(value, "chip"))
+		{
+			region->erase = MANIFEST_ERASE_CHIP;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	else if (!strcmp(key, "verify"))
+	{
+		if (strcmp(value, "yes") && strcmp(value, "no"))
+		{
+			return -1;
+		}
+		region->verify = !strcmp(value, "yes");
+	}
+	else if (!strcmp(key, "patch"))
+	{
+		return patch_add(value);
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int parse(manifest_t *manifest, const char *path)
+{
+	char buf[MANIFEST_LINE_SIZE];
+	manifest_region_t *region = NULL;
+	FILE *fp;
+	int line = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		printf("ERROR: Could not open the manifest %s.\n", path);
+		return -1;
+	}
+	while (fgets(buf, sizeof(buf), fp))
+	{
+		char *str = trim(buf);
+		char *value;
+
+		line++;
+		if (!*str || *str == '#' || *str == ';')
+		{
+			continue;
+		}
+		if (*str == '[')
+		{
+			char *end = strchr(str, ']');
+			if (!end || end[1] || end - str - 1 <= 0 || end - str - 1 >= (int)sizeof(region->name) ||
+				manifest->region_cnt == MANIFEST_MAX_REGIONS)
+			{
+				break;
+			}
+			*end = '\0';
+			region = &manifest->regions[manifest->region_cnt++];
+			strcpy(region->name, str + 1);
+			region->erase = MANIFEST_ERASE_SECTORS;
+			region->verify = 1;
+			continue;
+		}
+		if (!region || (value = strchr(str, '=')) == NULL)
+		{
+			break;
+		}
+		*value++ = '\0';
+		if (set_key(region, trim(str), trim(value)))
+		{
+			break;
+		}
+	}
+	if (!feof(fp))
+	{
+		printf("ERROR: The manifest %s is wrong in line %d.\n", path, line);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	if (!manifest->region_cnt)
+	{
+		printf("ERROR: The manifest %s has no regions.\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int compare_regions(const void *a, const void *b)
+{
+	const manifest_region_t *ra = a;
+	const manifest_region_t *rb = b;
+
+	return ra->addr < rb->addr ? -1 : ra->addr > rb->addr;
+}
+
+//--------------------------------------------
+int manifest_load(manifest_t *manifest, const char *path)
+{
+	int cnt;
+
+	memset(manifest, 0, sizeof(*manifest));
+	if (parse(manifest, path))
+	{
+		return -1;
+	}
+
+	for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+	{
+		manifest_region_t *region = &manifest->regions[cnt];
+		FILE *fp;
+		long length;
+
+		if (!region->file[0])
+		{
+			printf("ERROR: The region %s has no file.\n", region->name);
+			return -1;
+		}
+		if ((fp = fopen(region->file, "rb")) == NULL)
+		{
+			printf("ERROR: Could not open file %s.\n", region->file);
+			return -1;
+		}
+		fseek(fp, 0L, SEEK_END);
+		length = ftell(fp);
+		fclose(fp);
+		if (length <= 0 || region->addr + length > HC32L110_FLASH_SIZE)
+		{
+			printf("ERROR: File %s is empty or does not fit into the flash memory at 0x%04X.\n", region->file, region->addr);
+			return -1;
+		}
+		region->size = (uint32_t)length;
+		manifest->chip_erase |= region->erase == MANIFEST_ERASE_CHIP;
+	}
+
+	qsort(manifest->regions, manifest->region_cnt, sizeof(manifest->regions[0]), compare_regions);
+	for (cnt = 1; cnt < manifest->region_cnt; cnt++)
+	{
+		manifest_region_t *prev = &manifest->regions[cnt - 1];
+		if (prev->addr + prev->size > manifest->regions[cnt].addr)
+		{
+			printf("ERROR: The regions %s and %s overlap.\n", prev->name, manifest->regions[cnt].name);
+			return -1;
+		}
+	}
+
+	// sector runs: neighbouring regions sharing or touching sectors become one run
+	for (cnt = 0; !manifest->chip_erase && cnt < manifest->region_cnt; cnt++)
+	{
+		manifest_region_t *region = &manifest->regions[cnt];
+		uint32_t start = region->addr & ~(HC32L110_SECTOR_SIZE - 1);
+		uint32_t end = (region->addr + region->size + HC32L110_SECTOR_SIZE - 1) & ~(HC32L110_SECTOR_SIZE - 1);
+		int last = manifest->erase_cnt - 1;
+
+		if (region->erase != MANIFEST_ERASE_SECTORS)
+		{
+			continue;
+		}
+		if (last >= 0 && manifest->erase_addr[last] + manifest->erase_size[last] >= start)
+		{
+			manifest->erase_size[last] = end - manifest->erase_addr[last];
+			continue;
+		}
+		manifest->erase_addr[manifest->erase_cnt] = start;
+		manifest->erase_size[manifest->erase_cnt++] = end - start;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+int manifest_prepare(manifest_t *manifest)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+	{
+		manifest_region_t *region = &manifest->regions[cnt];
+		FILE *fp;
+		int res;
+
+		region->data = malloc(region->size);
+		if (!region->data || (fp = fopen(region->file, "rb")) == NULL)
+		{
+			return -1;
+		}
+		res = fread(region->data, region->size, 1, fp) != 1;
+		fclose(fp);
+		if (res)
+		{
+			return -1;
+		}
+		if (hc32boot_image_prepare(&region->image, region->addr, region->data, region->size, WRITE_PACKET_MAX_DATA_SIZE))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int submit(hc32boot_t *session, hc32boot_op_t *op, const char *prefix)
+{
+	if (hc32boot_submit(session, op))
+	{
+		printf("%sERROR: Connection error.\n", prefix);
+		return -1;
+	}
+	return 1;
+}
+
+//--------------------------------------------
+void manifest_start(manifest_exec_t *exec, const char *prefix)
+{
+	memset(exec, 0, sizeof(*exec));
+	exec->prefix = prefix;
+	exec->verify = -1;
+}
+
+//--------------------------------------------
+int manifest_next(manifest_t *manifest, manifest_exec_t *exec, hc32boot_t *session, int result)
+{
+	const char *prefix = exec->prefix;
+	hc32boot_op_t op;
+
+	if (result)
+	{
+		printf("%sERROR: Connection error.\n", prefix);
+		exec->verify = -1;
+	}
+	if (exec->verify >= 0)
+	{
+		manifest_region_t *region = &manifest->regions[exec->verify];
+		uint32_t crc = crc32(CRC32_INIT, exec->buf, region->size);
+
+		exec->verify = -1;
+		if (crc != region->image.crc)
+		{
+			printf("%sERROR: Verification of region %s failed, CRC-32 of the flash memory is 0x%08X.\n", prefix, region->name, crc);
+			result = -1;
+		}
+		else
+		{
+			printf("%sVerification of region %s passed.\n", prefix, region->name);
+		}
+	}
+	if (result)
+	{
+		free(exec->buf);
+		exec->buf = NULL;
+		return -1;
+	}
+
+	// the schedule: patches, chip erase, sector runs, writes, verifications
+	for (;;)
+	{
+		int pos = exec->pos++;
+
+		memset(&op, 0, sizeof(op));
+		if (pos == 0)
+		{
+			hc32boot_image_t *images[MANIFEST_MAX_REGIONS];
+			int cnt;
+
+			for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+			{
+				images[cnt] = &manifest->regions[cnt].image;
+			}
+			if (patch_apply(images, manifest->region_cnt))
+			{
+				return -1;
+			}
+			continue;
+		}
+		pos--;
+		if (pos < manifest->chip_erase)
+		{
+			printf("%sErase Flash memory.\n", prefix);
+			op.type = HC32BOOT_OP_ERASE;
+			return submit(session, &op, prefix);
+		}
+		pos -= manifest->chip_erase;
+		if (pos < manifest->erase_cnt)
+		{
+			printf("%sErase Flash memory 0x%04X-0x%04X.\n", prefix, manifest->erase_addr[pos], manifest->erase_addr[pos] + manifest->erase_size[pos] - 1);
+			op.type = HC32BOOT_OP_ERASE;
+			op.addr = manifest->erase_addr[pos];
+			op.size = manifest->erase_size[pos];
+			return submit(session, &op, prefix);
+		}
+		pos -= manifest->erase_cnt;
+		if (pos < manifest->region_cnt)
+		{
+			manifest_region_t *region = &manifest->regions[pos];
+
+			printf("%sWrite region %s from %s at 0x%04X, %u bytes, CRC-32 0x%08X.\n",
+				prefix, region->name, region->file, region->addr, region->size, region->image.crc);
+			op.type = HC32BOOT_OP_WRITE;
+			op.image = &region->image;
+			return submit(session, &op, prefix);
+		}
+		pos -= manifest->region_cnt;
+		if (pos < manifest->region_cnt)
+		{
+			manifest_region_t *region = &manifest->regions[pos];
+
+			if (!region->verify)
+			{
+				continue;
+			}
+			// per run, the station runs several manifests at once
+			if (!exec->buf && (exec->buf = malloc(HC32L110_FLASH_SIZE)) == NULL)
+			{
+				return -1;
+			}
+			op.type = HC32BOOT_OP_READ;
+			op.addr = region->addr;
+			op.size = region->size;
+			op.data = exec->buf;
+			if (submit(session, &op, prefix) < 0)
+			{
+				free(exec->buf);
+				exec->buf = NULL;
+				return -1;
+			}
+			exec->verify = pos;
+			return 1;
+		}
+		free(exec->buf);
+		exec->buf = NULL;
+		return 0;
+	}
+}
+
+//--------------------------------------------
+int manifest_run(manifest_t *manifest, hc32boot_t *session, const char *prefix)
+{
+	manifest_exec_t exec;
+	int res = 0;
+
+	manifest_start(&exec, prefix);
+	while ((res = manifest_next(manifest, &exec, session, res)) > 0)
+	{
+		res = hc32boot_wait(session);
+	}
+	return res;
+}
+
+//--------------------------------------------
+void manifest_plan(manifest_t *manifest, void (*plan)(void *arg, const char *phase, const hc32boot_op_t *op), void *arg)
+{
+	hc32boot_op_t op;
+	int cnt;
+
+	memset(&op, 0, sizeof(op));
+	op.type = HC32BOOT_OP_ERASE;
+	if (manifest->chip_erase)
+	{
+		plan(arg, "erase", &op);
+	}
+	for (cnt = 0; cnt < manifest->erase_cnt; cnt++)
+	{
+		op.addr = manifest->erase_addr[cnt];
+		op.size = manifest->erase_size[cnt];
+		plan(arg, "erase", &op);
+	}
+	for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+	{
+		memset(&op, 0, sizeof(op));
+		op.type = HC32BOOT_OP_WRITE;
+		op.image = &manifest->regions[cnt].image;
+		plan(arg, "write", &op);
+	}
+	for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+	{
+		if (!manifest->regions[cnt].verify)
+		{
+			continue;
+		}
+		memset(&op, 0, sizeof(op));
+		op.type = HC32BOOT_OP_READ;
+		op.addr = manifest->regions[cnt].addr;
+		op.size = manifest->regions[cnt].size;
+		plan(arg, "verify", &op);
+	}
+}
+
+//--------------------------------------------
+void manifest_free(manifest_t *manifest)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+	{
+		hc32boot_image_free(&manifest->regions[cnt].image);
+		free(manifest->regions[cnt].data);
+		manifest->regions[cnt].data = NULL;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef MANIFEST_H_
+#define MANIFEST_H_
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define MANIFEST_MAX_REGIONS     8
+
+//--------------------------------------------
+// region erase policy
+#define MANIFEST_ERASE_NONE      0
+#define MANIFEST_ERASE_SECTORS   1   // the sectors the region touches
+#define MANIFEST_ERASE_CHIP      2   // the whole flash, once, before all writes
+
+//--------------------------------------------
+typedef struct manifest_region
+{
+	char name[32];
+	char file[256];
+	uint32_t addr;
+	uint32_t size;
+	int erase;
+	int verify;
+	uint8_t *data;
+	hc32boot_image_t image;
+} manifest_region_t;
+
+//--------------------------------------------
+// the schedule: one chip erase or the coalesced sector runs, then all writes, then the verifications
+typedef struct manifest
+{
+	manifest_region_t regions[MANIFEST_MAX_REGIONS];   // sorted by address
+	int region_cnt;
+	int chip_erase;
+	uint32_t erase_addr[MANIFEST_MAX_REGIONS];
+	uint32_t erase_size[MANIFEST_MAX_REGIONS];
+	int erase_cnt;
+} manifest_t;
+
+//--------------------------------------------
+// manifest_run() in progress
+typedef struct manifest_exec
+{
+	const char *prefix;
+	int pos;                 // the next step of the schedule
+	int verify;              // the region read back by the operation running, -1 for none
+	uint8_t *buf;
+} manifest_exec_t;
+
+//--------------------------------------------
+// INI file, one section per region:
+//   [boot]
+//   file = boot.bin
+//   addr = 0          hexadecimal, default 0
+//   erase = sectors   sectors, chip or none, default sectors
+//   verify = yes      yes or no, default yes
+//   patch = 3f00=counter:sn.txt   as -P, can be repeated
+// Parses the manifest and plans the schedule, prints the errors.
+int manifest_load(manifest_t *manifest, const char *path);
+// reads the files and prepares the images
+int manifest_prepare(manifest_t *manifest);
+// runs the schedule on a session with the flashloader loaded, prefix is printed
+// before every line; without patches the manifest is only read, sessions can share it
+int manifest_run(manifest_t *manifest, hc32boot_t *session, const char *prefix);
+// manifest_run() one operation at a time, for a caller that drives many sessions:
+// manifest_next() is called after manifest_start() and then whenever the session
+// queue has run empty, with its result; it submits the next operation and returns
+// 1, 0 once the schedule is done, -1 on errors (printed)
+void manifest_start(manifest_exec_t *exec, const char *prefix);
+int manifest_next(manifest_t *manifest, manifest_exec_t *exec, hc32boot_t *session, int result);
+// calls plan for every operation manifest_run() would submit, in the same order (patches are not applied)
+void manifest_plan(manifest_t *manifest, void (*plan)(void *arg, const char *phase, const hc32boot_op_t *op), void *arg);
+void manifest_free(manifest_t *manifest);
+
+#endif /* MANIFEST_H_ */
@@ -0,0 +1,409 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include <stdlib.h>     /* strtoul */
+#include <stdio.h>      /* printf, snprintf */
+#include <string.h>     /* strncmp, strchr */
+#include <ctype.h>      /* isxdigit */
+#include <errno.h>      /* errno */
+#ifdef _WIN32
+#include <windows.h>    /* Windows stuff */
+#else
+#include <fcntl.h>      /* open */
+#include <unistd.h>     /* read, write, ftruncate */
+#include <sys/file.h>   /* flock */
+#endif
+#include "checksum.h"
+#include "hc32boot.h"
+#include "patch.h"
+
+//--------------------------------------------
+#define PATCH_BYTES              0
+#define PATCH_COUNTER            1
+#define PATCH_CRC32              2
+
+#define PATCH_PATH_SIZE          256
+#define PATCH_FMT_SIZE           32
+
+//--------------------------------------------
+typedef struct patch
+{
+	int type;
+	uint32_t addr;
+	uint8_t bytes[PATCH_MAX_SIZE];
+	uint32_t len;
+	char path[PATCH_PATH_SIZE];   // counter file
+	char fmt[PATCH_FMT_SIZE];     // counter format, empty for u32
+	uint32_t start;               // crc32 range
+	uint32_t end;
+} patch_t;
+
+//--------------------------------------------
+static patch_t patches[PATCH_MAX];
+static int patch_cnt;
+
+//--------------------------------------------
+static int parse_number(const char *str, int base, uint32_t max, uint32_t *value)
+{
+	unsigned long res;
+	char *endptr;
+
+	errno = 0;
+	res = strtoul(str, &endptr, base);
+	if (errno || endptr == str || *endptr != '\0' || res > max)
+	{
+		return -1;
+	}
+	*value = (uint32_t)res;
+	return 0;
+}
+
+//--------------------------------------------
+// exactly one %u conversion with an optional zero flag and width, %% is allowed
+static int check_fmt(const char *fmt)
+{
+	int conversions = 0;
+
+	for (; *fmt; fmt++)
+	{
+		if (*fmt != '%')
+		{
+			continue;
+		}
+		if (*++fmt == '%')
+		{
+			continue;
+		}
+		while (*fmt >= '0' && *fmt <= '9')
+		{
+			fmt++;
+		}
+		if (*fmt != 'u')
+		{
+			return -1;
+		}
+		conversions++;
+	}
+	return conversions == 1 ? 0 : -1;
+}
+
+//--------------------------------------------
+static int parse_value(patch_t *p, const char *type, const char *value)
+{
+	uint32_t number;
+	size_t len = strlen(value);
+
+	if (!strcmp(type, "u8") || !strcmp(type, "u16") || !strcmp(type, "u32"))
+	{
+		p->len = type[1] == '8' ? 1 : type[1] == '1' ? 2 : 4;
+		if (parse_number(value, 0, p->len == 4 ? 0xffffffff : (1ul << (8 * p->len)) - 1, &number))
+		{
+			return -1;
+		}
+		for (uint32_t cnt = 0; cnt < p->len; cnt++)
+		{
+			p->bytes[cnt] = (uint8_t)(number >> (8 * cnt));
+		}
+	}
+	else if (!strcmp(type, "hex"))
+	{
+		if (!len || len % 2 || len / 2 > PATCH_MAX_SIZE)
+		{
+			return -1;
+		}
+		for (p->len = 0; p->len < len / 2; p->len++)
+		{
+			char byte[3] = { value[2 * p->len], value[2 * p->len + 1], '\0' };
+			if (!isxdigit((unsigned char)byte[0]) || !isxdigit((unsigned char)byte[1]))
+			{
+				return -1;
+			}
+			p->bytes[p->len] = (uint8_t)strtoul(byte, NULL, 16);
+		}
+	}
+	else if (!strcmp(type, "str"))
+	{
+		if (!len || len > PATCH_MAX_SIZE)
+		{
+			return -1;
+		}
+		memcpy(p->bytes, value, len);
+		p->len = (uint32_t)len;
+	}
+	else if (!strcmp(type, "counter"))
+	{
+		const char *fmt = strrchr(value, ',');
+		size_t path_len = fmt ? (size_t)(fmt - value) : len;
+
+		if (!path_len || path_len >= sizeof(p->path))
+		{
+			return -1;
+		}
+		memcpy(p->path, value, path_len);
+		if (fmt && (strlen(fmt + 1) >= sizeof(p->fmt) || check_fmt(fmt + 1)))
+		{
+			return -1;
+		}
+		if (fmt)
+		{
+			strcpy(p->fmt, fmt + 1);
+		}
+		p->type = PATCH_COUNTER;
+	}
+	else if (!strcmp(type, "crc32"))
+	{
+		char range[32];
+		char *end;
+
+		if (len >= sizeof(range) || (end = strchr(strcpy(range, value), '-')) == NULL)
+		{
+			return -1;
+		}
+		*end++ = '\0';
+		if (parse_number(range, 16, HC32L110_FLASH_SIZE, &p->start) || parse_number(end, 16, HC32L110_FLASH_SIZE, &p->end) ||
+			p->start >= p->end)
+		{
+			return -1;
+		}
+		p->len = 4;
+		p->type = PATCH_CRC32;
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+int patch_add(const char *spec)
+{
+	char buf[PATCH_PATH_SIZE + PATCH_FMT_SIZE + 32];
+	char *value;
+	char *type;
+	patch_t *p;
+
+	if (patch_cnt == PATCH_MAX || strlen(spec) >= sizeof(buf))
+	{
+		return -1;
+	}
+	strcpy(buf, spec);
+	p = &patches[patch_cnt];
+	memset(p, 0, sizeof(*p));
+	if ((type = strchr(buf, '=')) == NULL || (value = strchr(type, ':')) == NULL)
+	{
+		return -1;
+	}
+	*type++ = '\0';
+	*value++ = '\0';
+	if (parse_number(buf, 16, HC32L110_FLASH_SIZE - 1, &p->addr) || parse_value(p, type, value))
+	{
+		return -1;
+	}
+	patch_cnt++;
+	return 0;
+}
+
+//--------------------------------------------
+int patch_add_file(const char *path)
+{
+	char line[PATCH_PATH_SIZE + PATCH_FMT_SIZE + 32];
+	FILE *file;
+	int res = 0;
+
+	if ((file = fopen(path, "r")) == NULL)
+	{
+		return -1;
+	}
+	while (!res && fgets(line, sizeof(line), file))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] && line[0] != '#')
+		{
+			res = patch_add(line);
+		}
+	}
+	fclose(file);
+	return res;
+}
+
+//--------------------------------------------
+int patch_count(void)
+{
+	return patch_cnt;
+}
+
+//--------------------------------------------
+// Takes the current value and stores the next one under an exclusive lock,
+// a number is used once even if the programming fails later.
+static int counter_next(const char *path, uint32_t *value)
+{
+	char buf[16] = { 0 };
+	int len;
+	int res = -1;
+#ifdef _WIN32
+	HANDLE file;
+	OVERLAPPED ov = { 0 };
+	DWORD cnt;
+
+	file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return -1;
+	}
+	if (LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &ov))
+	{
+		if (ReadFile(file, buf, sizeof(buf) - 1, &cnt, NULL))
+		{
+			buf[cnt] = '\0';
+			buf[strcspn(buf, "\r\n")] = '\0';
+			*value = 0;
+			if (!buf[0] || !parse_number(buf, 10, 0xfffffffe, value))
+			{
+				len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)*value + 1);
+				if (SetFilePointer(file, 0, NULL, FILE_BEGIN) == 0 && SetEndOfFile(file) &&
+					WriteFile(file, buf, len, &cnt, NULL) && cnt == (DWORD)len)
+				{
+					res = 0;
+				}
+			}
+		}
+		UnlockFileEx(file, 0, MAXDWORD, MAXDWORD, &ov);
+	}
+	CloseHandle(file);
+#else
+	int fd;
+	ssize_t cnt;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (!flock(fd, LOCK_EX))
+	{
+		if ((cnt = read(fd, buf, sizeof(buf) - 1)) >= 0)
+		{
+			buf[cnt] = '\0';
+			buf[strcspn(buf, "\r\n")] = '\0';
+			*value = 0;
+			if (!buf[0] || !parse_number(buf, 10, 0xfffffffe, value))
+			{
+				len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)*value + 1);
+				if (!ftruncate(fd, 0) && pwrite(fd, buf, len, 0) == len)
+				{
+					res = 0;
+				}
+			}
+		}
+		flock(fd, LOCK_UN);
+	}
+	close(fd);
+#endif
+	return res;
+}
+
+//--------------------------------------------
+static hc32boot_image_t *find_image(hc32boot_image_t *images[], int image_cnt, uint32_t addr, uint32_t len)
+{
+	for (int cnt = 0; cnt < image_cnt; cnt++)
+	{
+		if (addr >= images[cnt]->addr && addr + len <= images[cnt]->addr + images[cnt]->size)
+		{
+			return images[cnt];
+		}
+	}
+	return NULL;
+}
+
+//--------------------------------------------
+int patch_apply(hc32boot_image_t *images[], int image_cnt)
+{
+	hc32boot_image_t *image;
+	int pass;
+	int cnt;
+
+	// the CRC fixups cover the result of all the other patches
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (cnt = 0; cnt < patch_cnt; cnt++)
+		{
+			patch_t *p = &patches[cnt];
+			uint32_t value;
+
+			if ((p->type == PATCH_CRC32) != pass)
+			{
+				continue;
+			}
+			if (p->type == PATCH_COUNTER)
+			{
+				value = 0;
+				if (counter_next(p->path, &value))
+				{
+					printf("ERROR: Could not update the counter file %s.\n", p->path);
+					return -1;
+				}
+				if (p->fmt[0])
+				{
+					char text[PATCH_MAX_SIZE + 1];
+					int len = snprintf(text, sizeof(text), p->fmt, (unsigned)value);
+					if (len <= 0 || len > PATCH_MAX_SIZE)
+					{
+						printf("ERROR: The counter %s does not fit into %d bytes.\n", p->path, PATCH_MAX_SIZE);
+						return -1;
+					}
+					memcpy(p->bytes, text, len);
+					p->len = (uint32_t)len;
+				}
+				else
+				{
+					p->bytes[0] = (uint8_t)value;
+					p->bytes[1] = (uint8_t)(value >> 8);
+					p->bytes[2] = (uint8_t)(value >> 16);
+					p->bytes[3] = (uint8_t)(value >> 24);
+					p->len = 4;
+				}
+				printf("Patch 0x%04X: counter %s = %lu.\n", p->addr, p->path, (unsigned long)value);
+			}
+			else if (p->type == PATCH_CRC32)
+			{
+				static uint8_t buf[HC32L110_FLASH_SIZE];
+				image = find_image(images, image_cnt, p->start, p->end - p->start);
+				if (!image || hc32boot_image_get(image, p->start, buf, p->end - p->start))
+				{
+					printf("ERROR: The CRC-32 range 0x%04X-0x%04X is outside of the image.\n", p->start, p->end);
+					return -1;
+				}
+				value = crc32(CRC32_INIT, buf, p->end - p->start);
+				p->bytes[0] = (uint8_t)value;
+				p->bytes[1] = (uint8_t)(value >> 8);
+				p->bytes[2] = (uint8_t)(value >> 16);
+				p->bytes[3] = (uint8_t)(value >> 24);
+				printf("Patch 0x%04X: CRC-32 of 0x%04X-0x%04X = 0x%08X.\n", p->addr, p->start, p->end, value);
+			}
+			else
+			{
+				printf("Patch 0x%04X: %u bytes.\n", p->addr, p->len);
+			}
+			image = find_image(images, image_cnt, p->addr, p->len);
+			if (!image || hc32boot_image_patch(image, p->addr, p->bytes, p->len))
+			{
+				printf("ERROR: The patch at 0x%04X is outside of the image.\n", p->addr);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef PATCH_H_
+#define PATCH_H_
+
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define PATCH_MAX                16
+#define PATCH_MAX_SIZE           64
+
+//--------------------------------------------
+// Per-device patches, <addr>=<value> with the address in hexadecimal notation:
+//   u8:<n>, u16:<n>, u32:<n>  little-endian number
+//   hex:<bytes>               e.g. hex:0123abcd
+//   str:<text>                ASCII, no terminating zero
+//   counter:<file>[,<fmt>]    number taken from the file, which is incremented (locked, so
+//                             stations can share it); u32 by default or printf-like ASCII, e.g. SN%06u
+//   crc32:<start>-<end>       CRC-32 (LE32) of the final image from start to end (exclusive),
+//                             applied after all other patches
+int patch_add(const char *spec);
+// one patch per line, empty lines and lines starting with # are skipped
+int patch_add_file(const char *path);
+int patch_count(void);
+// patches the frames (hc32boot_image_patch) of the image that holds the patch, prints a line per patch
+int patch_apply(hc32boot_image_t *images[], int image_cnt);
+
+#endif /* PATCH_H_ */
@@ -0,0 +1,130 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdio.h>      /* printf */
+#include <string.h>     /* strcmp */
+#include "hc32boot.h"
+#include "plan.h"
+
+//--------------------------------------------
+typedef struct phase
+{
+	const char *name;
+	uint32_t frames;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint64_t busy_us;
+	uint64_t time_us;
+} phase_t;
+
+//--------------------------------------------
+static hc32boot_config_t plan_cfg;
+static hc32boot_link_t plan_link;
+static phase_t phases[PLAN_MAX_PHASES];
+static int phase_cnt;
+
+//--------------------------------------------
+static void on_step(void *arg, const hc32boot_plan_step_t *step)
+{
+	phase_t *phase = arg;
+
+	if (step->cmd >= 0)
+	{
+		printf("  %-10s %-16s cmd %2d 0x%06X %5u  tx %5u  rx %5u  %6d baud %9.1f ms\n", phase->name, step->what,
+			step->cmd, step->addr, step->size, step->tx_len, step->rx_len, step->baudrate, step->time_us / 1000.0);
+	}
+	else if (step->tx_len || step->rx_len)
+	{
+		printf("  %-10s %-16s        0x%06X %5u  tx %5u  rx %5u  %6d baud %9.1f ms\n", phase->name, step->what,
+			step->addr, step->size, step->tx_len, step->rx_len, step->baudrate, step->time_us / 1000.0);
+	}
+	else
+	{
+		printf("  %-10s %-16s %68.1f ms\n", phase->name, step->what, step->time_us / 1000.0);
+	}
+	phase->frames += step->tx_len || step->rx_len;
+	phase->tx_bytes += step->tx_len;
+	phase->rx_bytes += step->rx_len;
+	phase->busy_us += step->busy_us;
+	phase->time_us += step->time_us;
+}
+
+//--------------------------------------------
+void plan_begin(const hc32boot_config_t *cfg, uint32_t latency_us)
+{
+	plan_cfg = *cfg;
+	hc32boot_link_estimate(cfg, latency_us, &plan_link);
+	phase_cnt = 0;
+	printf("Plan at %d baud%s, link latency %.1f ms, packet size %u bytes:\n", cfg->baudrate,
+		cfg->boot_baudrate ? " (flashloader upload at the -f rate)" : "", latency_us / 1000.0, plan_link.pkt_size);
+}
+
+//--------------------------------------------
+int plan_op(const char *phase, const hc32boot_op_t *op)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < phase_cnt && strcmp(phases[cnt].name, phase); cnt++);
+	if (cnt == phase_cnt)
+	{
+		if (phase_cnt == PLAN_MAX_PHASES)
+		{
+			return -1;
+		}
+		memset(&phases[phase_cnt], 0, sizeof(phases[0]));
+		phases[phase_cnt++].name = phase;
+	}
+	return hc32boot_plan(&plan_cfg, &plan_link, op, on_step, &phases[cnt]);
+}
+
+//--------------------------------------------
+void plan_manifest_op(void *arg, const char *phase, const hc32boot_op_t *op)
+{
+	(void)arg;
+	plan_op(phase, op);
+}
+
+//--------------------------------------------
+uint32_t plan_end(void)
+{
+	phase_t total = { "total", 0, 0, 0, 0, 0 };
+	int cnt;
+
+	printf("\n  %-10s %7s %9s %9s %11s %11s %11s\n", "phase", "frames", "tx bytes", "rx bytes", "wire ms", "busy ms", "time ms");
+	for (cnt = 0; cnt <= phase_cnt; cnt++)
+	{
+		phase_t *phase = cnt < phase_cnt ? &phases[cnt] : &total;
+
+		if (cnt == phase_cnt)
+		{
+			printf("  %.76s\n", "----------------------------------------------------------------------------");
+		}
+		// what is neither busy time nor latency is the time on the wire
+		printf("  %-10s %7u %9llu %9llu %11.1f %11.1f %11.1f\n", phase->name, phase->frames,
+			(unsigned long long)phase->tx_bytes, (unsigned long long)phase->rx_bytes,
+			(phase->time_us - phase->busy_us - (uint64_t)phase->frames * plan_link.latency_us) / 1000.0,
+			phase->busy_us / 1000.0, phase->time_us / 1000.0);
+		if (phase == &total)
+		{
+			break;
+		}
+		total.frames += phase->frames;
+		total.tx_bytes += phase->tx_bytes;
+		total.rx_bytes += phase->rx_bytes;
+		total.busy_us += phase->busy_us;
+		total.time_us += phase->time_us;
+	}
+	return (uint32_t)(total.time_us / 1000);
+}
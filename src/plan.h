@@ -0,0 +1,36 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef PLAN_H_
+#define PLAN_H_
+
+#include <stdint.h>     /* uint32_t */
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define PLAN_MAX_PHASES          16
+
+//--------------------------------------------
+// Dry run (-n): prints every frame and wait the operations would issue, then
+// the bytes on the wire and the estimated time per phase. The link is the one
+// a calibration would choose for the given round-trip latency.
+void plan_begin(const hc32boot_config_t *cfg, uint32_t latency_us);
+// phase: the name the step is counted under, e.g. "write"
+int plan_op(const char *phase, const hc32boot_op_t *op);
+// for manifest_plan()
+void plan_manifest_op(void *arg, const char *phase, const hc32boot_op_t *op);
+// prints the summary, returns the estimated total time in ms
+uint32_t plan_end(void);
+
+#endif /* PLAN_H_ */
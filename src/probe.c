@@ -0,0 +1,93 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset */
+#ifdef _WIN32
+#include <windows.h>    /* Windows stuff */
+#include "gettimeofday.h"
+#else
+#include <sys/time.h>   /* gettimeofday */
+#endif
+#include "hc32boot.h"
+#include "probe.h"
+
+//--------------------------------------------
+static uint64_t get_time_ms(void)
+{
+	struct timeval current_time;
+
+	gettimeofday(&current_time, NULL);
+	return (uint64_t)current_time.tv_sec * 1000 + current_time.tv_usec / 1000;
+}
+
+//--------------------------------------------
+int probe_run(hc32boot_t *session, probe_t *probe)
+{
+	uint8_t sums[PROBE_SECTOR_CNT * 2];
+	hc32boot_op_t op;
+	uint64_t start_ms = get_time_ms();
+	int cnt;
+
+	memset(probe, 0, sizeof(*probe));
+
+	// both operations are queued and run in one wait
+	memset(&op, 0, sizeof(op));
+	op.type = HC32BOOT_OP_READ;
+	op.addr = HC32L110_UID_ADDR;
+	op.size = HC32L110_UID_SIZE;
+	op.data = probe->uid;
+	if (hc32boot_submit(session, &op))
+	{
+		return -1;
+	}
+	memset(&op, 0, sizeof(op));
+	op.type = HC32BOOT_OP_CHECKSUM;
+	op.addr = 0;
+	op.size = HC32L110_FLASH_SIZE;
+	op.data = sums;
+	if (hc32boot_submit(session, &op) || hc32boot_wait(session))
+	{
+		return -1;
+	}
+
+	for (cnt = 0; cnt < PROBE_SECTOR_CNT; cnt++)
+	{
+		probe->sector_sum[cnt] = (uint16_t)(sums[cnt * 2] | sums[cnt * 2 + 1] << 8);
+		probe->sum += probe->sector_sum[cnt];
+	}
+	probe->flashloader_crc = hc32boot_flashloader_crc();
+	probe->time_ms = (uint32_t)(get_time_ms() - start_ms);
+	return 0;
+}
+
+//--------------------------------------------
+void probe_print(const probe_t *probe)
+{
+	int cnt;
+
+	printf("{\"uid\":\"");
+	for (cnt = 0; cnt < HC32L110_UID_SIZE; cnt++)
+	{
+		printf("%02x", probe->uid[cnt]);
+	}
+	printf("\",\"flashloader_crc\":\"%08x\",\"flash_size\":%d,\"sector_size\":%d,\"sum16\":%u,\"sector_sum16\":[",
+		probe->flashloader_crc, HC32L110_FLASH_SIZE, HC32L110_SECTOR_SIZE, probe->sum);
+	for (cnt = 0; cnt < PROBE_SECTOR_CNT; cnt++)
+	{
+		printf("%s%u", cnt ? "," : "", probe->sector_sum[cnt]);
+	}
+	printf("],\"time_ms\":%u}\n", probe->time_ms);
+}
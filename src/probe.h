@@ -0,0 +1,40 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef PROBE_H_
+#define PROBE_H_
+
+#include <stdint.h>     /* uint8_t ... uint32_t */
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define PROBE_SECTOR_CNT         (HC32L110_FLASH_SIZE / HC32L110_SECTOR_SIZE)
+
+//--------------------------------------------
+typedef struct probe
+{
+	uint8_t uid[HC32L110_UID_SIZE];
+	uint16_t sector_sum[PROBE_SECTOR_CNT];   // 16-bit sums computed by the flashloader
+	uint16_t sum;                            // of the whole flash
+	uint32_t flashloader_crc;
+	uint32_t time_ms;
+} probe_t;
+
+//--------------------------------------------
+// Reads the UID and lets the flashloader sum every sector, no flash data crosses the link.
+int probe_run(hc32boot_t *session, probe_t *probe);
+// one JSON line
+void probe_print(const probe_t *probe);
+
+#endif /* PROBE_H_ */
@@ -0,0 +1,178 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdio.h>      /* snprintf */
+#ifdef _WIN32
+#include <io.h>         /* _write, _isatty */
+#include "gettimeofday.h"
+#define write _write
+#define isatty _isatty
+#else
+#include <unistd.h>     /* write, isatty */
+#include <signal.h>     /* signal, SIGPIPE */
+#include <sys/time.h>   /* gettimeofday */
+#endif
+#include "progress.h"
+
+//--------------------------------------------
+#define PROGRESS_BAR_WIDTH       30
+
+//--------------------------------------------
+static int out_fd = -1;
+static int out_tty;
+static const char *cur_phase;
+static uint32_t cur_total;
+static uint32_t cur_done;
+static uint64_t start_us;
+static uint64_t last_us;
+static uint32_t last_done;
+
+//--------------------------------------------
+static uint64_t get_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//--------------------------------------------
+static void emit(const char *buf, int len)
+{
+	if (len > 0 && write(out_fd, buf, (unsigned)len) < 0)
+	{
+		// the reader has gone, the programming goes on
+		out_fd = -1;
+	}
+}
+
+//--------------------------------------------
+static void bar(uint64_t now_us, double avg, double eta, const char *end)
+{
+	char buf[160];
+	char fill[PROGRESS_BAR_WIDTH + 1];
+	uint32_t filled = cur_total ? (uint32_t)((uint64_t)cur_done * PROGRESS_BAR_WIDTH / cur_total) : 0;
+	uint32_t cnt;
+
+	for (cnt = 0; cnt < PROGRESS_BAR_WIDTH; cnt++)
+	{
+		fill[cnt] = cnt < filled ? '#' : '.';
+	}
+	fill[PROGRESS_BAR_WIDTH] = '\0';
+	if (*end)
+	{
+		emit(buf, snprintf(buf, sizeof(buf), "\r%-8s [%s] %3u%% %7.1f kB/s %5.1f s%s",
+			cur_phase, fill, cur_total ? (unsigned)((uint64_t)cur_done * 100 / cur_total) : 100, avg / 1000,
+			(now_us - start_us) / 1e6, end));
+		return;
+	}
+	emit(buf, snprintf(buf, sizeof(buf), "\r%-8s [%s] %3u%% %7.1f kB/s ETA %5.1f s",
+		cur_phase, fill, cur_total ? (unsigned)((uint64_t)cur_done * 100 / cur_total) : 0, avg / 1000, eta));
+}
+
+//--------------------------------------------
+void progress_open(int fd)
+{
+	out_fd = fd;
+	out_tty = isatty(fd);
+#ifndef _WIN32
+	// a closed pipe makes write() fail with EPIPE instead of killing the tool
+	signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+//--------------------------------------------
+void progress_begin(const char *phase, uint32_t total)
+{
+	char buf[128];
+
+	cur_phase = phase;
+	cur_total = total;
+	cur_done = 0;
+	last_done = 0;
+	start_us = last_us = get_time_us();
+	if (out_fd < 0 || out_tty)
+	{
+		return;
+	}
+	emit(buf, snprintf(buf, sizeof(buf), "{\"event\":\"start\",\"phase\":\"%s\",\"total\":%u}\n", phase, total));
+}
+
+//--------------------------------------------
+void progress_update(uint32_t done)
+{
+	char buf[256];
+	uint64_t now_us;
+	double rate;
+	double avg;
+	double eta;
+
+	cur_done = done;
+	if (out_fd < 0)
+	{
+		return;
+	}
+	now_us = get_time_us();
+	if (now_us - last_us < PROGRESS_INTERVAL_MS * 1000ULL)
+	{
+		return;
+	}
+	rate = (done - last_done) * 1e6 / (now_us - last_us);
+	avg = done * 1e6 / (now_us - start_us);
+	eta = avg > 0 && cur_total > done ? (cur_total - done) / avg : 0;
+	last_us = now_us;
+	last_done = done;
+	if (out_tty)
+	{
+		bar(now_us, avg, eta, "");
+		return;
+	}
+	emit(buf, snprintf(buf, sizeof(buf),
+		"{\"event\":\"progress\",\"phase\":\"%s\",\"done\":%u,\"total\":%u,\"bytes_per_s\":%.0f,\"avg_bytes_per_s\":%.0f,\"eta_s\":%.2f}\n",
+		cur_phase, done, cur_total, rate, avg, eta));
+}
+
+//--------------------------------------------
+void progress_end(int result)
+{
+	char buf[256];
+	uint64_t now_us;
+	double seconds;
+	double avg;
+
+	if (out_fd < 0)
+	{
+		return;
+	}
+	now_us = get_time_us();
+	seconds = (now_us - start_us) / 1e6;
+	avg = seconds > 0 ? cur_done / seconds : 0;
+	if (out_tty)
+	{
+		bar(now_us, avg, 0, result ? " failed\n" : "\n");
+		return;
+	}
+	emit(buf, snprintf(buf, sizeof(buf),
+		"{\"event\":\"end\",\"phase\":\"%s\",\"result\":\"%s\",\"done\":%u,\"total\":%u,\"seconds\":%.3f,\"avg_bytes_per_s\":%.0f}\n",
+		cur_phase, result ? "error" : "ok", cur_done, cur_total, seconds, avg));
+}
+
+//--------------------------------------------
+void progress_op(void *arg, const hc32boot_op_t *op, uint32_t done)
+{
+	(void)arg;
+	(void)op;
+	progress_update(done);
+}
@@ -0,0 +1,40 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef PROGRESS_H_
+#define PROGRESS_H_
+
+#include <stdint.h>     /* uint32_t */
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define PROGRESS_INTERVAL_MS     200    // at most one event per phase in this time
+
+//--------------------------------------------
+// Progress events of the long phases (erase, write, read, verify, compare)
+// on a file descriptor, JSON lines:
+//   {"event":"start","phase":"write","total":16384}
+//   {"event":"progress","phase":"write","done":4096,"total":16384,"bytes_per_s":...,"avg_bytes_per_s":...,"eta_s":...}
+//   {"event":"end","phase":"write","result":"ok","done":16384,"total":16384,"seconds":...,"avg_bytes_per_s":...}
+// or a progress bar if the descriptor is a terminal. Nothing is written
+// before progress_open(). The per-frame update only reads the clock, the
+// events are rate limited to PROGRESS_INTERVAL_MS.
+void progress_open(int fd);
+void progress_begin(const char *phase, uint32_t total);
+void progress_update(uint32_t done);
+void progress_end(int result);
+// hc32boot_op_t progress callback, calls progress_update()
+void progress_op(void *arg, const hc32boot_op_t *op, uint32_t done);
+
+#endif /* PROGRESS_H_ */
@@ -25,13 +25,15 @@
 #include <dirent.h>     /* struct dirent */
 #include <sys/stat.h>   /* lstat, S_ISLNK */
 #include <libgen.h>     /* basename */
-#include <string.h>     /* memcpy, memset */
+#include <string.h>     /* memcpy, memset, strncmp */
+#include <limits.h>     /* PATH_MAX */
+#ifdef __linux__
+#include <linux/serial.h> /* struct serial_struct, ASYNC_LOW_LATENCY */
+#endif
 #endif
 #include <assert.h>     /* assert */
 #include <stdio.h>      /* sprintf */
-#if SERIAL_ENUM
-#include "list_lstbox.h"
-#endif
+#include <stdlib.h>     /* strtoul */
 #include "serial.h"
 
 #ifndef DPRINTF
@@ -135,6 +137,26 @@ int serial_open(const char *name, const port_settings_t *set, HANDLE *dev)
 	return 0;
 }
 
+//--------------------------------------------
+int serial_set_baudrate(HANDLE dev, int baudrate)
+{
+	DCB dcb = { 0 };
+
+	dcb.DCBlength = sizeof(DCB);
+	if (!FlushFileBuffers(dev) || !GetCommState(dev, &dcb))
+	{
+		print_error_serial(__LINE__);
+		return -1;
+	}
+	dcb.BaudRate = baudrate;
+	if (!SetCommState(dev, &dcb))
+	{
+		print_error_serial(__LINE__);
+		return -1;
+	}
+	return 0;
+}
+
 //--------------------------------------------
 void serial_flush(HANDLE dev)
 {
@@ -236,9 +258,8 @@ void serial_clr_dtr(HANDLE dev)
 	EscapeCommFunction(dev, CLRDTR);
 }
 
-#if SERIAL_ENUM
 //--------------------------------------------
-void serial_enum(list_lstbox_t **list)
+void serial_enum(serial_enum_cb_t cb, void *arg)
 {
 	HANDLE dev;
 	char devname[MAX_SERDEVNAME + 7];
@@ -262,12 +283,100 @@ void serial_enum(list_lstbox_t **list)
 			continue;
 		}
 		serial_close(dev);
-		list_lstbox_add(list, devname, scrname);
+		cb(arg, devname, scrname);
 	}
 }
+
+//--------------------------------------------
+int serial_port_info(const char *devname, serial_port_info_t *info)
+{
+	(void)devname;
+	(void)info;
+	return -1;
+}
+
+#else
+//--------------------------------------------
+static int get_baudrate_flag(int baudrate)
+{
+	switch (baudrate)
+	{
+#if defined(__APPLE__) && defined(__MACH__)
+	// I don't know if this works for macOS or not
+	case 9600:
+	case 19200:
+	case 38400:
+	case 57600:
+	case 115200:
+	case 230400:
+	case 460800:
+	case 921600:
+	case 1000000:
+	case 2000000:
+		return baudrate;
+#else
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+	case 230400:
+		return B230400;
+	case 460800:
+		return B460800;
+	case 921600:
+		return B921600;
+	case 1000000:
+		return B1000000;
+	case 2000000:
+		return B2000000;
 #endif
+	default:
+		return -1;
+	}
+}
 
+//--------------------------------------------
+// USB-UART bridges hold received bytes back until their latency timer expires
+// (16 ms by default on FTDI), which costs more than the data itself with a
+// stop-and-wait protocol. Both settings need suitable permissions and are
+// silently skipped if the driver does not support them.
+static void serial_low_latency(const char *name, HANDLE dev)
+{
+#ifdef __linux__
+	struct serial_struct ss;
+	char path[PATH_MAX];
+	char sysname[PATH_MAX + 64];
+	FILE *fp;
+
+	if (!ioctl(dev, TIOCGSERIAL, &ss))
+	{
+		ss.flags |= ASYNC_LOW_LATENCY;
+		ioctl(dev, TIOCSSERIAL, &ss);
+	}
+	// the name may be a symbolic link such as /dev/serial/by-id/...
+	if (!realpath(name, path))
+	{
+		return;
+	}
+	sprintf(sysname, "/sys/class/tty/%s/device/latency_timer", basename(path));
+	fp = fopen(sysname, "w");
+	if (fp)
+	{
+		fputs("1", fp);
+		fclose(fp);
+	}
 #else
+	(void)name;
+	(void)dev;
+#endif
+}
+
 //--------------------------------------------
 int serial_open(const char *name, const port_settings_t *set, HANDLE *dev)
 {
@@ -286,30 +395,9 @@ int serial_open(const char *name, const port_settings_t *set, HANDLE *dev)
 		return -1;
 	}
 
-	switch (set->baudrate)
+	baudrate_flag = get_baudrate_flag(set->baudrate);
+	if (baudrate_flag < 0)
 	{
-#if defined(__APPLE__) && defined(__MACH__)
-	// I don't know if this works for macOS or not
-	case 921600:
-	case 1000000:
-	case 2000000:
-		baudrate_flag = set->baudrate;
-		break;
-#else
-	case 9600:
-		baudrate_flag = B9600;
-		break;
-	case 921600:
-		baudrate_flag = B921600;
-		break;
-	case 1000000:
-		baudrate_flag = B1000000;
-		break;
-	case 2000000:
-		baudrate_flag = B2000000;
-		break;
-#endif
-	default:
 		print_error_serial(__LINE__);
 		return -1;
 	}
@@ -333,11 +421,39 @@ int serial_open(const char *name, const port_settings_t *set, HANDLE *dev)
 		return -1;
 	}
 
+	if (set->low_latency)
+	{
+		serial_low_latency(name, *dev);
+	}
+
 	serial_flush(*dev);
 
 	return 0;
 }
 
+//--------------------------------------------
+int serial_set_baudrate(HANDLE dev, int baudrate)
+{
+	int baudrate_flag;
+	struct termios tio;
+
+	baudrate_flag = get_baudrate_flag(baudrate);
+	if (baudrate_flag < 0 || tcgetattr(dev, &tio) < 0)
+	{
+		print_error_serial(__LINE__);
+		return -1;
+	}
+	cfsetispeed(&tio, baudrate_flag);
+	cfsetospeed(&tio, baudrate_flag);
+	// the data already written is sent at the old baud rate
+	if (tcsetattr(dev, TCSADRAIN, &tio) < 0)
+	{
+		print_error_serial(__LINE__);
+		return -1;
+	}
+	return 0;
+}
+
 //--------------------------------------------
 void serial_flush(HANDLE dev)
 {
@@ -467,9 +583,9 @@ void serial_clr_dtr(HANDLE dev)
 	ioctl(dev, TIOCMSET, &status);
 }
 
-#if SERIAL_ENUM
 //--------------------------------------------
-void serial_enum(list_lstbox_t **list)
+// USB and other pluggable serial ports: a tty with a device that is not a built-in 8250 UART
+void serial_enum(serial_enum_cb_t cb, void *arg)
 {
 	int res;
 	struct dirent **namelist;
@@ -500,7 +616,7 @@ void serial_enum(list_lstbox_t **list)
 							memset(devicedir, 0, sizeof(devicedir));
 							strcpy(devicedir, devdir);
 							strcat(devicedir, namelist[res]->d_name);
-							list_lstbox_add(list, devicedir, devicedir);
+							cb(arg, devicedir, devicedir);
 						}
 					}
 				}
@@ -510,5 +626,197 @@ void serial_enum(list_lstbox_t **list)
 		free(namelist);
 	}
 }
+
+//--------------------------------------------
+static int read_attr(const char *dir, const char *attr, char *buf, size_t size)
+{
+	char path[PATH_MAX + 32];
+	FILE *fp;
+	int res = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	if ((fp = fopen(path, "r")) != NULL)
+	{
+		if (fgets(buf, (int)size, fp))
+		{
+			buf[strcspn(buf, "\r\n")] = '\0';
+			res = 0;
+		}
+		fclose(fp);
+	}
+	return res;
+}
+
+//--------------------------------------------
+int serial_port_info(const char *devname, serial_port_info_t *info)
+{
+	char path[PATH_MAX];
+	char sysname[PATH_MAX + 64];
+	char dir[PATH_MAX];
+	char value[16];
+	char *slash;
+
+	memset(info, 0, sizeof(*info));
+	if (strlen(devname) >= sizeof(info->devname) || !realpath(devname, path))
+	{
+		return -1;
+	}
+	strcpy(info->devname, devname);
+	snprintf(sysname, sizeof(sysname), "/sys/class/tty/%s/device", basename(path));
+	if (!realpath(sysname, dir))
+	{
+		return -1;
+	}
+	// the tty hangs below the USB interface, the USB device is the first parent with idVendor
+	while (read_attr(dir, "idVendor", value, sizeof(value)))
+	{
+		if ((slash = strrchr(dir, '/')) == NULL || slash == dir)
+		{
+			return -1;
+		}
+		*slash = '\0';
+	}
+	info->vid = (unsigned int)strtoul(value, NULL, 16);
+	if (read_attr(dir, "idProduct", value, sizeof(value)))
+	{
+		return -1;
+	}
+	info->pid = (unsigned int)strtoul(value, NULL, 16);
+	read_attr(dir, "serial", info->serial, sizeof(info->serial));
+	snprintf(info->usb_path, sizeof(info->usb_path), "%s", strrchr(dir, '/') + 1);
+	return 0;
+}
 #endif
-#endif
\ No newline at end of file
+
+//--------------------------------------------
+#define SERIAL_MAX_PORTS         64
+
+//--------------------------------------------
+static serial_port_info_t resolve_cache[SERIAL_MAX_PORTS];
+static int resolve_cnt = -1;
+
+//--------------------------------------------
+static void resolve_add(void *arg, const char *devname, const char *scrname)
+{
+	(void)arg;
+	(void)scrname;
+	if (resolve_cnt < SERIAL_MAX_PORTS && !serial_port_info(devname, &resolve_cache[resolve_cnt]))
+	{
+		resolve_cnt++;
+	}
+}
+
+//--------------------------------------------
+// splits a selector into its kind ('s'erial, 'p'ath, 'v'idpid or 0 for a device name) and value
+static int parse_selector(const char *selector, const char **value, unsigned int *vid, unsigned int *pid)
+{
+	if (!strncmp(selector, "usb-serial:", 11) || !strncmp(selector, "usb-path:", 9))
+	{
+		*value = strchr(selector, ':') + 1;
+		return **value ? selector[4] : -1;
+	}
+	if (!strncmp(selector, "vidpid:", 7))
+	{
+		char *endptr;
+
+		*value = selector + 7;
+		*vid = (unsigned int)strtoul(*value, &endptr, 16);
+		if (endptr == *value || *endptr != ':')
+		{
+			return -1;
+		}
+		*value = endptr + 1;
+		*pid = (unsigned int)strtoul(*value, &endptr, 16);
+		if (endptr == *value || *endptr != '\0')
+		{
+			return -1;
+		}
+		return 'v';
+	}
+	*value = selector;
+	return 0;
+}
+
+//--------------------------------------------
+static int info_match(const serial_port_info_t *info, int kind, const char *value, unsigned int vid, unsigned int pid)
+{
+	return (kind == 'v' && info->vid == vid && info->pid == pid) ||
+		(kind == 's' && !strcmp(info->serial, value)) ||
+		(kind == 'p' && !strcmp(info->usb_path, value));
+}
+
+//--------------------------------------------
+int serial_resolve(const char *selector, char *name, size_t size)
+{
+	unsigned int vid = 0;
+	unsigned int pid = 0;
+	const char *value;
+	int found = -1;
+	int kind;
+	int cnt;
+
+	assert(selector);
+	assert(name);
+
+	kind = parse_selector(selector, &value, &vid, &pid);
+	if (kind < 0)
+	{
+		return SERIAL_RESOLVE_SYNTAX;
+	}
+	if (!kind)
+	{
+		if (strlen(selector) >= size)
+		{
+			return SERIAL_RESOLVE_SYNTAX;
+		}
+		strcpy(name, selector);
+		return SERIAL_RESOLVE_OK;
+	}
+
+	if (resolve_cnt < 0)
+	{
+		resolve_cnt = 0;
+		serial_enum(resolve_add, NULL);
+	}
+	for (cnt = 0; cnt < resolve_cnt; cnt++)
+	{
+		if (info_match(&resolve_cache[cnt], kind, value, vid, pid))
+		{
+			if (found >= 0)
+			{
+				return SERIAL_RESOLVE_AMBIGUOUS;
+			}
+			found = cnt;
+		}
+	}
+	if (found < 0)
+	{
+		return SERIAL_RESOLVE_NOT_FOUND;
+	}
+	if (strlen(resolve_cache[found].devname) >= size)
+	{
+		return SERIAL_RESOLVE_SYNTAX;
+	}
+	strcpy(name, resolve_cache[found].devname);
+	return SERIAL_RESOLVE_OK;
+}
+
+//--------------------------------------------
+int serial_match(const char *selector, const char *devname)
+{
+	serial_port_info_t info;
+	unsigned int vid = 0;
+	unsigned int pid = 0;
+	const char *value;
+	int kind;
+
+	assert(selector);
+	assert(devname);
+
+	kind = parse_selector(selector, &value, &vid, &pid);
+	if (kind <= 0)
+	{
+		return !kind && !strcmp(selector, devname);
+	}
+	return !serial_port_info(devname, &info) && info_match(&info, kind, value, vid, pid);
+}
@@ -33,10 +33,12 @@ typedef struct port_settings
 {
 	int baudrate;
 	int flow_control;
+	int low_latency;         // Linux: ASYNC_LOW_LATENCY and a 1 ms USB-UART latency timer, best effort
 } port_settings_t;
 
 //--------------------------------------------
 int serial_open(const char *name, const port_settings_t *set, HANDLE *dev);
+int serial_set_baudrate(HANDLE dev, int baudrate);
 void serial_flush(HANDLE dev);
 void serial_close(HANDLE dev);
 int serial_read(HANDLE dev, void *buf, size_t len);
@@ -45,8 +47,34 @@ void serial_set_rts(HANDLE dev);
 void serial_clr_rts(HANDLE dev);
 void serial_set_dtr(HANDLE dev);
 void serial_clr_dtr(HANDLE dev);
-#if SERIAL_ENUM
-void serial_enum(list_lstbox_t **list);
-#endif
+// calls cb for every serial port found, devname is the name to open
+typedef void (*serial_enum_cb_t)(void *arg, const char *devname, const char *scrname);
+void serial_enum(serial_enum_cb_t cb, void *arg);
+
+//--------------------------------------------
+// USB identity of a port, stable across re-enumeration (Linux, from sysfs)
+typedef struct serial_port_info
+{
+	char devname[MAX_SERDEVNAME + 16];
+	unsigned int vid;
+	unsigned int pid;
+	char serial[64];         // empty if the adapter has no serial number
+	char usb_path[32];       // bus and hub ports, e.g. 1-2.3
+} serial_port_info_t;
+
+//--------------------------------------------
+#define SERIAL_RESOLVE_OK                 0
+#define SERIAL_RESOLVE_NOT_FOUND         -1
+#define SERIAL_RESOLVE_AMBIGUOUS         -2
+#define SERIAL_RESOLVE_SYNTAX            -3
+
+//--------------------------------------------
+int serial_port_info(const char *devname, serial_port_info_t *info);
+// Port selectors: usb-serial:<serial>, usb-path:<path>, vidpid:<vid>:<pid>
+// (hexadecimal), anything else is a device name and is copied as it is.
+// The ports are scanned once, later calls use the cached result.
+int serial_resolve(const char *selector, char *name, size_t size);
+// 1 if the selector (or device name) designates the port devname
+int serial_match(const char *selector, const char *devname);
 
 #endif /* SERIAL_H_ */
\ No newline at end of file
@@ -0,0 +1,508 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdlib.h>     /* EXIT_SUCCESS, strtoul */
+#include <stdio.h>      /* printf, fgets, fopen */
+#include <string.h>     /* strcmp, strtok */
+#include <ctype.h>      /* isprint */
+#include <errno.h>      /* errno */
+#ifdef _WIN32
+#include <io.h>         /* _isatty */
+#include "gettimeofday.h"
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>     /* isatty */
+#include <sys/time.h>   /* gettimeofday */
+#endif
+#include "checksum.h"
+#include "hc32boot.h"
+#include "probe.h"
+#include "shell.h"
+
+//--------------------------------------------
+#define SHELL_DUMP_WIDTH         16
+
+//--------------------------------------------
+typedef struct command
+{
+	const char *name;
+	int min_args;
+	int max_args;
+	int (*handler)(hc32boot_t *session, char *argv[], int argc);
+	const char *usage;
+} command_t;
+
+//--------------------------------------------
+static uint8_t buf[HC32L110_FLASH_SIZE + 1];
+static int connected;
+static int raw;
+static int quit;
+
+//--------------------------------------------
+static uint64_t get_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//--------------------------------------------
+static int run(hc32boot_t *session, int type, uint32_t addr, uint32_t size, uint8_t *data)
+{
+	hc32boot_op_t op = { 0 };
+
+	op.type = type;
+	op.addr = addr;
+	op.size = size;
+	op.data = data;
+	if (hc32boot_submit(session, &op) || hc32boot_wait(session))
+	{
+		printf("ERROR: Connection error.\n");
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int parse_hex(const char *str, uint32_t max, uint32_t *value)
+{
+	unsigned long res;
+	char *endptr;
+
+	errno = 0;
+	res = strtoul(str, &endptr, 16);
+	if (errno || endptr == str || *endptr != '\0' || res > max)
+	{
+		printf("ERROR: %s is not a hexadecimal number up to 0x%X.\n", str, max);
+		return -1;
+	}
+	*value = (uint32_t)res;
+	return 0;
+}
+
+//--------------------------------------------
+// a flash range, size 0 is not allowed
+static int parse_range(char *argv[], uint32_t *addr, uint32_t *size)
+{
+	if (parse_hex(argv[0], HC32L110_FLASH_SIZE - 1, addr) || parse_hex(argv[1], HC32L110_FLASH_SIZE, size))
+	{
+		return -1;
+	}
+	if (!*size || *addr + *size > HC32L110_FLASH_SIZE)
+	{
+		printf("ERROR: The range is empty or beyond the flash memory.\n");
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// a region by name or a range in one, any range with -x; returns the count of
+// the arguments used
+static int parse_read(char *argv[], int argc, uint32_t *addr, uint32_t *size)
+{
+	const hc32boot_region_t *region;
+
+	if ((region = hc32boot_region(argv[0])) != NULL)
+	{
+		*addr = region->addr;
+		*size = region->size;
+		return 1;
+	}
+	if (argc < 2)
+	{
+		printf("ERROR: %s is not a region, flash, sram or uid, the size is missing.\n", argv[0]);
+		return -1;
+	}
+	if (parse_hex(argv[0], UINT32_MAX, addr) || parse_hex(argv[1], HC32L110_FLASH_SIZE, size))
+	{
+		return -1;
+	}
+	if (!*size || *size - 1 > UINT32_MAX - *addr)
+	{
+		printf("ERROR: The range is empty or beyond the address space.\n");
+		return -1;
+	}
+	if (!raw && !hc32boot_region_of(*addr, *size))
+	{
+		printf("ERROR: The range is not within the flash, sram or uid region, the -x option reads it anyway.\n");
+		return -1;
+	}
+	return 2;
+}
+
+//--------------------------------------------
+static void hexdump(uint32_t addr, const uint8_t *data, uint32_t size)
+{
+	uint32_t line;
+
+	for (line = 0; line < size; line += SHELL_DUMP_WIDTH)
+	{
+		uint32_t len = size - line < SHELL_DUMP_WIDTH ? size - line : SHELL_DUMP_WIDTH;
+		uint32_t cnt;
+
+		printf("%08X ", addr + line);
+		for (cnt = 0; cnt < SHELL_DUMP_WIDTH; cnt++)
+		{
+			if (cnt < len)
+			{
+				printf(" %02X", data[line + cnt]);
+			}
+			else
+			{
+				printf("   ");
+			}
+		}
+		printf("  |");
+		for (cnt = 0; cnt < len; cnt++)
+		{
+			printf("%c", isprint(data[line + cnt]) ? data[line + cnt] : '.');
+		}
+		printf("|\n");
+	}
+}
+
+//--------------------------------------------
+static int cmd_read(hc32boot_t *session, char *argv[], int argc)
+{
+	uint32_t addr;
+	uint32_t size;
+	FILE *file;
+	int used;
+
+	if ((used = parse_read(argv, argc, &addr, &size)) < 0 || run(session, HC32BOOT_OP_READ, addr, size, buf))
+	{
+		return -1;
+	}
+	if (argc == used)
+	{
+		hexdump(addr, buf, size);
+		return 0;
+	}
+	if ((file = fopen(argv[used], "wb")) == NULL || fwrite(buf, size, 1, file) != 1)
+	{
+		printf("ERROR: Could not write file %s.\n", argv[used]);
+		if (file)
+		{
+			fclose(file);
+		}
+		return -1;
+	}
+	fclose(file);
+	printf("0x%04X bytes at 0x%04X read to %s, CRC-32 0x%08X.\n", size, addr, argv[used], crc32(CRC32_INIT, buf, size));
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_dump(hc32boot_t *session, char *argv[], int argc)
+{
+	uint32_t addr;
+	uint32_t size;
+	int used;
+
+	if ((used = parse_read(argv, argc, &addr, &size)) < 0)
+	{
+		return -1;
+	}
+	if (argc > used)
+	{
+		printf("ERROR: dump writes no file, read does.\n");
+		return -1;
+	}
+	if (run(session, HC32BOOT_OP_READ, addr, size, buf))
+	{
+		return -1;
+	}
+	hexdump(addr, buf, size);
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_write(hc32boot_t *session, char *argv[], int argc)
+{
+	uint32_t addr;
+	size_t size;
+	FILE *file;
+
+	(void)argc;
+	if (parse_hex(argv[1], HC32L110_FLASH_SIZE - 1, &addr))
+	{
+		return -1;
+	}
+	if ((file = fopen(argv[0], "rb")) == NULL)
+	{
+		printf("ERROR: Could not open file %s.\n", argv[0]);
+		return -1;
+	}
+	// one byte more than fits tells a file that is too long
+	size = fread(buf, 1, HC32L110_FLASH_SIZE - addr + 1, file);
+	fclose(file);
+	if (!size || addr + size > HC32L110_FLASH_SIZE)
+	{
+		printf("ERROR: File %s is empty or does not fit into the flash memory at 0x%04X.\n", argv[0], addr);
+		return -1;
+	}
+	if (run(session, HC32BOOT_OP_WRITE, addr, (uint32_t)size, buf))
+	{
+		return -1;
+	}
+	printf("0x%04X bytes written at 0x%04X, CRC-32 0x%08X.\n", (unsigned)size, addr, crc32(CRC32_INIT, buf, size));
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_erase(hc32boot_t *session, char *argv[], int argc)
+{
+	uint32_t addr;
+	uint32_t size = 0;
+	uint32_t end;
+
+	if (argc == 1 && !strcmp(argv[0], "chip"))
+	{
+		if (run(session, HC32BOOT_OP_ERASE, 0, 0, NULL))
+		{
+			return -1;
+		}
+		printf("Flash memory erased.\n");
+		return 0;
+	}
+	if (argc == 1 ? parse_hex(argv[0], HC32L110_FLASH_SIZE - 1, &addr) : parse_range(argv, &addr, &size))
+	{
+		return -1;
+	}
+	if (!size)
+	{
+		// the sector holding addr, a sector erase at 0 would be a chip erase
+		size = 1;
+	}
+	// the library erases every sector the range touches
+	if (run(session, HC32BOOT_OP_ERASE, addr, size, NULL))
+	{
+		return -1;
+	}
+	end = (addr + size + HC32L110_SECTOR_SIZE - 1) & ~(uint32_t)(HC32L110_SECTOR_SIZE - 1);
+	addr &= ~(uint32_t)(HC32L110_SECTOR_SIZE - 1);
+	printf("Flash memory 0x%04X-0x%04X erased.\n", addr, end - 1);
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_checksum(hc32boot_t *session, char *argv[], int argc)
+{
+	uint32_t addr;
+	uint32_t size;
+	uint8_t sum[2];
+
+	(void)argc;
+	if (parse_range(argv, &addr, &size) || run(session, HC32BOOT_OP_SUM, addr, size, sum))
+	{
+		return -1;
+	}
+	printf("Sum16 of 0x%04X bytes at 0x%04X: 0x%04X.\n", size, addr, sum[0] | sum[1] << 8);
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_probe(hc32boot_t *session, char *argv[], int argc)
+{
+	probe_t probe;
+
+	(void)argv;
+	(void)argc;
+	if (probe_run(session, &probe))
+	{
+		printf("ERROR: Connection error.\n");
+		return -1;
+	}
+	probe_print(&probe);
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_run(hc32boot_t *session, char *argv[], int argc)
+{
+	(void)argv;
+	(void)argc;
+	connected = 0;
+	if (run(session, HC32BOOT_OP_RUN, 0, 0, NULL))
+	{
+		return -1;
+	}
+	printf("The application has been started, connect gets back to the flashloader.\n");
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_connect(hc32boot_t *session, char *argv[], int argc)
+{
+	(void)argv;
+	(void)argc;
+	connected = 0;
+	printf("Please wait. The HL32L110 is reset.\n");
+	if (run(session, HC32BOOT_OP_CONNECT, 0, 0, NULL) || run(session, HC32BOOT_OP_LOAD, 0, 0, NULL) ||
+		run(session, HC32BOOT_OP_CALIBRATE, 0, 0, NULL))
+	{
+		return -1;
+	}
+	connected = 1;
+	printf("The flashloader is running, packet size %u bytes.\n", hc32boot_link(session)->pkt_size);
+	return 0;
+}
+
+//--------------------------------------------
+static int cmd_help(hc32boot_t *session, char *argv[], int argc);
+
+//--------------------------------------------
+static int cmd_quit(hc32boot_t *session, char *argv[], int argc)
+{
+	(void)session;
+	(void)argv;
+	(void)argc;
+	quit = 1;
+	return 0;
+}
+
+//--------------------------------------------
+static const command_t commands[] = {
+	{ "read", 1, 3, cmd_read, "read <addr> <size> [<file>]  read to a file, hexdump without a file" },
+	{ "dump", 1, 2, cmd_dump, "dump <addr> <size>           hexdump" },
+	{ "hexdump", 1, 2, cmd_dump, "hexdump <addr> <size>        hexdump" },
+	{ "write", 2, 2, cmd_write, "write <file> <addr>          write a file, the sectors must be erased" },
+	{ "erase", 1, 2, cmd_erase, "erase <addr> [<size>]        erase the sector at addr, or the sectors of the range; erase chip" },
+	{ "checksum", 2, 2, cmd_checksum, "checksum <addr> <size>       16-bit sum computed by the flashloader" },
+	{ "probe", 0, 0, cmd_probe, "probe                        UID and flash checksums" },
+	{ "run", 0, 0, cmd_run, "run                          reset into the application" },
+	{ "reset", 0, 0, cmd_run, "reset                        as run" },
+	{ "connect", 0, 0, cmd_connect, "connect                      reset, upload and start the flashloader again" },
+	{ "help", 0, 0, cmd_help, "help                         this list" },
+	{ "quit", 0, 0, cmd_quit, "quit                         end the session (exit, end of input)" },
+	{ "exit", 0, 0, cmd_quit, NULL },
+};
+
+//--------------------------------------------
+static int cmd_help(hc32boot_t *session, char *argv[], int argc)
+{
+	size_t cnt;
+
+	(void)session;
+	(void)argv;
+	(void)argc;
+	printf("Addresses and sizes in hexadecimal notation, a region (flash, sram, uid) instead of <addr> <size> of read:\n");
+	for (cnt = 0; cnt < sizeof(commands) / sizeof(commands[0]); cnt++)
+	{
+		if (commands[cnt].usage)
+		{
+			printf("  %s\n", commands[cnt].usage);
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// runs one line, empty lines and comments do nothing
+static int execute(hc32boot_t *session, char *line)
+{
+	char *argv[SHELL_MAX_ARGS + 1];
+	const command_t *cmd = NULL;
+	uint64_t start_us;
+	int argc = 0;
+	size_t cnt;
+	int res;
+	char *name;
+
+	line[strcspn(line, "#\r\n")] = '\0';
+	if ((name = strtok(line, " \t")) == NULL)
+	{
+		return 0;
+	}
+	while (argc <= SHELL_MAX_ARGS && (argv[argc] = strtok(NULL, " \t")) != NULL)
+	{
+		argc++;
+	}
+	for (cnt = 0; cnt < sizeof(commands) / sizeof(commands[0]); cnt++)
+	{
+		if (!strcmp(commands[cnt].name, name))
+		{
+			cmd = &commands[cnt];
+			break;
+		}
+	}
+	if (!cmd)
+	{
+		printf("ERROR: Unknown command %s, help lists them.\n", name);
+		return -1;
+	}
+	if (argc < cmd->min_args || argc > cmd->max_args)
+	{
+		printf("Usage: %s\n", cmd->usage ? cmd->usage : cmd->name);
+		return -1;
+	}
+	if (!connected && cmd->handler != cmd_connect && cmd->handler != cmd_help && cmd->handler != cmd_quit)
+	{
+		printf("ERROR: The flashloader is not running, connect starts it.\n");
+		return -1;
+	}
+	start_us = get_time_us();
+	res = cmd->handler(session, argv, argc);
+	if (!res && cmd->handler != cmd_help && cmd->handler != cmd_quit)
+	{
+		printf("(%.1f ms)\n", (get_time_us() - start_us) / 1000.0);
+	}
+	return res;
+}
+
+//--------------------------------------------
+int shell_run(hc32boot_t *session, int raw_read)
+{
+	char line[SHELL_LINE_SIZE];
+	int interactive = isatty(fileno(stdin));
+	int failed = 0;
+
+	connected = 1;
+	raw = raw_read;
+	quit = 0;
+	if (interactive)
+	{
+		printf("The flashloader is running, help lists the commands.\n");
+	}
+	while (!quit)
+	{
+		if (interactive)
+		{
+			printf("hc32> ");
+			fflush(stdout);
+		}
+		if (!fgets(line, sizeof(line), stdin))
+		{
+			if (interactive)
+			{
+				printf("\n");
+			}
+			break;
+		}
+		if (execute(session, line))
+		{
+			failed = 1;
+			if (!interactive)
+			{
+				// a script does not go on after a failed step
+				break;
+			}
+		}
+	}
+	return interactive || !failed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
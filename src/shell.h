@@ -0,0 +1,43 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef SHELL_H_
+#define SHELL_H_
+
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define SHELL_LINE_SIZE          512
+#define SHELL_MAX_ARGS           4
+
+//--------------------------------------------
+// Interactive session (-I): commands from stdin, one per line, all of them on
+// the session already connected with the flashloader running, addresses and
+// sizes in hexadecimal notation:
+//   read <addr> <size> [<file>]   read to a file, hexdump without a file (dump, hexdump),
+//                                 a region name (flash, sram, uid) for <addr> <size>, any
+//                                 address with raw_read (-x)
+//   write <file> <addr>           write a file, the sectors must be erased
+//   erase <addr> [<size>]         erase the sector at addr, or every sector of the range
+//   erase chip                    erase the whole flash
+//   checksum <addr> <size>        16-bit sum computed by the flashloader
+//   probe                         UID and flash checksums, as -i
+//   run                           reset into the application (reset), connect gets back
+//   connect                       reset, flashloader upload and calibration again
+//   help, quit
+// On a terminal a prompt is shown and an error ends only the command, from a
+// pipe or file the first error ends the shell with EXIT_FAILURE.
+int shell_run(hc32boot_t *session, int raw_read);
+
+#endif /* SHELL_H_ */
@@ -0,0 +1,851 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint8_t ... uint64_t */
+#include <stdlib.h>     /* EXIT_SUCCESS, malloc, strtol */
+#include <stdio.h>      /* printf, fopen */
+#include <string.h>     /* strcmp, strrchr */
+#include <ctype.h>      /* isspace */
+#include <errno.h>      /* errno */
+#ifdef _WIN32
+#include <windows.h>    /* SRWLOCK, CONDITION_VARIABLE */
+#include <process.h>    /* _beginthreadex */
+#include "gettimeofday.h"
+#else
+#include <sys/time.h>   /* gettimeofday */
+#include <pthread.h>    /* pthread_create */
+#endif
+#include "serial.h"
+#include "hc32boot.h"
+#include "patch.h"
+#include "manifest.h"
+#include "audit.h"
+#include "station.h"
+
+//--------------------------------------------
+#define STATION_LINE_SIZE        512
+#define STATION_DEFAULT_WORKERS  4
+#define STATION_NAME_SIZE        256
+
+//--------------------------------------------
+// job states
+#define JOB_QUEUED               0      // in a worker queue or being prepared
+#define JOB_READY                1      // prepared, waiting for a port
+#define JOB_RUNNING              2
+#define JOB_DONE                 3
+
+//--------------------------------------------
+// port steps, a job runs through them in this order
+#define STEP_IDLE                0      // waits for a job of the port to be prepared
+#define STEP_CONNECT             1
+#define STEP_LOAD                2
+#define STEP_CALIBRATE           3
+#define STEP_UID                 4      // for the audit log only
+#define STEP_MANIFEST            5
+#define STEP_DONE                6      // no job left for the port, or the port is gone
+
+//--------------------------------------------
+// prepared manifest states
+#define PREP_NONE                0
+#define PREP_BUSY                1      // a worker reads and frames it
+#define PREP_READY               2
+#define PREP_FAILED              3
+
+//--------------------------------------------
+#ifdef _WIN32
+typedef SRWLOCK lock_t;
+typedef CONDITION_VARIABLE cond_t;
+typedef HANDLE thread_t;
+#define lock_init(l)             InitializeSRWLock(l)
+#define lock(l)                  AcquireSRWLockExclusive(l)
+#define unlock(l)                ReleaseSRWLockExclusive(l)
+#define cond_init(c)             InitializeConditionVariable(c)
+#define cond_wait(c, l)          SleepConditionVariableSRW(c, l, INFINITE, 0)
+#define cond_broadcast(c)        WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t lock_t;
+typedef pthread_cond_t cond_t;
+typedef pthread_t thread_t;
+#define lock_init(l)             pthread_mutex_init(l, NULL)
+#define lock(l)                  pthread_mutex_lock(l)
+#define unlock(l)                pthread_mutex_unlock(l)
+#define cond_init(c)             pthread_cond_init(c, NULL)
+#define cond_wait(c, l)          pthread_cond_wait(c, l)
+#define cond_broadcast(c)        pthread_cond_broadcast(c)
+#endif
+
+//--------------------------------------------
+// A manifest is read and its images framed once, all the jobs naming it run
+// the same copy: without patches manifest_run() only reads it.
+typedef struct prepared
+{
+	manifest_t manifest;
+	int state;
+	int users;               // jobs not done yet, the copy is freed after the last one
+} prepared_t;
+
+//--------------------------------------------
+typedef struct job
+{
+	char selector[256];
+	char path[256];
+	int line;
+	uint64_t ports;          // bit per port the selector matches
+	int state;
+	prepared_t *prepared;
+} job_t;
+
+//--------------------------------------------
+typedef struct port
+{
+	char spec[256];
+	char name[STATION_NAME_SIZE];
+	char prefix[STATION_NAME_SIZE + 4];   // "[<name>] "
+	int index;
+	hc32boot_t *session;     // open for the whole run, every job resets the board
+	job_t *job;
+	int step;
+	manifest_exec_t exec;
+	audit_t audit;
+	uint8_t uid[HC32L110_UID_SIZE];
+	uint64_t start_ms;
+	int ok_cnt;
+	int fail_cnt;
+	uint64_t busy_ms;
+} port_t;
+
+//--------------------------------------------
+// a worker queue: the owner takes the oldest job, a thief the newest
+typedef struct deque
+{
+	lock_t lock;
+	int *items;
+	int head;
+	int tail;
+	thread_t thread;
+	int started;
+} deque_t;
+
+//--------------------------------------------
+static job_t *jobs;
+static int job_cnt;
+static prepared_t *prepared;
+static int prepared_cnt;
+static port_t ports[STATION_MAX_PORTS];
+static int port_cnt;
+static deque_t deques[STATION_MAX_WORKERS];
+static int worker_cnt = STATION_DEFAULT_WORKERS;
+static hc32boot_config_t session_cfg;
+// the job states and the counters below
+static lock_t state_lock;
+static cond_t state_cond;
+static int ahead_cnt;        // jobs being prepared or prepared and not taken yet
+static int ahead_max;
+static int prep_fail_cnt;
+static int lost_cnt;         // jobs whose ports are all gone
+static int aborted;
+static int stop;             // the ports are done, the workers end
+
+//--------------------------------------------
+static uint64_t get_time_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//--------------------------------------------
+static char *trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+	{
+		str++;
+	}
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+	{
+		*--end = '\0';
+	}
+	return str;
+}
+
+//--------------------------------------------
+// splits off the first word of str, returns the rest
+static char *next_word(char *str)
+{
+	while (*str && !isspace((unsigned char)*str))
+	{
+		str++;
+	}
+	if (*str)
+	{
+		*str++ = '\0';
+	}
+	return trim(str);
+}
+
+//--------------------------------------------
+static int parse(const char *path)
+{
+	char buf[STATION_LINE_SIZE];
+	FILE *fp;
+	int line = 0;
+
+	if ((fp = fopen(path, "r")) == NULL)
+	{
+		printf("ERROR: Could not open the station file %s.\n", path);
+		return -1;
+	}
+	jobs = calloc(STATION_MAX_JOBS, sizeof(job_t));
+	while (jobs && fgets(buf, sizeof(buf), fp))
+	{
+		char *str = trim(buf);
+		char *arg;
+
+		line++;
+		if (!*str || *str == '#' || *str == ';')
+		{
+			continue;
+		}
+		arg = next_word(str);
+		if (!strcmp(str, "port") && *arg && port_cnt < STATION_MAX_PORTS && strlen(arg) < sizeof(ports[0].spec))
+		{
+			strcpy(ports[port_cnt++].spec, arg);
+		}
+		else if (!strcmp(str, "workers") && *arg)
+		{
+			char *endptr;
+
+			errno = 0;
+			worker_cnt = (int)strtol(arg, &endptr, 10);
+			if (errno || *endptr != '\0' || worker_cnt < 1 || worker_cnt > STATION_MAX_WORKERS)
+			{
+				break;
+			}
+		}
+		else if (!strcmp(str, "job") && *arg && job_cnt < STATION_MAX_JOBS)
+		{
+			job_t *job = &jobs[job_cnt];
+			char *manifest = next_word(arg);
+
+			if (!*manifest || strlen(arg) >= sizeof(job->selector) || strlen(manifest) >= sizeof(job->path))
+			{
+				break;
+			}
+			strcpy(job->selector, arg);
+			strcpy(job->path, manifest);
+			job->line = line;
+			job_cnt++;
+		}
+		else
+		{
+			break;
+		}
+	}
+	if (!jobs || !feof(fp))
+	{
+		printf("ERROR: The station file %s is wrong in line %d.\n", path, line);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	if (!port_cnt || !job_cnt)
+	{
+		printf("ERROR: The station file %s has no ports or no jobs.\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+//--------------------------------------------
+// resolves the ports and checks every job once, before any board is touched
+static int check(void)
+{
+	static manifest_t manifest;
+	int cnt;
+
+	prepared = calloc(job_cnt, sizeof(prepared_t));
+	if (!prepared)
+	{
+		printf("ERROR: Out of memory.\n");
+		return -1;
+	}
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		port_t *port = &ports[cnt];
+		const char *short_name;
+
+		if (serial_resolve(port->spec, port->name, sizeof(port->name)) != SERIAL_RESOLVE_OK)
+		{
+			printf("ERROR: No single serial port matches %s.\n", port->spec);
+			return -1;
+		}
+		short_name = strrchr(port->name, '/') ? strrchr(port->name, '/') + 1 : port->name;
+		snprintf(port->prefix, sizeof(port->prefix), "[%s] ", short_name);
+		port->index = cnt;
+	}
+	for (cnt = 0; cnt < job_cnt; cnt++)
+	{
+		job_t *job = &jobs[cnt];
+		int cnt_p;
+		int patches;
+
+		for (cnt_p = 0; cnt_p < port_cnt; cnt_p++)
+		{
+			if (!strcmp(job->selector, "*") || !strcmp(job->selector, ports[cnt_p].spec) ||
+				serial_match(job->selector, ports[cnt_p].name))
+			{
+				job->ports |= (uint64_t)1 << cnt_p;
+			}
+		}
+		if (!job->ports)
+		{
+			printf("ERROR: No port of the station matches %s in line %d.\n", job->selector, job->line);
+			return -1;
+		}
+		for (cnt_p = 0; cnt_p < cnt && strcmp(jobs[cnt_p].path, job->path); cnt_p++);
+		if (cnt_p < cnt)
+		{
+			// the same manifest has been checked already, its copy is shared
+			job->prepared = jobs[cnt_p].prepared;
+			job->prepared->users++;
+			continue;
+		}
+		job->prepared = &prepared[prepared_cnt++];
+		job->prepared->users = 1;
+		patches = patch_count();
+		if (manifest_load(&manifest, job->path))
+		{
+			return -1;
+		}
+		manifest_free(&manifest);
+		if (patch_count() != patches)
+		{
+			// the patches (counters) are global and would apply to every board
+			printf("ERROR: The manifest %s has patches, they are not supported in station jobs.\n", job->path);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+//--------------------------------------------
+static int deque_pop(deque_t *d)
+{
+	int idx = -1;
+
+	lock(&d->lock);
+	if (d->head < d->tail)
+	{
+		idx = d->items[d->head++];
+	}
+	unlock(&d->lock);
+	return idx;
+}
+
+//--------------------------------------------
+static int deque_steal(deque_t *d)
+{
+	int idx = -1;
+
+	lock(&d->lock);
+	if (d->head < d->tail)
+	{
+		idx = d->items[--d->tail];
+	}
+	unlock(&d->lock);
+	return idx;
+}
+
+//--------------------------------------------
+// the last job of a manifest frees its copy, called with state_lock held
+static void release(job_t *job)
+{
+	if (--job->prepared->users == 0 && job->prepared->state == PREP_READY)
+	{
+		manifest_free(&job->prepared->manifest);
+	}
+}
+
+//--------------------------------------------
+// a job none of the open ports can take, called with state_lock held
+static void orphan(job_t *job)
+{
+	printf("ERROR: No port is left for the job in line %d, manifest %s.\n", job->line, job->path);
+	release(job);
+	ahead_cnt--;
+	lost_cnt++;
+	job->state = JOB_DONE;
+}
+
+//--------------------------------------------
+// the first job of a manifest reads and frames it, the others wait for that copy
+static void prepare(job_t *job)
+{
+	prepared_t *p = job->prepared;
+
+	lock(&state_lock);
+	while (p->state == PREP_BUSY)
+	{
+		cond_wait(&state_cond, &state_lock);
+	}
+	if (p->state == PREP_NONE)
+	{
+		int res;
+
+		p->state = PREP_BUSY;
+		unlock(&state_lock);
+		res = manifest_load(&p->manifest, job->path) || manifest_prepare(&p->manifest);
+		if (res)
+		{
+			manifest_free(&p->manifest);
+		}
+		lock(&state_lock);
+		p->state = res ? PREP_FAILED : PREP_READY;
+	}
+	if (p->state == PREP_FAILED)
+	{
+		printf("ERROR: Could not prepare the job in line %d, manifest %s.\n", job->line, job->path);
+		release(job);
+		ahead_cnt--;
+		prep_fail_cnt++;
+	}
+	job->state = p->state == PREP_FAILED ? JOB_DONE : JOB_READY;
+	if (job->state == JOB_READY && !job->ports)
+	{
+		orphan(job);
+	}
+	cond_broadcast(&state_cond);
+	unlock(&state_lock);
+}
+
+//--------------------------------------------
+// Prepares at most ahead_max jobs ahead of the ports: its own queue first,
+// then the newest job of the other queues.
+static void worker(int self)
+{
+	for (;;)
+	{
+		int idx;
+		int cnt;
+
+		lock(&state_lock);
+		while (ahead_cnt >= ahead_max && !stop)
+		{
+			cond_wait(&state_cond, &state_lock);
+		}
+		ahead_cnt++;
+		unlock(&state_lock);
+
+		idx = stop ? -1 : deque_pop(&deques[self]);
+		for (cnt = 1; idx < 0 && !stop && cnt < worker_cnt; cnt++)
+		{
+			idx = deque_steal(&deques[(self + cnt) % worker_cnt]);
+		}
+		if (idx < 0)
+		{
+			lock(&state_lock);
+			ahead_cnt--;
+			cond_broadcast(&state_cond);
+			unlock(&state_lock);
+			return;
+		}
+		prepare(&jobs[idx]);
+	}
+}
+
+//--------------------------------------------
+// The oldest prepared job the port matches, pending is set while matching jobs
+// are still queued or being prepared. Called with state_lock held.
+static job_t *job_find(const port_t *port, int *pending)
+{
+	uint64_t bit = (uint64_t)1 << port->index;
+	int cnt;
+
+	*pending = 0;
+	for (cnt = 0; cnt < job_cnt; cnt++)
+	{
+		if (!(jobs[cnt].ports & bit) || jobs[cnt].state >= JOB_RUNNING)
+		{
+			continue;
+		}
+		*pending = 1;
+		if (jobs[cnt].state == JOB_READY)
+		{
+			return &jobs[cnt];
+		}
+	}
+	return NULL;
+}
+
+//--------------------------------------------
+// the port takes no more jobs, the ones only it could run are dropped
+static void port_retire(port_t *port)
+{
+	uint64_t bit = (uint64_t)1 << port->index;
+	int cnt;
+
+	port->step = STEP_DONE;
+	lock(&state_lock);
+	for (cnt = 0; cnt < job_cnt; cnt++)
+	{
+		if (!(jobs[cnt].ports & bit))
+		{
+			continue;
+		}
+		jobs[cnt].ports &= ~bit;
+		// a queued job is dropped by prepare()
+		if (!jobs[cnt].ports && jobs[cnt].state == JOB_READY)
+		{
+			orphan(&jobs[cnt]);
+		}
+	}
+	cond_broadcast(&state_cond);
+	unlock(&state_lock);
+}
+
+//--------------------------------------------
+// the only read of the connect steps is the UID for the audit log
+static int port_submit(port_t *port, int step, int type, const char *phase)
+{
+	hc32boot_op_t op = { 0 };
+
+	port->step = step;
+	op.type = type;
+	if (type == HC32BOOT_OP_READ)
+	{
+		op.addr = HC32L110_UID_ADDR;
+		op.size = HC32L110_UID_SIZE;
+		op.data = port->uid;
+	}
+	audit_phase(&port->audit, phase, op.size);
+	return hc32boot_submit(port->session, &op) ? -1 : 1;
+}
+
+//--------------------------------------------
+// Takes the oldest prepared job of the port and submits its first operation:
+// 1, 0 while the jobs of the port are still being prepared, -1 when none is
+// left or the port is gone.
+static int job_start(port_t *port)
+{
+	job_t *job = NULL;
+	int pending = 0;
+
+	lock(&state_lock);
+	if (!stop && (job = job_find(port, &pending)) != NULL)
+	{
+		job->state = JOB_RUNNING;
+		ahead_cnt--;
+		cond_broadcast(&state_cond);
+	}
+	unlock(&state_lock);
+	if (!job)
+	{
+		port->step = pending && !stop ? STEP_IDLE : STEP_DONE;
+		return port->step == STEP_IDLE ? 0 : -1;
+	}
+
+	port->job = job;
+	port->start_ms = get_time_ms();
+	printf("%sJob in line %d, manifest %s.\n", port->prefix, job->line, job->path);
+	audit_begin(&port->audit, port->name);
+	audit_attach(&port->audit, port->session);
+	if (port_submit(port, STEP_CONNECT, HC32BOOT_OP_CONNECT, "connect") < 0)
+	{
+		// the port has been closed after an error, the job goes back to the other ports
+		printf("%sERROR: The serial port is not accessible any more.\n", port->prefix);
+		lock(&state_lock);
+		job->state = JOB_READY;
+		ahead_cnt++;
+		unlock(&state_lock);
+		port->job = NULL;
+		port_retire(port);
+		return -1;
+	}
+	return 1;
+}
+
+//--------------------------------------------
+static void job_end(port_t *port, int res)
+{
+	job_t *job = port->job;
+	uint64_t ms = get_time_ms() - port->start_ms;
+
+	audit_end(&port->audit, port->session, res);
+	port->busy_ms += ms;
+	if (res)
+	{
+		port->fail_cnt++;
+		printf("%sERROR: Job in line %d failed after %.1f s.\n", port->prefix, job->line, ms / 1000.0);
+	}
+	else
+	{
+		port->ok_cnt++;
+		printf("%sJob in line %d completed successfully in %.1f s.\n", port->prefix, job->line, ms / 1000.0);
+	}
+	lock(&state_lock);
+	job->state = JOB_DONE;
+	release(job);
+	unlock(&state_lock);
+	port->job = NULL;
+	port->step = STEP_IDLE;
+}
+
+//--------------------------------------------
+// hc32boot_wait_each() callback: the queue of the port has run empty, the next
+// step of its job is submitted or the next job is started
+static int port_next(void *arg, size_t index, int result)
+{
+	port_t *port = ((port_t **)arg)[index];
+	manifest_t *manifest;
+	int res = -1;
+	int cnt;
+
+	if (port->step == STEP_DONE)
+	{
+		return -1;
+	}
+	if (port->step == STEP_IDLE)
+	{
+		return job_start(port);
+	}
+	manifest = &port->job->prepared->manifest;
+	if (port->step == STEP_MANIFEST)
+	{
+		res = manifest_next(manifest, &port->exec, port->session, result);
+	}
+	else if (!result && port->step == STEP_CONNECT)
+	{
+		res = port_submit(port, STEP_LOAD, HC32BOOT_OP_LOAD, "load");
+	}
+	else if (!result && port->step == STEP_LOAD)
+	{
+		res = port_submit(port, STEP_CALIBRATE, HC32BOOT_OP_CALIBRATE, "calibrate");
+	}
+	else if (!result && port->step == STEP_CALIBRATE && audit_enabled())
+	{
+		res = port_submit(port, STEP_UID, HC32BOOT_OP_READ, "uid");
+	}
+	else if (!result)
+	{
+		uint32_t bytes = 0;
+
+		if (port->step == STEP_UID)
+		{
+			audit_uid(&port->audit, port->uid);
+		}
+		for (cnt = 0; cnt < manifest->region_cnt; cnt++)
+		{
+			audit_image(&port->audit, manifest->regions[cnt].image.crc);
+			bytes += manifest->regions[cnt].size;
+		}
+		audit_phase(&port->audit, "manifest", bytes);
+		port->step = STEP_MANIFEST;
+		manifest_start(&port->exec, port->prefix);
+		res = manifest_next(manifest, &port->exec, port->session, 0);
+	}
+	if (res > 0)
+	{
+		return 1;
+	}
+	if (res < 0 && port->step != STEP_MANIFEST)
+	{
+		printf("%sERROR: Could not connect to HL32L110.\n", port->prefix);
+	}
+	job_end(port, res);
+	return job_start(port);
+}
+
+//--------------------------------------------
+#ifdef _WIN32
+static unsigned __stdcall worker_thread(void *arg)
+{
+	worker((int)(intptr_t)arg);
+	return 0;
+}
+static int thread_start(thread_t *thread, unsigned (__stdcall *func)(void *), void *arg)
+{
+	*thread = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+	return *thread ? 0 : -1;
+}
+static void thread_join(thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+#else
+static void *worker_thread(void *arg)
+{
+	worker((int)(intptr_t)arg);
+	return NULL;
+}
+static int thread_start(thread_t *thread, void *(*func)(void *), void *arg)
+{
+	return pthread_create(thread, NULL, func, arg) ? -1 : 0;
+}
+static void thread_join(thread_t thread)
+{
+	pthread_join(thread, NULL);
+}
+#endif
+
+//--------------------------------------------
+int station_run(const char *path, const hc32boot_config_t *cfg)
+{
+	hc32boot_t *sessions[STATION_MAX_PORTS];
+	port_t *live[STATION_MAX_PORTS];
+	int live_cnt = 0;
+	int started_cnt = 0;
+	uint64_t start;
+	int ok_cnt = 0;
+	int fail_cnt;
+	int cnt;
+
+	if (parse(path) || check())
+	{
+		free(prepared);
+		free(jobs);
+		return EXIT_FAILURE;
+	}
+	session_cfg = *cfg;
+	lock_init(&state_lock);
+	cond_init(&state_cond);
+	if (worker_cnt > job_cnt)
+	{
+		worker_cnt = job_cnt;
+	}
+	ahead_max = port_cnt + worker_cnt;
+	for (cnt = 0; cnt < worker_cnt; cnt++)
+	{
+		lock_init(&deques[cnt].lock);
+		deques[cnt].items = malloc((job_cnt / worker_cnt + 1) * sizeof(int));
+		if (!deques[cnt].items)
+		{
+			printf("ERROR: Out of memory.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	// round robin, every worker starts with a share of the oldest jobs
+	for (cnt = 0; cnt < job_cnt; cnt++)
+	{
+		deque_t *d = &deques[cnt % worker_cnt];
+		d->items[d->tail++] = cnt;
+	}
+
+	printf("Station: %d ports, %d jobs, %d workers.\n", port_cnt, job_cnt, worker_cnt);
+	start = get_time_ms();
+	// the sessions stay open, every job resets the board
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		ports[cnt].session = hc32boot_open(ports[cnt].name, &session_cfg);
+		if (!ports[cnt].session)
+		{
+			printf("%sERROR: Could not open serial port. Not found or not accessible.\n", ports[cnt].prefix);
+			port_retire(&ports[cnt]);
+			continue;
+		}
+		live[live_cnt] = &ports[cnt];
+		sessions[live_cnt++] = ports[cnt].session;
+	}
+	for (cnt = 0; cnt < worker_cnt; cnt++)
+	{
+		deques[cnt].started = !thread_start(&deques[cnt].thread, worker_thread, (void *)(intptr_t)cnt);
+		started_cnt += deques[cnt].started;
+	}
+	// a worker that did not start is robbed by the others
+	aborted = !started_cnt;
+	if (aborted)
+	{
+		printf("ERROR: Could not start the worker threads.\n");
+	}
+	// all ports are driven from here, the workers only prepare the jobs
+	while (!aborted && live_cnt)
+	{
+		int idle = 0;
+
+		if (hc32boot_wait_each(sessions, live_cnt, port_next, live))
+		{
+			printf("ERROR: Out of memory.\n");
+			aborted = 1;
+			break;
+		}
+		lock(&state_lock);
+		for (;;)
+		{
+			int pending = 0;
+			int ready = 0;
+
+			idle = 0;
+			for (cnt = 0; cnt < live_cnt && !ready; cnt++)
+			{
+				if (live[cnt]->step == STEP_IDLE)
+				{
+					ready = job_find(live[cnt], &pending) != NULL;
+					idle |= pending;
+				}
+			}
+			if (ready || !idle)
+			{
+				break;
+			}
+			cond_wait(&state_cond, &state_lock);
+		}
+		unlock(&state_lock);
+		if (!idle)
+		{
+			break;
+		}
+	}
+	lock(&state_lock);
+	stop = 1;
+	cond_broadcast(&state_cond);
+	unlock(&state_lock);
+	for (cnt = 0; cnt < worker_cnt; cnt++)
+	{
+		if (deques[cnt].started)
+		{
+			thread_join(deques[cnt].thread);
+		}
+		free(deques[cnt].items);
+	}
+	for (cnt = 0; cnt < live_cnt; cnt++)
+	{
+		hc32boot_close(sessions[cnt]);
+	}
+
+	fail_cnt = prep_fail_cnt + lost_cnt;
+	printf("\nStation summary:\n");
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		printf("  %s: %d completed, %d failed, busy %.1f s\n",
+			ports[cnt].name, ports[cnt].ok_cnt, ports[cnt].fail_cnt, ports[cnt].busy_ms / 1000.0);
+		ok_cnt += ports[cnt].ok_cnt;
+		fail_cnt += ports[cnt].fail_cnt;
+	}
+	printf("  total: %d completed, %d failed in %.1f s\n", ok_cnt, fail_cnt, (get_time_ms() - start) / 1000.0);
+	// the copies of the jobs an abort left behind
+	for (cnt = 0; cnt < prepared_cnt; cnt++)
+	{
+		if (prepared[cnt].users && prepared[cnt].state == PREP_READY)
+		{
+			manifest_free(&prepared[cnt].manifest);
+		}
+	}
+	free(prepared);
+	free(jobs);
+	return fail_cnt || aborted || ok_cnt != job_cnt ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,40 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef STATION_H_
+#define STATION_H_
+
+#include "hc32boot.h"
+
+//--------------------------------------------
+#define STATION_MAX_PORTS        64
+#define STATION_MAX_JOBS         4096
+#define STATION_MAX_WORKERS      64
+
+//--------------------------------------------
+// Station file, one directive per line, lines starting with # or ; are comments:
+//   port <serport>            a port of the station, name or selector (as -p)
+//   workers <n>               preparation threads, default 4
+//   job <selector> <manifest> a board to program as the manifest (-m) lists,
+//                             on any port the selector matches, * for any port
+// The jobs are queued in file order. The worker threads read, frame and
+// checksum the manifest images ahead of the ports, once per manifest: all the
+// jobs naming the same manifest share one copy. Every worker takes the jobs
+// of its own queue and steals from the others when it runs dry. All ports are
+// driven from the calling thread by hc32boot_wait_each(), every port takes the
+// oldest prepared job it matches as soon as it is idle.
+// Job output is prefixed with the port name. Returns EXIT_SUCCESS if no job failed.
+int station_run(const char *path, const hc32boot_config_t *cfg);
+
+#endif /* STATION_H_ */
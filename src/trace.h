@@ -0,0 +1,65 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+//--------------------------------------------
+// USDT static probes of the session, provider hc32boot. Built with
+// HC32BOOT_USDT defined (make USDT=1) and <sys/sdt.h> present (systemtap-sdt-dev),
+// compiled out otherwise. A probe nobody traces is a nop instruction, its
+// arguments are still computed (a clock read per frame).
+// Times are in microseconds (gettimeofday), cmd is the flashloader command,
+// -1 for the exchanges with the ROM bootloader.
+//   frame__submit   cmd, addr, tx bytes, timeout ms, time
+//   frame__rx       cmd, addr, us since submit, time          the first byte of the answer
+//   frame__done     cmd, addr, rx bytes, us since submit, time
+//   frame__bad      cmd, addr, TRACE_BAD_..., status byte, time
+//   timeout         cmd, addr, us since submit, time
+//   retry           retries so far, time                      connect pattern repeated
+//   phase           name, operation, time                     reset, connect, upload, execute, release...
+//   op__start       operation, addr, size, time
+//   op__done        operation, result, us since start, time
+#if defined(HC32BOOT_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TRACE_ENABLED            1
+#else
+#warning "HC32BOOT_USDT: <sys/sdt.h> not found, the probes are compiled out"
+#endif
+#endif
+
+#ifdef TRACE_ENABLED
+#include <sys/sdt.h>    /* DTRACE_PROBE2 ... DTRACE_PROBE5 */
+#define TRACE2(name, a1, a2)                   DTRACE_PROBE2(hc32boot, name, a1, a2)
+#define TRACE3(name, a1, a2, a3)               DTRACE_PROBE3(hc32boot, name, a1, a2, a3)
+#define TRACE4(name, a1, a2, a3, a4)           DTRACE_PROBE4(hc32boot, name, a1, a2, a3, a4)
+#define TRACE5(name, a1, a2, a3, a4, a5)       DTRACE_PROBE5(hc32boot, name, a1, a2, a3, a4, a5)
+#else
+#define TRACE_ENABLED            0
+#define TRACE2(name, a1, a2)                   do { } while (0)
+#define TRACE3(name, a1, a2, a3)               do { } while (0)
+#define TRACE4(name, a1, a2, a3, a4)           do { } while (0)
+#define TRACE5(name, a1, a2, a3, a4, a5)       do { } while (0)
+#endif
+
+//--------------------------------------------
+// frame__bad reasons
+#define TRACE_BAD_HEADER         1   // not a flashloader frame
+#define TRACE_BAD_STATUS         2   // the flashloader refused the command (its checksum, command or address)
+#define TRACE_BAD_SIZE           3   // the size field is beyond the packet size
+#define TRACE_BAD_CHECKSUM       4   // the sum8 of the response does not match
+#define TRACE_BAD_NAK            5   // the ROM bootloader did not acknowledge the upload
+#define TRACE_BAD_ECHO           6   // the address or size echoed is not the one requested
+
+#endif /* TRACE_H_ */
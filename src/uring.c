@@ -0,0 +1,226 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdint.h>     /* uint64_t */
+#include <string.h>     /* memset */
+#if defined(__linux__) && defined(HC32BOOT_IO_URING)
+#include <errno.h>      /* errno */
+#include <poll.h>       /* POLLIN */
+#include <time.h>       /* struct timespec */
+#include <unistd.h>     /* syscall, close */
+#include <sys/mman.h>   /* mmap, munmap */
+#include <sys/syscall.h> /* __NR_io_uring_setup */
+#include <linux/io_uring.h> /* struct io_uring_sqe */
+#endif
+#include "uring.h"
+
+#if defined(__linux__) && defined(HC32BOOT_IO_URING)
+//--------------------------------------------
+int uring_init(uring_t *ring, unsigned entries)
+{
+	struct io_uring_params p;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->fd < 0)
+	{
+		// no kernel support, or disabled (kernel.io_uring_disabled, seccomp)
+		return -1;
+	}
+	if (!(p.features & IORING_FEAT_EXT_ARG))
+	{
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->sq_len = ring->cq_len = ring->sq_len > ring->cq_len ? ring->sq_len : ring->cq_len;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+	{
+		close(ring->fd);
+		return -1;
+	}
+	ring->cq_ptr = ring->sq_ptr;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+		{
+			munmap(ring->sq_ptr, ring->sq_len);
+			close(ring->fd);
+			return -1;
+		}
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		if (ring->cq_ptr != ring->sq_ptr)
+		{
+			munmap(ring->cq_ptr, ring->cq_len);
+		}
+		munmap(ring->sq_ptr, ring->sq_len);
+		close(ring->fd);
+		return -1;
+	}
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->sq_entries = p.sq_entries;
+	ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+	ring->cqes = (char *)ring->cq_ptr + p.cq_off.cqes;
+	return 0;
+}
+
+//--------------------------------------------
+void uring_exit(uring_t *ring)
+{
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr)
+	{
+		munmap(ring->cq_ptr, ring->cq_len);
+	}
+	munmap(ring->sq_ptr, ring->sq_len);
+	// the pending polls are cancelled with the ring
+	close(ring->fd);
+}
+
+//--------------------------------------------
+static int enter(uring_t *ring, unsigned wait_nr, int timeout_ms)
+{
+	struct io_uring_getevents_arg arg;
+	struct timespec ts;
+	int res;
+
+	memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0)
+	{
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+	res = (int)syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait_nr,
+		(wait_nr ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (res >= 0)
+	{
+		ring->to_submit -= (unsigned)res < ring->to_submit ? (unsigned)res : ring->to_submit;
+		return 0;
+	}
+	return errno == ETIME || errno == EINTR ? 0 : -1;
+}
+
+//--------------------------------------------
+int uring_poll(uring_t *ring, int fd, int events, int multishot, uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *ring->sq_tail;
+	unsigned index;
+
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+	{
+		// the submission queue is full, hand it over to the kernel first
+		if (enter(ring, 0, -1))
+		{
+			return -1;
+		}
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+		{
+			return -1;
+		}
+	}
+	index = tail & *ring->sq_mask;
+	sqe = (struct io_uring_sqe *)ring->sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = (events & URING_POLL_IN ? POLLIN : 0) | (events & URING_POLL_OUT ? POLLOUT : 0);
+	sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return 0;
+}
+
+//--------------------------------------------
+int uring_wait(uring_t *ring, int timeout_ms, uring_cb_t cb, void *arg)
+{
+	unsigned head;
+	unsigned tail;
+
+	int pending;
+
+	head = *ring->cq_head;
+	pending = head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	// submit, and wait in the same system call if nothing has completed yet
+	if ((ring->to_submit || !pending) && enter(ring, pending ? 0 : 1, timeout_ms))
+	{
+		return -1;
+	}
+	tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+		struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+		cb(arg, cqe->user_data, cqe->res, (cqe->flags & IORING_CQE_F_MORE) != 0);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return 0;
+}
+#else
+//--------------------------------------------
+int uring_init(uring_t *ring, unsigned entries)
+{
+	(void)entries;
+	memset(ring, 0, sizeof(*ring));
+	return -1;
+}
+
+//--------------------------------------------
+void uring_exit(uring_t *ring)
+{
+	(void)ring;
+}
+
+//--------------------------------------------
+int uring_poll(uring_t *ring, int fd, int events, int multishot, uint64_t user_data)
+{
+	(void)ring;
+	(void)fd;
+	(void)events;
+	(void)multishot;
+	(void)user_data;
+	return -1;
+}
+
+//--------------------------------------------
+int uring_wait(uring_t *ring, int timeout_ms, uring_cb_t cb, void *arg)
+{
+	(void)ring;
+	(void)timeout_ms;
+	(void)cb;
+	(void)arg;
+	return -1;
+}
+#endif
@@ -0,0 +1,64 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <stdint.h>     /* uint64_t */
+#include <stddef.h>     /* size_t */
+
+//--------------------------------------------
+// Minimal io_uring ring on the raw system calls, only the poll requests
+// hc32boot_wait_all() needs. Built with HC32BOOT_IO_URING defined (make
+// IO_URING=1) on Linux, uring_init() fails otherwise and on kernels
+// without IORING_FEAT_EXT_ARG (5.11).
+typedef struct uring
+{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned to_submit;
+	void *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *cqes;
+	void *sq_ptr;
+	size_t sq_len;
+	void *cq_ptr;
+	size_t cq_len;
+	size_t sqes_len;
+} uring_t;
+
+//--------------------------------------------
+#define URING_POLL_IN            1
+#define URING_POLL_OUT           2
+
+//--------------------------------------------
+// called for every completion: res is the poll result or -errno,
+// more is set while a multishot poll stays armed
+typedef void (*uring_cb_t)(void *arg, uint64_t user_data, int res, int more);
+
+//--------------------------------------------
+int uring_init(uring_t *ring, unsigned entries);
+void uring_exit(uring_t *ring);
+// queued, submitted by the next uring_wait(); multishot polls report every wakeup
+int uring_poll(uring_t *ring, int fd, int events, int multishot, uint64_t user_data);
+// submits the queued requests and waits up to timeout_ms (-1: no limit) for a completion
+int uring_wait(uring_t *ring, int timeout_ms, uring_cb_t cb, void *arg);
+
+#endif /* URING_H_ */
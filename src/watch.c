@@ -0,0 +1,396 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#include <stdlib.h>     /* EXIT_SUCCESS */
+#include <stdio.h>      /* printf */
+#ifndef _WIN32
+#include <stdint.h>     /* uint64_t */
+#include <string.h>     /* strcmp, strlen, memchr, memcpy */
+#include <errno.h>      /* errno */
+#include <signal.h>     /* sigaction */
+#include <unistd.h>     /* fork, execvp, pipe */
+#include <fcntl.h>      /* fcntl */
+#include <poll.h>       /* poll */
+#include <time.h>       /* clock_gettime */
+#include <sys/wait.h>   /* waitpid */
+#ifdef __linux__
+#include <sys/inotify.h> /* inotify_init1 */
+#endif
+#include "serial.h"
+#endif
+#include "watch.h"
+
+#ifdef _WIN32
+//--------------------------------------------
+int watch_run(const char *self, char *const args[], int max_jobs)
+{
+	(void)self;
+	(void)args;
+	(void)max_jobs;
+	printf("ERROR: The -W option is not supported on Windows.\n");
+	return EXIT_FAILURE;
+}
+#else
+//--------------------------------------------
+#define WATCH_SETTLE_MS          300    // udev sets the permissions after the node appears
+#define WATCH_RESCAN_MS          2000   // without inotify, and in case an event is missed
+#define WATCH_LINE_SIZE          256
+
+//--------------------------------------------
+// port states
+#define PORT_PRESENT             0      // there before the watch started or already programmed
+#define PORT_PENDING             1      // appeared, waiting for a job slot
+#define PORT_RUNNING             2
+#define PORT_ABSENT              3      // unplugged, the next appearance starts a job
+
+//--------------------------------------------
+typedef struct port
+{
+	char name[MAX_SERDEVNAME + 16];
+	int state;
+	int seen;
+	pid_t pid;
+	int fd;                  // job stdout and stderr
+	char line[WATCH_LINE_SIZE];
+	size_t line_len;
+	uint64_t start_ms;
+	int ok_cnt;
+	int fail_cnt;
+} port_t;
+
+//--------------------------------------------
+static port_t ports[WATCH_MAX_PORTS];
+static int port_cnt;
+static int scanning_first;
+static volatile sig_atomic_t stop;
+
+//--------------------------------------------
+static uint64_t get_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//--------------------------------------------
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+//--------------------------------------------
+static const char *short_name(const port_t *port)
+{
+	const char *name = strrchr(port->name, '/');
+	return name ? name + 1 : port->name;
+}
+
+//--------------------------------------------
+static void on_port(void *arg, const char *devname, const char *scrname)
+{
+	int cnt;
+
+	(void)arg;
+	(void)scrname;
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		if (!strcmp(ports[cnt].name, devname))
+		{
+			break;
+		}
+	}
+	if (cnt == port_cnt)
+	{
+		if (port_cnt == WATCH_MAX_PORTS || strlen(devname) >= sizeof(ports[0].name))
+		{
+			return;
+		}
+		memset(&ports[port_cnt], 0, sizeof(ports[0]));
+		strcpy(ports[port_cnt].name, devname);
+		ports[port_cnt].state = PORT_ABSENT;
+		ports[port_cnt].fd = -1;
+		port_cnt++;
+	}
+	ports[cnt].seen = 1;
+	if (ports[cnt].state == PORT_ABSENT)
+	{
+		ports[cnt].state = scanning_first ? PORT_PRESENT : PORT_PENDING;
+		if (!scanning_first)
+		{
+			serial_port_info_t info;
+			if (!serial_port_info(devname, &info))
+			{
+				printf("New serial port %s (usb-path:%s vidpid:%04x:%04x usb-serial:%s).\n",
+					devname, info.usb_path, info.vid, info.pid, info.serial);
+			}
+			else
+			{
+				printf("New serial port %s.\n", devname);
+			}
+		}
+	}
+}
+
+//--------------------------------------------
+static void scan(void)
+{
+	int cnt;
+
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		ports[cnt].seen = 0;
+	}
+	serial_enum(on_port, NULL);
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		// a running job finds out by itself
+		if (!ports[cnt].seen && ports[cnt].state != PORT_RUNNING)
+		{
+			ports[cnt].state = PORT_ABSENT;
+		}
+	}
+}
+
+//--------------------------------------------
+static int job_start(port_t *port, const char *self, char *const args[])
+{
+	char opt_p[sizeof(port->name) + 2];
+	char *argv[WATCH_MAX_ARGS + 3];
+	int fds[2];
+	int cnt;
+
+	// the name is terminated within its buffer, opt_p has room for it
+	opt_p[0] = '-';
+	opt_p[1] = 'p';
+	memcpy(opt_p + 2, port->name, strlen(port->name) + 1);
+	argv[0] = (char *)self;
+	argv[1] = opt_p;
+	for (cnt = 0; args[cnt] && cnt < WATCH_MAX_ARGS; cnt++)
+	{
+		argv[cnt + 2] = args[cnt];
+	}
+	argv[cnt + 2] = NULL;
+
+	if (pipe(fds))
+	{
+		return -1;
+	}
+	fflush(stdout);
+	port->pid = fork();
+	if (port->pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (port->pid == 0)
+	{
+		// Ctrl-C stops the watch, not a board in the middle of programming
+		setpgid(0, 0);
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execvp(self, argv);
+		_exit(127);
+	}
+	close(fds[1]);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	port->fd = fds[0];
+	port->line_len = 0;
+	port->start_ms = get_time_ms();
+	port->state = PORT_RUNNING;
+	printf("[%s] Job started.\n", short_name(port));
+	return 0;
+}
+
+//--------------------------------------------
+static void job_output(port_t *port)
+{
+	char buf[WATCH_LINE_SIZE];
+	ssize_t len;
+	int status = -1;
+
+	len = read(port->fd, buf, sizeof(buf));
+	if (len < 0 && errno == EINTR)
+	{
+		return;
+	}
+	for (ssize_t cnt = 0; cnt < len; cnt++)
+	{
+		if ((buf[cnt] == '\n' && port->line_len) || port->line_len == sizeof(port->line) - 1)
+		{
+			printf("[%s] %.*s\n", short_name(port), (int)port->line_len, port->line);
+			port->line_len = 0;
+		}
+		if (buf[cnt] != '\n')
+		{
+			port->line[port->line_len++] = buf[cnt];
+		}
+	}
+	if (len > 0)
+	{
+		return;
+	}
+
+	// end of output: the job has finished
+	if (port->line_len)
+	{
+		printf("[%s] %.*s\n", short_name(port), (int)port->line_len, port->line);
+	}
+	close(port->fd);
+	port->fd = -1;
+	while (waitpid(port->pid, &status, 0) < 0 && errno == EINTR);
+	if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+	{
+		port->ok_cnt++;
+		printf("[%s] Job completed successfully in %.1f s.\n", short_name(port), (get_time_ms() - port->start_ms) / 1000.0);
+	}
+	else
+	{
+		port->fail_cnt++;
+		printf("[%s] ERROR: Job failed after %.1f s.\n", short_name(port), (get_time_ms() - port->start_ms) / 1000.0);
+	}
+	port->state = PORT_PRESENT;
+}
+
+//--------------------------------------------
+int watch_run(const char *self, char *const args[], int max_jobs)
+{
+	struct pollfd fds[WATCH_MAX_PORTS + 1];
+	port_t *fd_port[WATCH_MAX_PORTS + 1];
+	struct sigaction sa;
+	uint64_t scan_ms;
+	int notify = -1;
+	int ok_cnt = 0;
+	int fail_cnt = 0;
+	int cnt;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+#ifdef __linux__
+	notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify >= 0 && inotify_add_watch(notify, "/dev", IN_CREATE | IN_ATTRIB | IN_DELETE) < 0)
+	{
+		close(notify);
+		notify = -1;
+	}
+#endif
+
+	scanning_first = 1;
+	scan();
+	scanning_first = 0;
+	printf("Waiting for new serial ports, press Ctrl-C to stop.\n");
+	scan_ms = get_time_ms() + WATCH_RESCAN_MS;
+
+	for (;;)
+	{
+		int running = 0;
+		int nfds = 0;
+		int64_t timeout;
+
+		for (cnt = 0; cnt < port_cnt; cnt++)
+		{
+			running += ports[cnt].state == PORT_RUNNING;
+		}
+		for (cnt = 0; cnt < port_cnt && !stop && (!max_jobs || running < max_jobs); cnt++)
+		{
+			if (ports[cnt].state != PORT_PENDING)
+			{
+				continue;
+			}
+			if (job_start(&ports[cnt], self, args))
+			{
+				printf("[%s] ERROR: Could not start a job.\n", short_name(&ports[cnt]));
+				ports[cnt].state = PORT_PRESENT;
+				continue;
+			}
+			running++;
+		}
+		for (cnt = 0; cnt < port_cnt; cnt++)
+		{
+			if (ports[cnt].state == PORT_RUNNING)
+			{
+				fds[nfds].fd = ports[cnt].fd;
+				fds[nfds].events = POLLIN;
+				fd_port[nfds++] = &ports[cnt];
+			}
+		}
+		if (stop && !running)
+		{
+			break;
+		}
+		if (notify >= 0 && !stop)
+		{
+			fds[nfds].fd = notify;
+			fds[nfds].events = POLLIN;
+			fd_port[nfds++] = NULL;
+		}
+		fflush(stdout);
+
+		timeout = (int64_t)(scan_ms - get_time_ms());
+		if (poll(fds, nfds, stop ? -1 : timeout < 0 ? 0 : (int)timeout) < 0 && errno != EINTR)
+		{
+			break;
+		}
+		for (cnt = 0; cnt < nfds; cnt++)
+		{
+			if (!(fds[cnt].revents & (POLLIN | POLLHUP | POLLERR)))
+			{
+				continue;
+			}
+			if (fd_port[cnt])
+			{
+				job_output(fd_port[cnt]);
+			}
+			else
+			{
+				char buf[4096];
+				while (read(notify, buf, sizeof(buf)) > 0);
+				if (scan_ms > get_time_ms() + WATCH_SETTLE_MS)
+				{
+					scan_ms = get_time_ms() + WATCH_SETTLE_MS;
+				}
+			}
+		}
+		if (!stop && get_time_ms() >= scan_ms)
+		{
+			scan();
+			scan_ms = get_time_ms() + WATCH_RESCAN_MS;
+		}
+	}
+
+	if (notify >= 0)
+	{
+		close(notify);
+	}
+	printf("\nWatch summary:\n");
+	for (cnt = 0; cnt < port_cnt; cnt++)
+	{
+		if (ports[cnt].ok_cnt || ports[cnt].fail_cnt)
+		{
+			printf("  %s: %d completed, %d failed\n", ports[cnt].name, ports[cnt].ok_cnt, ports[cnt].fail_cnt);
+			ok_cnt += ports[cnt].ok_cnt;
+			fail_cnt += ports[cnt].fail_cnt;
+		}
+	}
+	printf("  total: %d completed, %d failed\n", ok_cnt, fail_cnt);
+	return fail_cnt ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+#endif
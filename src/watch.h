@@ -0,0 +1,30 @@
+/*
+* Copyright (c) 2024 Vladimir Alemasov
+* All rights reserved
+*
+* This program and the accompanying materials are distributed under
+* the terms of GNU General Public License version 2
+* as published by the Free Software Foundation.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*/
+
+#ifndef WATCH_H_
+#define WATCH_H_
+
+//--------------------------------------------
+#define WATCH_MAX_PORTS          64
+#define WATCH_MAX_ARGS           64
+
+//--------------------------------------------
+// Watches for serial ports that appear (serial_enum(), woken up by inotify
+// on /dev) and starts "<self> -p<port> <args>" for every new one, at most
+// max_jobs at a time (0: no limit). Job output is prefixed with the port name.
+// Runs until Ctrl-C, then waits for the running jobs and prints a summary.
+// Returns EXIT_SUCCESS if no job failed.
+int watch_run(const char *self, char *const args[], int max_jobs);
+
+#endif /* WATCH_H_ */
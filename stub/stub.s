@@ -0,0 +1,142 @@
+@
+@ Copyright (c) 2024 Vladimir Alemasov
+@ All rights reserved
+@
+@ This program and the accompanying materials are distributed under
+@ the terms of GNU General Public License version 2
+@ as published by the Free Software Foundation.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+
+@ HC32L110 stage-1 bootstrap stub, see buf_stub in src/hc32boot.c.
+@
+@ The ROM bootloader loads the stub at 0x20000000 at 9600 baud. The stub
+@ copies itself behind the flashloader image, divides the UART0 baud timer
+@ period by the ratio patched in by the host and reports the result with one
+@ byte at 9600 baud: 0xa5 if the baud rate is switched, 0x5a if the ratio
+@ does not divide the period. Then it receives the flashloader image to
+@ 0x20000000, sends its 8-bit sum, restores 9600 baud and starts it.
+@
+@ Build:
+@   llvm-mc -triple=thumbv6m-none-eabi -filetype=obj stub/stub.s -o stub.o
+@   llvm-objcopy -O binary -j .text stub.o stub.bin
+
+	.syntax unified
+	.cpu cortex-m0plus
+	.thumb
+
+	.equ LOAD_ADDR, 0x20000000
+	.equ RELOC_ADDR, 0x20000800     @ above the flashloader image, below its stack
+	.equ UART0, 0x40000000          @ SBUF 0x00, ISR 0x10 (bit 0 RI, bit 1 TI), ICR 0x14
+	.equ TIM0, 0x40000c00           @ ARR 0x00, CNT 0x04, UART0 baud rate timer
+
+	.text
+start:
+	@ same vector as the flashloader, so it does not matter whether
+	@ the ROM jumps to the image start or through the reset vector
+	.word 0x20000ab8
+	.word LOAD_ADDR + entry - start + 1
+entry:
+	cpsid i
+	ldr r0, =LOAD_ADDR
+	ldr r1, =RELOC_ADDR
+	movs r2, #0
+	ldr r3, =end - start
+copy:
+	ldr r4, [r0, r2]
+	str r4, [r1, r2]
+	adds r2, #4
+	cmp r2, r3
+	blo copy
+	ldr r0, =RELOC_ADDR + stage - start + 1
+	bx r0
+
+stage:
+	ldr r5, =UART0
+	ldr r6, =TIM0
+	ldr r0, [r6, #0]
+	mov r8, r0                      @ ARR at 9600 baud
+	movs r1, #1
+	lsls r1, r1, #16
+	subs r7, r1, r0                 @ timer period
+	ldr r2, ratio
+	movs r3, #0
+div:
+	cmp r7, r2
+	blo div_done
+	subs r7, r7, r2
+	adds r3, #1
+	b div
+div_done:
+	movs r4, #0x5a
+	cmp r7, #0
+	bne report
+	cmp r3, #0
+	beq report
+	movs r4, #0xa5
+report:
+	subs r0, r1, r3                 @ ARR for the stage-2 baud rate
+	bl tx
+	cmp r4, #0xa5
+	bne receive
+	str r0, [r6, #0]
+	str r0, [r6, #4]
+
+receive:
+	ldr r0, =LOAD_ADDR
+	ldr r1, length
+	movs r2, #0
+rx_wait:
+	ldr r3, [r5, #16]
+	lsls r3, r3, #31
+	bpl rx_wait
+	ldr r3, [r5, #20]
+	movs r7, #1
+	bics r3, r7
+	str r3, [r5, #20]
+	ldr r3, [r5, #0]
+	strb r3, [r0]
+	adds r2, r2, r3
+	adds r0, #1
+	subs r1, #1
+	bne rx_wait
+	uxtb r4, r2
+	bl tx
+
+	mov r0, r8
+	str r0, [r6, #0]
+	str r0, [r6, #4]
+	ldr r0, =LOAD_ADDR
+	ldr r1, [r0, #0]
+	msr msp, r1
+	ldr r1, [r0, #4]
+	bx r1
+
+@ sends r4, clobbers r3 and r7
+tx:
+	movs r7, #2
+	ldr r3, [r5, #20]
+	bics r3, r7
+	str r3, [r5, #20]
+	str r4, [r5, #0]
+tx_wait:
+	ldr r3, [r5, #16]
+	lsls r3, r3, #30
+	bpl tx_wait
+	ldr r3, [r5, #20]
+	bics r3, r7
+	str r3, [r5, #20]
+	bx lr
+
+	.ltorg
+	.balign 4
+@ patched by the host
+ratio:
+	.word 1                         @ stage-2 baud rate / 9600
+length:
+	.word 0                         @ flashloader image size
+end: